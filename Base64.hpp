@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace OlympusWebServer
+{
+  class Base64
+  {
+  public: // methods
+
+    // Decodes the standard or the URL-safe alphabet, with or without padding. Returns false on any other
+    // character.
+    static bool Decode(std::string const& text, std::string& output)
+    {
+      auto bits = 0u;
+      auto bitCount = 0;
+
+      for (auto it = text.begin(); it != text.end(); ++it)
+      {
+        auto c = *it;
+        auto value = 0u;
+        if (c >= 'A' && c <= 'Z')
+        {
+          value = static_cast<unsigned>(c - 'A');
+        }
+        else if (c >= 'a' && c <= 'z')
+        {
+          value = static_cast<unsigned>(c - 'a') + 26;
+        }
+        else if (c >= '0' && c <= '9')
+        {
+          value = static_cast<unsigned>(c - '0') + 52;
+        }
+        else if (c == '+' || c == '-')
+        {
+          value = 62;
+        }
+        else if (c == '/' || c == '_')
+        {
+          value = 63;
+        }
+        else if (c == '=')
+        {
+          break;
+        }
+        else
+        {
+          return false;
+        }
+
+        bits = (bits << 6) | value;
+        bitCount += 6;
+        if (bitCount >= 8)
+        {
+          bitCount -= 8;
+          output.push_back(static_cast<char>((bits >> bitCount) & 0xFF));
+        }
+      }
+
+      return true;
+    }
+
+    // Encodes with the standard alphabet and padding.
+    static std::string Encode(char const* data, std::size_t length)
+    {
+      static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+      auto bytes = reinterpret_cast<unsigned char const*>(data);
+      auto text = std::string();
+      text.reserve((length + 2) / 3 * 4);
+
+      for (auto i = std::size_t(); i < length; i += 3)
+      {
+        auto remaining = length - i;
+        auto group = static_cast<unsigned>(bytes[i]) << 16;
+        if (remaining > 1)
+        {
+          group |= static_cast<unsigned>(bytes[i + 1]) << 8;
+        }
+        if (remaining > 2)
+        {
+          group |= bytes[i + 2];
+        }
+
+        text.push_back(alphabet[(group >> 18) & 0x3F]);
+        text.push_back(alphabet[(group >> 12) & 0x3F]);
+        text.push_back(remaining > 1 ? alphabet[(group >> 6) & 0x3F] : '=');
+        text.push_back(remaining > 2 ? alphabet[group & 0x3F] : '=');
+      }
+
+      return text;
+    }
+  };
+} // namespace OlympusWebServer
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include "Threading.hpp"
+#include <vector>
+
+namespace OlympusWebServer
+{
+  // A fixed-size block of buffer memory. Chunks link into chains so a buffer can grow without reallocating.
+  class BufferChunk
+  {
+  public: // data
+
+    static const std::size_t Capacity = 4096 - sizeof(void*);
+
+    BufferChunk* next;
+    char data[Capacity];
+  };
+
+  // Leases chunks to the connections of one thread. Chunks are carved from slabs and recycled through a LIFO free
+  // list, so a released chunk is handed out again while it is still in cache and steady-state receives never
+  // touch the allocator.
+  class BufferPool
+  {
+  private: // data
+
+    static const std::size_t ChunksPerSlab = 64;
+
+    BufferChunk* freeList;
+    std::size_t freeCount;
+    std::vector<BufferChunk*> slabs;
+
+  public: // methods
+
+    BufferPool() :
+      freeList(NULL),
+      freeCount(0)
+    {
+    }
+
+    ~BufferPool()
+    {
+      for (auto it = slabs.begin(); it != slabs.end(); ++it)
+      {
+        delete[] *it;
+      }
+    }
+
+    BufferChunk* Acquire()
+    {
+      if (freeList == NULL)
+      {
+        AddSlab();
+      }
+
+      auto chunk = freeList;
+      freeList = chunk->next;
+      --freeCount;
+
+      chunk->next = NULL;
+      return chunk;
+    }
+
+    std::size_t GetFreeCount() const
+    {
+      return freeCount;
+    }
+
+    std::size_t GetTotalCount() const
+    {
+      return slabs.size() * ChunksPerSlab;
+    }
+
+    // Returns the pool for the calling thread. Chunks must be released on the thread that acquired them.
+    static BufferPool& GetThreadPool()
+    {
+      // Never freed: buffers owned by connections may outlive any point at which the pool could be destroyed.
+      static OLYMPUS_THREAD_LOCAL BufferPool* pool = NULL;
+      if (pool == NULL)
+      {
+        pool = new BufferPool();
+      }
+
+      return *pool;
+    }
+
+    void Release(BufferChunk* chunk)
+    {
+      chunk->next = freeList;
+      freeList = chunk;
+      ++freeCount;
+    }
+
+  private: // methods
+
+    BufferPool(BufferPool const&);
+    BufferPool& operator=(BufferPool const&);
+
+    void AddSlab()
+    {
+      auto slab = new BufferChunk[ChunksPerSlab];
+      slabs.push_back(slab);
+
+      for (auto i = 0u; i < ChunksPerSlab; ++i)
+      {
+        Release(&slab[i]);
+      }
+    }
+  };
+} // namespace OlympusWebServer
\ No newline at end of file
@@ -0,0 +1,240 @@
+#pragma once
+
+#include "LoadGenerator.hpp"
+#include <memory>
+#include <string>
+#include "Threading.hpp"
+#include "Trace.hpp"
+#include <vector>
+#include "Winsock.hpp"
+
+namespace OlympusWebServer
+{
+  // Opens every connection at once, sends one request on each and closes it after the response, the way clients
+  // reconnect after a deploy or load balancer failover. Latency runs from the connect call to the full response,
+  // so SYNs dropped from a full accept queue show up as retransmit-sized outliers.
+  class ConnectionStorm
+  {
+  private: // types
+
+    class Connection
+    {
+    public: // data
+
+      std::string input;
+      std::size_t sent;
+      SOCKET socket;
+      long long start;
+
+    public: // methods
+
+      Connection() :
+        sent(0),
+        socket(INVALID_SOCKET),
+        start(0)
+      {
+      }
+
+      Connection(Connection&& b)
+      {
+        *this = std::move(b);
+      }
+
+      Connection& operator=(Connection&& b)
+      {
+        input = std::move(b.input);
+        sent = b.sent;
+        socket = b.socket;
+        start = b.start;
+
+        b.socket = INVALID_SOCKET;
+
+        return *this;
+      }
+
+      ~Connection()
+      {
+        Close();
+      }
+
+      void Close()
+      {
+        if (socket != INVALID_SOCKET)
+        {
+          Winsock::DestroySocket(socket);
+          socket = INVALID_SOCKET;
+        }
+      }
+    };
+
+  private: // data
+
+    LoadGeneratorOptions options;
+
+  public: // methods
+
+    // Uses connections, threads, endpoint, request and durationSeconds (as the time limit) from options.
+    explicit ConnectionStorm(LoadGeneratorOptions options_) :
+      options(std::move(options_))
+    {
+      if (options.threads == 0 || options.connections < options.threads)
+      {
+        throw std::runtime_error("ConnectionStorm.ConnectionStorm - Needs at least one connection per thread");
+      }
+    }
+
+    LoadGeneratorResult Run()
+    {
+      Winsock::Initialize();
+
+      auto results = std::vector<LoadGeneratorResult>(options.threads);
+      auto threads = std::vector<std::unique_ptr<Thread>>();
+
+      auto start = TraceClock::Now();
+      auto deadline = start + TraceClock::FromMicroseconds(options.durationSeconds * 1000000.0);
+
+      for (auto i = 0u; i < options.threads; ++i)
+      {
+        auto connections = options.connections / options.threads + (i < options.connections % options.threads ? 1 : 0);
+        auto& result = results[i];
+        threads.push_back(std::unique_ptr<Thread>(new Thread([this, connections, deadline, &result]()
+        {
+          RunThread(connections, deadline, result);
+        })));
+      }
+
+      for (auto it = threads.begin(); it != threads.end(); ++it)
+      {
+        (*it)->Join();
+      }
+
+      auto total = LoadGeneratorResult();
+      for (auto it = results.begin(); it != results.end(); ++it)
+      {
+        total.Merge(*it);
+      }
+      total.elapsedSeconds = TraceClock::ToMicroseconds(TraceClock::Now() - start) / 1000000.0;
+
+      return total;
+    }
+
+  private: // methods
+
+    void RunThread(unsigned connectionCount, long long deadline, LoadGeneratorResult& result)
+    {
+      auto connections = std::vector<Connection>(connectionCount);
+      auto descriptors = std::vector<pollfd>(connectionCount);
+      auto remaining = connectionCount;
+
+      for (auto i = 0u; i < connectionCount; ++i)
+      {
+        auto& connection = connections[i];
+        connection.start = TraceClock::Now();
+        connection.socket = Winsock::CreateStreamSocket(options.endpoint.GetFamily());
+        if (connection.socket == INVALID_SOCKET || !Winsock::IoctlSocket(connection.socket, false))
+        {
+          throw std::runtime_error("ConnectionStorm.RunThread - Unable to create a socket");
+        }
+
+        if (!Winsock::Connect(connection.socket, options.endpoint.GetAddress(), options.endpoint.GetLength()) &&
+          WSAGetLastError() != WSAEINPROGRESS && WSAGetLastError() != WSAEWOULDBLOCK)
+        {
+          ++result.errors;
+          connection.Close();
+          --remaining;
+        }
+
+        descriptors[i].fd = connection.socket;
+        descriptors[i].events = POLLOUT;
+      }
+
+      for (auto now = TraceClock::Now(); remaining > 0 && now < deadline; now = TraceClock::Now())
+      {
+        if (Winsock::Poll(descriptors.data(), descriptors.size(), 10) <= 0)
+        {
+          continue;
+        }
+
+        now = TraceClock::Now();
+        for (auto i = 0u; i < connectionCount; ++i)
+        {
+          auto& connection = connections[i];
+          auto events = descriptors[i].revents;
+          if (connection.socket == INVALID_SOCKET || events == 0)
+          {
+            continue;
+          }
+
+          if (Step(connection, events, now, result))
+          {
+            descriptors[i].events = static_cast<short>(connection.sent < options.request.size() ? POLLOUT : POLLIN);
+            continue;
+          }
+
+          connection.Close();
+          descriptors[i].fd = INVALID_SOCKET;
+          --remaining;
+        }
+      }
+
+      result.timeouts += remaining;
+    }
+
+    // Advances one connection. Returns false once it is finished, successfully or not.
+    bool Step(Connection& connection, short events, long long now, LoadGeneratorResult& result)
+    {
+      if ((events & POLLERR) != 0)
+      {
+        ++result.errors;
+        return false;
+      }
+
+      if (connection.sent < options.request.size())
+      {
+        auto sent = Winsock::Send(connection.socket, options.request.substr(connection.sent));
+        if (sent == SOCKET_ERROR)
+        {
+          if (WSAGetLastError() == WSAEWOULDBLOCK)
+          {
+            return true;
+          }
+          ++result.errors;
+          return false;
+        }
+
+        connection.sent += static_cast<std::size_t>(sent);
+        return true;
+      }
+
+      char buffer[4096];
+      auto received = Winsock::Receive(connection.socket, buffer);
+      if (received == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK)
+      {
+        return true;
+      }
+      if (received <= 0)
+      {
+        ++result.errors;
+        return false;
+      }
+
+      connection.input.append(buffer, static_cast<std::size_t>(received));
+      auto isSuccess = false;
+      auto length = LoadGenerator::ParseResponse(connection.input, 0, isSuccess);
+      if (length == 0)
+      {
+        return true;
+      }
+
+      if (length == std::string::npos || !isSuccess)
+      {
+        ++result.errors;
+        return false;
+      }
+
+      ++result.completed;
+      result.latency.Record(static_cast<unsigned long long>(TraceClock::ToMicroseconds(now - connection.start) * 1000.0));
+      return false;
+    }
+  };
+} // namespace OlympusWebServer
\ No newline at end of file
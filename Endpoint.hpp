@@ -0,0 +1,325 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "Winsock.hpp"
+
+#ifndef _WIN32
+#include <sys/un.h>
+#endif
+
+namespace OlympusWebServer
+{
+  // An address a socket can listen on or connect to: IPv4, IPv6 (optionally dual-stack) or a Unix domain socket
+  // path. On Linux, a Unix path starting with '@' names a socket in the abstract namespace, which lives only as
+  // long as the listener and never touches the filesystem.
+  class Endpoint
+  {
+  private: // data
+
+    sockaddr_storage address;
+    socklen_t addressLength;
+    bool isDualStack;
+
+  public: // methods
+
+    Endpoint() :
+      addressLength(0),
+      isDualStack(false)
+    {
+      std::memset(&address, 0, sizeof(address));
+    }
+
+    // Every IPv4 and IPv6 interface, through one dual-stack IPv6 socket.
+    static Endpoint Any(unsigned short port)
+    {
+      return Ipv6("::", port, true);
+    }
+
+    // Copies an address filled in by the system, such as the peer address from accept.
+    static Endpoint FromAddress(sockaddr const* address, socklen_t addressLength)
+    {
+      auto endpoint = Endpoint();
+      if (addressLength > static_cast<socklen_t>(sizeof(endpoint.address)))
+      {
+        addressLength = static_cast<socklen_t>(sizeof(endpoint.address));
+      }
+      std::memcpy(&endpoint.address, address, addressLength);
+      endpoint.addressLength = addressLength;
+
+      return endpoint;
+    }
+
+    static Endpoint Ipv4(std::string const& host, unsigned short port)
+    {
+      auto endpoint = Endpoint();
+      auto& ipv4 = reinterpret_cast<sockaddr_in&>(endpoint.address);
+      ipv4.sin_family = AF_INET;
+      ipv4.sin_port = htons(port);
+      if (inet_pton(AF_INET, host.c_str(), &ipv4.sin_addr) != 1)
+      {
+        throw std::runtime_error("Endpoint.Ipv4 - Invalid IPv4 address: " + host);
+      }
+      endpoint.addressLength = sizeof(sockaddr_in);
+
+      return endpoint;
+    }
+
+    // A dual-stack socket also accepts IPv4 clients, which appear as IPv4-mapped IPv6 addresses.
+    static Endpoint Ipv6(std::string const& host, unsigned short port, bool dualStack = false)
+    {
+      auto endpoint = Endpoint();
+      auto& ipv6 = reinterpret_cast<sockaddr_in6&>(endpoint.address);
+      ipv6.sin6_family = AF_INET6;
+      ipv6.sin6_port = htons(port);
+      if (inet_pton(AF_INET6, host.c_str(), &ipv6.sin6_addr) != 1)
+      {
+        throw std::runtime_error("Endpoint.Ipv6 - Invalid IPv6 address: " + host);
+      }
+      endpoint.addressLength = sizeof(sockaddr_in6);
+      endpoint.isDualStack = dualStack;
+
+      return endpoint;
+    }
+
+    static Endpoint Loopback(unsigned short port)
+    {
+      auto endpoint = Endpoint();
+      reinterpret_cast<sockaddr_in&>(endpoint.address) = Winsock::GetLoopbackAddress(port);
+      endpoint.addressLength = sizeof(sockaddr_in);
+
+      return endpoint;
+    }
+
+    // Parses the forms written by ToString: "127.0.0.1:8800", "[::1]:8800", "unix:/run/app.sock" and
+    // "unix:@name". Also accepts "*:8800" for Any and a bare port for Loopback. The IPv6 wildcard "[::]" is
+    // dual-stack; other IPv6 addresses are not.
+    static Endpoint Parse(std::string const& text)
+    {
+      if (text.compare(0, 5, "unix:") == 0)
+      {
+        return Unix(text.substr(5));
+      }
+
+      auto colon = text.rfind(':');
+      if (colon == std::string::npos)
+      {
+        return Loopback(ParsePort(text));
+      }
+
+      auto host = text.substr(0, colon);
+      auto port = ParsePort(text.substr(colon + 1));
+
+      if (host == "*")
+      {
+        return Any(port);
+      }
+      if (host.size() >= 2 && host[0] == '[' && host[host.size() - 1] == ']')
+      {
+        host = host.substr(1, host.size() - 2);
+        return Ipv6(host, port, host == "::");
+      }
+
+      return Ipv4(host, port);
+    }
+
+    static Endpoint Unix(std::string const& path)
+    {
+#ifdef _WIN32
+      (void) path;
+      throw std::runtime_error("Endpoint.Unix - Unix domain sockets are not supported on this platform");
+#else
+      auto endpoint = Endpoint();
+      auto& local = reinterpret_cast<sockaddr_un&>(endpoint.address);
+      if (path.empty() || path.size() >= sizeof(local.sun_path))
+      {
+        throw std::runtime_error("Endpoint.Unix - Path is empty or too long: " + path);
+      }
+
+      local.sun_family = AF_UNIX;
+      std::memcpy(local.sun_path, path.data(), path.size());
+      endpoint.addressLength = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size() + 1);
+
+      if (path[0] == '@')
+      {
+#ifdef __linux__
+        // Abstract names are the bytes after a leading NUL, with no terminator counted in the length.
+        local.sun_path[0] = '\0';
+        --endpoint.addressLength;
+#else
+        throw std::runtime_error("Endpoint.Unix - The abstract namespace is only supported on Linux");
+#endif
+      }
+
+      return endpoint;
+#endif
+    }
+
+    sockaddr const* GetAddress() const
+    {
+      return reinterpret_cast<sockaddr const*>(&address);
+    }
+
+    int GetFamily() const
+    {
+      return address.ss_family;
+    }
+
+    socklen_t GetLength() const
+    {
+      return addressLength;
+    }
+
+    // The IP address as text, without the port or IPv6 brackets. Empty for Unix domain sockets.
+    std::string GetHost() const
+    {
+      char host[INET6_ADDRSTRLEN] = {};
+
+      switch (GetFamily())
+      {
+      case AF_INET:
+        inet_ntop(AF_INET, (void*) &reinterpret_cast<sockaddr_in const&>(address).sin_addr, host, sizeof(host));
+        return host;
+
+      case AF_INET6:
+        inet_ntop(AF_INET6, (void*) &reinterpret_cast<sockaddr_in6 const&>(address).sin6_addr, host, sizeof(host));
+        return host;
+
+      default:
+        return std::string();
+      }
+    }
+
+    // Zero for Unix domain sockets.
+    unsigned short GetPort() const
+    {
+      switch (GetFamily())
+      {
+      case AF_INET:
+        return ntohs(reinterpret_cast<sockaddr_in const&>(address).sin_port);
+
+      case AF_INET6:
+        return ntohs(reinterpret_cast<sockaddr_in6 const&>(address).sin6_port);
+
+      default:
+        return 0;
+      }
+    }
+
+    // Filesystem path of a Unix domain socket, or an empty string for abstract and IP endpoints.
+    std::string GetUnixPath() const
+    {
+#ifndef _WIN32
+      if (IsUnix())
+      {
+        auto path = reinterpret_cast<sockaddr_un const&>(address).sun_path;
+        if (path[0] != '\0')
+        {
+          return path;
+        }
+      }
+#endif
+
+      return std::string();
+    }
+
+    bool IsDualStack() const
+    {
+      return isDualStack;
+    }
+
+    // True for a Unix domain socket or a loopback address, including IPv4 loopback mapped into IPv6.
+    bool IsLocal() const
+    {
+      switch (GetFamily())
+      {
+      case AF_INET:
+        return (ntohl(reinterpret_cast<sockaddr_in const&>(address).sin_addr.s_addr) >> 24) == 127;
+
+      case AF_INET6:
+        {
+          auto& host = reinterpret_cast<sockaddr_in6 const&>(address).sin6_addr;
+          return IN6_IS_ADDR_LOOPBACK(&host) || (IN6_IS_ADDR_V4MAPPED(&host) && host.s6_addr[12] == 127);
+        }
+
+      default:
+        return IsUnix();
+      }
+    }
+
+    bool IsUnix() const
+    {
+#ifdef _WIN32
+      return false;
+#else
+      return GetFamily() == AF_UNIX;
+#endif
+    }
+
+    void SetPort(unsigned short port)
+    {
+      switch (GetFamily())
+      {
+      case AF_INET:
+        reinterpret_cast<sockaddr_in&>(address).sin_port = htons(port);
+        break;
+
+      case AF_INET6:
+        reinterpret_cast<sockaddr_in6&>(address).sin6_port = htons(port);
+        break;
+      }
+    }
+
+    std::string ToString() const
+    {
+      switch (GetFamily())
+      {
+      case AF_INET:
+        return GetHost() + ":" + PortToString(GetPort());
+
+      case AF_INET6:
+        return "[" + GetHost() + "]:" + PortToString(GetPort());
+
+#ifndef _WIN32
+      case AF_UNIX:
+        {
+          auto path = reinterpret_cast<sockaddr_un const&>(address).sun_path;
+          if (path[0] == '\0')
+          {
+            return "unix:@" + std::string(path + 1, addressLength - offsetof(sockaddr_un, sun_path) - 1);
+          }
+          return "unix:" + std::string(path);
+        }
+#endif
+
+      default:
+        return std::string();
+      }
+    }
+
+  private: // methods
+
+    static unsigned short ParsePort(std::string const& text)
+    {
+      auto end = static_cast<char*>(NULL);
+      auto port = std::strtoul(text.c_str(), &end, 10);
+      if (text.empty() || *end != '\0' || port > 65535)
+      {
+        throw std::runtime_error("Endpoint.Parse - Invalid port: " + text);
+      }
+
+      return static_cast<unsigned short>(port);
+    }
+
+    static std::string PortToString(unsigned short port)
+    {
+      char text[8];
+      std::sprintf(text, "%u", static_cast<unsigned>(port));
+      return text;
+    }
+  };
+} // namespace OlympusWebServer
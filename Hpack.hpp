@@ -0,0 +1,627 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace OlympusWebServer
+{
+  typedef std::pair<std::string, std::string> HttpHeader;
+  typedef std::vector<HttpHeader> HttpHeaderList;
+
+  // Decodes the static Huffman code HPACK uses for string literals (RFC 7541 appendix B). The code is canonical,
+  // so it is described by the number of codes of each length plus the symbols in code order.
+  class HpackHuffman
+  {
+  public: // methods
+
+    // Appends the decoded string to output. Returns false if the input holds EOS, or padding longer than seven
+    // bits or not made of ones.
+    static bool Decode(unsigned char const* data, std::size_t length, std::string& output)
+    {
+      static const unsigned short counts[] =
+      {
+        0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+      };
+      static const unsigned short symbols[] =
+      {
+        48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+        52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+        110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+        77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+        119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+        43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+        195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+        179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+        163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+        233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+        158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+        144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+        200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+        212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+        2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+        21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22,
+        256
+      };
+      static const unsigned MaxCodeLength = 30;
+      static const unsigned short EndOfString = 256;
+
+      // Walks the code one bit at a time: code is the bits read so far, first the first code of the current
+      // length and index the position of that code's symbol.
+      auto code = 0u;
+      auto first = 0u;
+      auto index = 0u;
+      auto codeLength = 0u;
+      auto isAllOnes = true;
+
+      for (auto i = std::size_t(); i < length; ++i)
+      {
+        for (auto bit = 7; bit >= 0; --bit)
+        {
+          auto value = (data[i] >> bit) & 1u;
+          code |= value;
+          isAllOnes = isAllOnes && value == 1;
+          ++codeLength;
+
+          auto count = counts[codeLength];
+          if (code - first < count)
+          {
+            auto symbol = symbols[index + code - first];
+            if (symbol == EndOfString)
+            {
+              return false;
+            }
+
+            output.push_back(static_cast<char>(symbol));
+            code = first = index = codeLength = 0;
+            isAllOnes = true;
+            continue;
+          }
+
+          if (codeLength == MaxCodeLength)
+          {
+            return false;
+          }
+
+          index += count;
+          first = (first + count) << 1;
+          code <<= 1;
+        }
+      }
+
+      return codeLength <= 7 && isAllOnes;
+    }
+  };
+
+  // The HPACK header table: the 61 static entries followed by a dynamic table of recently coded headers, newest
+  // first, bounded by a size in octets that counts 32 bytes of overhead per entry (RFC 7541 section 4.1).
+  class HpackTable
+  {
+  public: // data
+
+    static const std::size_t DefaultSize = 4096;
+    static const std::size_t StaticCount = 61;
+
+  private: // data
+
+    std::deque<HttpHeader> entries;
+    std::size_t maxSize;
+    std::size_t size;
+
+  public: // methods
+
+    HpackTable() :
+      maxSize(DefaultSize),
+      size(0)
+    {
+    }
+
+    HpackTable(HpackTable&& b)
+    {
+      *this = std::move(b);
+    }
+
+    HpackTable& operator=(HpackTable&& b)
+    {
+      entries = std::move(b.entries);
+      maxSize = b.maxSize;
+      size = b.size;
+
+      return *this;
+    }
+
+    // Inserts at the front of the dynamic table, evicting from the back to make room. An entry larger than the
+    // whole table just empties it.
+    void Add(std::string name, std::string value)
+    {
+      auto entrySize = GetEntrySize(name, value);
+      if (entrySize > maxSize)
+      {
+        entries.clear();
+        size = 0;
+        return;
+      }
+
+      size += entrySize;
+      entries.push_front(HttpHeader(std::move(name), std::move(value)));
+      Evict();
+    }
+
+    // Returns the index of the entry matching name and value, or failing that the first matching name (with
+    // isValueMatch false), or zero if the name is not in the table.
+    std::size_t Find(std::string const& name, std::string const& value, bool& isValueMatch) const
+    {
+      auto nameIndex = std::size_t();
+      isValueMatch = false;
+
+      for (auto i = 1u; i <= StaticCount; ++i)
+      {
+        auto& entry = GetStaticEntry(i);
+        if (name == entry.name)
+        {
+          if (value == entry.value)
+          {
+            isValueMatch = true;
+            return i;
+          }
+          nameIndex = nameIndex == 0 ? i : nameIndex;
+        }
+      }
+
+      for (auto i = 0u; i < entries.size(); ++i)
+      {
+        if (entries[i].first == name)
+        {
+          if (entries[i].second == value)
+          {
+            isValueMatch = true;
+            return StaticCount + 1 + i;
+          }
+          nameIndex = nameIndex == 0 ? StaticCount + 1 + i : nameIndex;
+        }
+      }
+
+      return nameIndex;
+    }
+
+    // Copies out the entry at a 1-based index. Returns false if the index is out of range.
+    bool Get(std::size_t index, std::string& name, std::string& value) const
+    {
+      if (index >= 1 && index <= StaticCount)
+      {
+        auto& entry = GetStaticEntry(index);
+        name = entry.name;
+        value = entry.value;
+        return true;
+      }
+
+      index -= StaticCount + 1;
+      if (index >= entries.size())
+      {
+        return false;
+      }
+
+      name = entries[index].first;
+      value = entries[index].second;
+      return true;
+    }
+
+    // Returns the size the entry at a 1-based index counts for (RFC 7541 section 4.1), or zero if the index is out
+    // of range.
+    std::size_t GetEntrySize(std::size_t index) const
+    {
+      if (index >= 1 && index <= StaticCount)
+      {
+        auto& entry = GetStaticEntry(index);
+        return std::strlen(entry.name) + std::strlen(entry.value) + 32;
+      }
+
+      index -= StaticCount + 1;
+      return index < entries.size() ? GetEntrySize(entries[index].first, entries[index].second) : 0;
+    }
+
+    std::size_t GetMaxSize() const
+    {
+      return maxSize;
+    }
+
+    void SetMaxSize(std::size_t maxSize_)
+    {
+      maxSize = maxSize_;
+      Evict();
+    }
+
+  private: // types
+
+    class StaticEntry
+    {
+    public: // data
+
+      char const* name;
+      char const* value;
+    };
+
+  private: // methods
+
+    HpackTable(HpackTable const&);
+    HpackTable& operator=(HpackTable const&);
+
+    void Evict()
+    {
+      while (size > maxSize)
+      {
+        size -= GetEntrySize(entries.back().first, entries.back().second);
+        entries.pop_back();
+      }
+    }
+
+    static std::size_t GetEntrySize(std::string const& name, std::string const& value)
+    {
+      return name.size() + value.size() + 32;
+    }
+
+    static StaticEntry const& GetStaticEntry(std::size_t index)
+    {
+      static const StaticEntry staticTable[StaticCount] =
+      {
+        { ":authority", "" },
+        { ":method", "GET" },
+        { ":method", "POST" },
+        { ":path", "/" },
+        { ":path", "/index.html" },
+        { ":scheme", "http" },
+        { ":scheme", "https" },
+        { ":status", "200" },
+        { ":status", "204" },
+        { ":status", "206" },
+        { ":status", "304" },
+        { ":status", "400" },
+        { ":status", "404" },
+        { ":status", "500" },
+        { "accept-charset", "" },
+        { "accept-encoding", "gzip, deflate" },
+        { "accept-language", "" },
+        { "accept-ranges", "" },
+        { "accept", "" },
+        { "access-control-allow-origin", "" },
+        { "age", "" },
+        { "allow", "" },
+        { "authorization", "" },
+        { "cache-control", "" },
+        { "content-disposition", "" },
+        { "content-encoding", "" },
+        { "content-language", "" },
+        { "content-length", "" },
+        { "content-location", "" },
+        { "content-range", "" },
+        { "content-type", "" },
+        { "cookie", "" },
+        { "date", "" },
+        { "etag", "" },
+        { "expect", "" },
+        { "expires", "" },
+        { "from", "" },
+        { "host", "" },
+        { "if-match", "" },
+        { "if-modified-since", "" },
+        { "if-none-match", "" },
+        { "if-range", "" },
+        { "if-unmodified-since", "" },
+        { "last-modified", "" },
+        { "link", "" },
+        { "location", "" },
+        { "max-forwards", "" },
+        { "proxy-authenticate", "" },
+        { "proxy-authorization", "" },
+        { "range", "" },
+        { "referer", "" },
+        { "refresh", "" },
+        { "retry-after", "" },
+        { "server", "" },
+        { "set-cookie", "" },
+        { "strict-transport-security", "" },
+        { "transfer-encoding", "" },
+        { "user-agent", "" },
+        { "vary", "" },
+        { "via", "" },
+        { "www-authenticate", "" }
+      };
+
+      return staticTable[index - 1];
+    }
+  };
+
+  // Decodes header blocks received on one connection. The dynamic table carries over from block to block, so
+  // every block must be decoded, in order, even for streams that are then refused.
+  class HpackDecoder
+  {
+  private: // data
+
+    std::size_t maxListSize;
+    std::size_t maxTableSize;
+    HpackTable table;
+
+  public: // methods
+
+    HpackDecoder() :
+      maxListSize(static_cast<std::size_t>(-1)),
+      maxTableSize(HpackTable::DefaultSize)
+    {
+    }
+
+    HpackDecoder(HpackDecoder&& b)
+    {
+      *this = std::move(b);
+    }
+
+    HpackDecoder& operator=(HpackDecoder&& b)
+    {
+      maxListSize = b.maxListSize;
+      maxTableSize = b.maxTableSize;
+      table = std::move(b.table);
+
+      return *this;
+    }
+
+    // Appends the headers in a complete block. Returns false on a compression error, or as soon as the block's
+    // header list grows past the limit set with SetMaxListSize. Either leaves the table out of step with the
+    // peer's, so the connection cannot continue.
+    bool Decode(char const* block, std::size_t length, HttpHeaderList& headers)
+    {
+      auto data = reinterpret_cast<unsigned char const*>(block);
+      auto end = data + length;
+      auto isHeaderSeen = false;
+      auto listSize = std::size_t();
+
+      while (data < end)
+      {
+        auto index = std::size_t();
+        auto name = std::string();
+        auto value = std::string();
+
+        if ((*data & 0x80) != 0) // indexed field
+        {
+          if (!DecodeInteger(data, end, 7, index) || index == 0)
+          {
+            return false;
+          }
+
+          // A few bytes can reference a large entry over and over, so the size is checked before it is copied.
+          auto entrySize = table.GetEntrySize(index);
+          listSize += entrySize;
+          if (entrySize == 0 || listSize > maxListSize || !table.Get(index, name, value))
+          {
+            return false;
+          }
+          headers.push_back(HttpHeader(std::move(name), std::move(value)));
+          isHeaderSeen = true;
+          continue;
+        }
+
+        if ((*data & 0xE0) == 0x20) // dynamic table size update, only allowed before the first field
+        {
+          if (isHeaderSeen || !DecodeInteger(data, end, 5, index) || index > maxTableSize)
+          {
+            return false;
+          }
+          table.SetMaxSize(index);
+          continue;
+        }
+
+        // Literal with incremental indexing (01), without indexing (0000) or never indexed (0001).
+        auto isIndexed = (*data & 0xC0) == 0x40;
+        if (!DecodeInteger(data, end, isIndexed ? 6 : 4, index))
+        {
+          return false;
+        }
+        if (index == 0 ? !DecodeString(data, end, name) : !table.Get(index, name, value))
+        {
+          return false;
+        }
+        value.clear();
+        if (!DecodeString(data, end, value))
+        {
+          return false;
+        }
+
+        listSize += name.size() + value.size() + 32;
+        if (listSize > maxListSize)
+        {
+          return false;
+        }
+
+        if (isIndexed)
+        {
+          table.Add(name, value);
+        }
+        headers.push_back(HttpHeader(std::move(name), std::move(value)));
+        isHeaderSeen = true;
+      }
+
+      return true;
+    }
+
+    // Limits the size of each decoded header list, counted as in SETTINGS_MAX_HEADER_LIST_SIZE: the length of
+    // every name and value plus 32 bytes per field.
+    void SetMaxListSize(std::size_t maxListSize_)
+    {
+      maxListSize = maxListSize_;
+    }
+
+  private: // methods
+
+    HpackDecoder(HpackDecoder const&);
+    HpackDecoder& operator=(HpackDecoder const&);
+
+    // Reads an integer with an N-bit prefix (RFC 7541 section 5.1), rejecting values too large for a header table.
+    static bool DecodeInteger(unsigned char const*& data, unsigned char const* end, int prefixBits, std::size_t& value)
+    {
+      auto prefixMax = (1u << prefixBits) - 1u;
+      value = *data++ & prefixMax;
+      if (value < prefixMax)
+      {
+        return true;
+      }
+
+      for (auto shift = 0; data < end && shift <= 21; shift += 7)
+      {
+        auto byte = *data++;
+        value += static_cast<std::size_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    static bool DecodeString(unsigned char const*& data, unsigned char const* end, std::string& value)
+    {
+      if (data == end)
+      {
+        return false;
+      }
+
+      auto isHuffman = (*data & 0x80) != 0;
+      auto length = std::size_t();
+      if (!DecodeInteger(data, end, 7, length) || length > static_cast<std::size_t>(end - data))
+      {
+        return false;
+      }
+
+      if (isHuffman)
+      {
+        value.reserve(length + length / 2);
+        if (!HpackHuffman::Decode(data, length, value))
+        {
+          return false;
+        }
+      }
+      else
+      {
+        value.assign(reinterpret_cast<char const*>(data), length);
+      }
+
+      data += length;
+      return true;
+    }
+  };
+
+  // Encodes header blocks sent on one connection. Strings are sent as raw octets; repeated headers are indexed
+  // through the dynamic table instead, which saves far more on a busy connection than Huffman coding would.
+  class HpackEncoder
+  {
+  private: // data
+
+    std::size_t pendingTableSize;
+    HpackTable table;
+
+  public: // methods
+
+    HpackEncoder() :
+      pendingTableSize(0)
+    {
+    }
+
+    HpackEncoder(HpackEncoder&& b)
+    {
+      *this = std::move(b);
+    }
+
+    HpackEncoder& operator=(HpackEncoder&& b)
+    {
+      pendingTableSize = b.pendingTableSize;
+      table = std::move(b.table);
+
+      return *this;
+    }
+
+    // Appends one field to a header block. Fields whose values change from message to message, like
+    // content-length, are not indexed so they do not push the stable ones out of the table.
+    void Encode(std::string const& name, std::string const& value, std::string& block)
+    {
+      if (pendingTableSize != 0)
+      {
+        EncodeInteger(0x20, 5, pendingTableSize - 1, block); // size update must lead the block
+        pendingTableSize = 0;
+      }
+
+      auto isValueMatch = false;
+      auto index = table.Find(name, value, isValueMatch);
+      if (isValueMatch)
+      {
+        EncodeInteger(0x80, 7, index, block);
+        return;
+      }
+
+      auto isIndexed = name != "content-length" && name != "date" && name != ":path";
+      if (isIndexed)
+      {
+        EncodeInteger(0x40, 6, index, block);
+      }
+      else
+      {
+        EncodeInteger(0x00, 4, index, block);
+      }
+
+      if (index == 0)
+      {
+        EncodeString(name, block);
+      }
+      EncodeString(value, block);
+
+      if (isIndexed)
+      {
+        table.Add(name, value);
+      }
+    }
+
+    // Applies the peer's SETTINGS_HEADER_TABLE_SIZE. Capped at the default, which is all this encoder needs.
+    void SetMaxTableSize(std::size_t maxSize)
+    {
+      if (maxSize > HpackTable::DefaultSize)
+      {
+        maxSize = HpackTable::DefaultSize;
+      }
+      if (maxSize != table.GetMaxSize())
+      {
+        table.SetMaxSize(maxSize);
+        pendingTableSize = maxSize + 1; // stored plus one so a new size of zero is still sent
+      }
+    }
+
+  private: // methods
+
+    HpackEncoder(HpackEncoder const&);
+    HpackEncoder& operator=(HpackEncoder const&);
+
+    static void EncodeInteger(unsigned char flags, int prefixBits, std::size_t value, std::string& block)
+    {
+      auto prefixMax = (1u << prefixBits) - 1u;
+      if (value < prefixMax)
+      {
+        block.push_back(static_cast<char>(flags | value));
+        return;
+      }
+
+      block.push_back(static_cast<char>(flags | prefixMax));
+      value -= prefixMax;
+      while (value >= 0x80)
+      {
+        block.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+      }
+      block.push_back(static_cast<char>(value));
+    }
+
+    static void EncodeString(std::string const& value, std::string& block)
+    {
+      EncodeInteger(0x00, 7, value.size(), block);
+      block += value;
+    }
+  };
+} // namespace OlympusWebServer
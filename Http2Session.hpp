@@ -0,0 +1,1092 @@
+#pragma once
+
+#include "Base64.hpp"
+#include <cctype>
+#include <deque>
+#include "Hpack.hpp"
+#include "HttpResponse.hpp"
+#include "ReceiveBuffer.hpp"
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace OlympusWebServer
+{
+  namespace Http2Error
+  {
+    enum Value
+    {
+      NoError = 0x0,
+      ProtocolError = 0x1,
+      InternalError = 0x2,
+      FlowControlError = 0x3,
+      SettingsTimeout = 0x4,
+      StreamClosed = 0x5,
+      FrameSizeError = 0x6,
+      RefusedStream = 0x7,
+      Cancel = 0x8,
+      CompressionError = 0x9,
+      EnhanceYourCalm = 0xb,
+      Http11Required = 0xd
+    };
+  }
+
+  namespace Http2Flag
+  {
+    enum Value
+    {
+      Ack = 0x1,
+      EndStream = 0x1,
+      EndHeaders = 0x4,
+      Padded = 0x8,
+      Priority = 0x20
+    };
+  }
+
+  namespace Http2FrameType
+  {
+    enum Value
+    {
+      Data = 0x0,
+      Headers = 0x1,
+      Priority = 0x2,
+      ResetStream = 0x3,
+      Settings = 0x4,
+      PushPromise = 0x5,
+      Ping = 0x6,
+      GoAway = 0x7,
+      WindowUpdate = 0x8,
+      Continuation = 0x9
+    };
+  }
+
+  namespace Http2Setting
+  {
+    enum Value
+    {
+      HeaderTableSize = 0x1,
+      EnablePush = 0x2,
+      MaxConcurrentStreams = 0x3,
+      InitialWindowSize = 0x4,
+      MaxFrameSize = 0x5,
+      MaxHeaderListSize = 0x6
+    };
+  }
+
+  // The server side of one HTTP/2 connection (RFC 7540). Frames are parsed out of the connection's receive buffer
+  // and every frame the server writes is appended to an output buffer for the connection to flush, so the
+  // responses to all the streams served in one update go out in as few sends as possible.
+  //
+  // Each stream's request is handed out only once it is complete, rewritten into HTTP/1.1 message form so it
+  // parses into the same HttpRequest as a request on an HTTP/1.1 connection.
+  class Http2Session
+  {
+  public: // data
+
+    static const std::size_t FrameHeaderLength = 9;
+
+    // Receive window for the whole connection, replenished once half of it has been used.
+    static const long long ConnectionWindow = 4ll * 1024 * 1024;
+
+    // Largest header block accepted, after CONTINUATION frames are joined.
+    static const std::size_t MaxHeaderBlockLength = 64u * 1024u;
+
+    // Largest decoded header list accepted, advertised as SETTINGS_MAX_HEADER_LIST_SIZE. A small block can decode
+    // into a much larger list, so this is enforced while decoding rather than on the block.
+    static const std::size_t MaxHeaderListSize = 64u * 1024u;
+
+    static const unsigned MaxStreams = 128;
+
+    // SETTINGS_MAX_FRAME_SIZE is left at its default, so this is the largest frame a client may send.
+    static const std::size_t MaxFrameLength = 16384;
+
+    static const std::size_t PrefaceLength = 24;
+
+    // Receive window of each stream. Stream windows are never replenished, so this is also the largest request
+    // body a client can send.
+    static const long long StreamWindow = 1024ll * 1024;
+
+  private: // types
+
+    class Stream
+    {
+    public: // data
+
+      std::string body;
+      HttpHeaderList headers;
+      bool isRequestComplete;
+      bool isResponding;
+      bool isTracked; // its completion is reported through TakeFinishedStream
+      std::string pendingData;
+      std::size_t pendingOffset;
+      long long receiveWindow;
+      long long sendWindow;
+
+    public: // methods
+
+      Stream() :
+        isRequestComplete(false),
+        isResponding(false),
+        isTracked(false),
+        pendingOffset(0),
+        receiveWindow(StreamWindow),
+        sendWindow(0)
+      {
+      }
+
+      Stream(Stream&& b)
+      {
+        *this = std::move(b);
+      }
+
+      Stream& operator=(Stream&& b)
+      {
+        body = std::move(b.body);
+        headers = std::move(b.headers);
+        isRequestComplete = b.isRequestComplete;
+        isResponding = b.isResponding;
+        isTracked = b.isTracked;
+        pendingData = std::move(b.pendingData);
+        pendingOffset = b.pendingOffset;
+        receiveWindow = b.receiveWindow;
+        sendWindow = b.sendWindow;
+
+        return *this;
+      }
+    };
+
+  private: // data
+
+    static const long long MaxWindow = 0x7FFFFFFF;
+    static const long long DefaultWindow = 65535;
+
+    long long connectionReceiveWindow;
+    long long connectionSendWindow;
+    HpackDecoder decoder;
+    HpackEncoder encoder;
+
+    // Tracked streams whose last frame has been queued, each with the length of the output just past that frame.
+    std::vector<std::pair<unsigned, std::size_t>> finishedStreams;
+
+    std::string headerBlock;
+    bool headerBlockEndsStream;
+    unsigned headerBlockStream;
+    bool isClosing;
+    bool isPrefaceReceived;
+    bool isSettingsReceived;
+    unsigned lastStreamId;
+    std::string output;
+    std::string payload;
+    long long peerInitialWindow;
+    std::size_t peerMaxFrameLength;
+    std::deque<unsigned> readyStreams;
+    std::unordered_map<unsigned, Stream> streams;
+
+  public: // methods
+
+    Http2Session() :
+      connectionReceiveWindow(ConnectionWindow),
+      connectionSendWindow(DefaultWindow),
+      headerBlockEndsStream(false),
+      headerBlockStream(0),
+      isClosing(false),
+      isPrefaceReceived(false),
+      isSettingsReceived(false),
+      lastStreamId(0),
+      peerInitialWindow(DefaultWindow),
+      peerMaxFrameLength(MaxFrameLength)
+    {
+      decoder.SetMaxListSize(MaxHeaderListSize);
+
+      // The server's preface is its SETTINGS frame, which may be sent before the client's preface arrives.
+      WriteFrameHeader(18, Http2FrameType::Settings, 0, 0);
+      WriteSetting(Http2Setting::MaxConcurrentStreams, MaxStreams);
+      WriteSetting(Http2Setting::InitialWindowSize, static_cast<unsigned>(StreamWindow));
+      WriteSetting(Http2Setting::MaxHeaderListSize, static_cast<unsigned>(MaxHeaderListSize));
+      WriteWindowUpdate(0, static_cast<unsigned>(ConnectionWindow - DefaultWindow));
+    }
+
+    // Continues a connection upgraded from HTTP/1.1 with "Upgrade: h2c". The client's HTTP2-Settings header is
+    // applied and stream 1 is opened, half closed, for the upgrade request: the caller already has that request
+    // and answers it with SendResponse like any other. Returns false if the settings do not decode.
+    bool AcceptUpgrade(std::string const& encodedSettings)
+    {
+      auto settings = std::string();
+      if (!Base64::Decode(encodedSettings, settings) || settings.size() % 6 != 0 ||
+        ApplySettings(settings.data(), settings.size()) != Http2Error::NoError)
+      {
+        return false;
+      }
+
+      auto stream = Stream();
+      stream.isRequestComplete = true;
+      stream.sendWindow = peerInitialWindow;
+      streams.insert(std::make_pair(1u, std::move(stream)));
+      lastStreamId = 1;
+
+      return true;
+    }
+
+    // Appends a frame header. Public, like ReadUint32, for the benchmark's HTTP/2 client.
+    static void AppendFrameHeader(
+      std::string& frames,
+      std::size_t length,
+      Http2FrameType::Value type,
+      unsigned char flags,
+      unsigned streamId)
+    {
+      frames.push_back(static_cast<char>((length >> 16) & 0xFF));
+      frames.push_back(static_cast<char>((length >> 8) & 0xFF));
+      frames.push_back(static_cast<char>(length & 0xFF));
+      frames.push_back(static_cast<char>(type));
+      frames.push_back(static_cast<char>(flags));
+      AppendUint32(frames, streamId);
+    }
+
+    static void AppendUint32(std::string& frames, unsigned value)
+    {
+      frames.push_back(static_cast<char>((value >> 24) & 0xFF));
+      frames.push_back(static_cast<char>((value >> 16) & 0xFF));
+      frames.push_back(static_cast<char>((value >> 8) & 0xFF));
+      frames.push_back(static_cast<char>(value & 0xFF));
+    }
+
+    // Frames waiting to be written to the socket. The caller removes what it manages to send.
+    std::string& GetOutput()
+    {
+      return output;
+    }
+
+    static char const* GetPreface()
+    {
+      return "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    }
+
+    // True once a connection error has been sent in a GOAWAY frame. The connection should be closed after the
+    // output is flushed.
+    bool IsClosing() const
+    {
+      return isClosing;
+    }
+
+    // Takes the next stream whose request has fully arrived, as an HTTP/1.1-style message with an "HTTP/2.0"
+    // version. Pseudo-headers become the request line and :authority becomes Host. Streams whose requests are
+    // malformed (RFC 9113 section 8.1.1) are reset instead, since their fields could not be rewritten without
+    // changing what the request says.
+    bool ReadRequest(std::string& request, unsigned& streamId)
+    {
+      while (!readyStreams.empty())
+      {
+        streamId = readyStreams.front();
+        readyStreams.pop_front();
+
+        auto it = streams.find(streamId);
+        if (it == streams.end())
+        {
+          continue; // reset by the client while it waited
+        }
+
+        auto& stream = it->second;
+        auto authority = static_cast<std::string const*>(NULL);
+        auto method = static_cast<std::string const*>(NULL);
+        auto path = static_cast<std::string const*>(NULL);
+        auto scheme = static_cast<std::string const*>(NULL);
+        auto fields = std::string();
+        auto isMalformed = false;
+        auto isRegularSeen = false;
+        for (auto header = stream.headers.begin(); header != stream.headers.end() && !isMalformed; ++header)
+        {
+          auto& name = header->first;
+          auto& value = header->second;
+          if (!IsValidField(name, value))
+          {
+            isMalformed = true;
+          }
+          else if (name[0] == ':')
+          {
+            // Only the request pseudo-headers, each at most once, and all before the regular fields.
+            auto pseudoHeader = static_cast<std::string const**>(NULL);
+            if (name == ":authority")
+            {
+              pseudoHeader = &authority;
+            }
+            else if (name == ":method")
+            {
+              pseudoHeader = &method;
+            }
+            else if (name == ":path")
+            {
+              pseudoHeader = &path;
+            }
+            else if (name == ":scheme")
+            {
+              pseudoHeader = &scheme;
+            }
+
+            isMalformed = isRegularSeen || pseudoHeader == NULL || *pseudoHeader != NULL;
+            if (!isMalformed)
+            {
+              *pseudoHeader = &value;
+            }
+          }
+          else
+          {
+            isRegularSeen = true;
+            isMalformed = IsConnectionSpecific(name, value) ||
+              (name == "content-length" && !IsContentLength(value, stream.body.size()));
+            fields += name + ": " + value + "\r\n";
+          }
+        }
+
+        if (isMalformed || method == NULL || path == NULL || scheme == NULL || !IsVisible(*method) ||
+          !IsVisible(*path))
+        {
+          WriteResetStream(streamId, Http2Error::ProtocolError);
+          streams.erase(it);
+          continue;
+        }
+
+        request.clear();
+        request.reserve(method->size() + path->size() + fields.size() + stream.body.size() + 64);
+        request += *method;
+        request += ' ';
+        request += *path;
+        request += " HTTP/2.0\r\n";
+        if (authority != NULL)
+        {
+          request += "host: ";
+          request += *authority;
+          request += "\r\n";
+        }
+        request += fields;
+        request += "\r\n";
+        request += stream.body;
+
+        HttpHeaderList().swap(stream.headers);
+        std::string().swap(stream.body);
+        return true;
+      }
+
+      return false;
+    }
+
+    static unsigned ReadUint32(char const* data)
+    {
+      auto bytes = reinterpret_cast<unsigned char const*>(data);
+      return (static_cast<unsigned>(bytes[0]) << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+    }
+
+    // Parses every complete frame in input. Returns false on a connection error, after queueing a GOAWAY.
+    bool Receive(ReceiveBuffer& input)
+    {
+      if (isClosing)
+      {
+        return false;
+      }
+
+      if (!isPrefaceReceived)
+      {
+        if (input.GetSize() < PrefaceLength)
+        {
+          return true;
+        }
+
+        payload.clear();
+        input.CopyTo(0, PrefaceLength, payload);
+        input.Consume(PrefaceLength);
+        if (payload != GetPreface())
+        {
+          return Fail(Http2Error::ProtocolError);
+        }
+        isPrefaceReceived = true;
+      }
+
+      while (input.GetSize() >= FrameHeaderLength)
+      {
+        unsigned char header[FrameHeaderLength];
+        for (auto i = 0u; i < FrameHeaderLength; ++i)
+        {
+          header[i] = static_cast<unsigned char>(input[i]);
+        }
+
+        auto length = (static_cast<std::size_t>(header[0]) << 16) | (header[1] << 8) | header[2];
+        auto type = header[3];
+        auto flags = header[4];
+        auto streamId = ReadUint32(reinterpret_cast<char const*>(header + 5)) & 0x7FFFFFFFu;
+
+        if (length > MaxFrameLength)
+        {
+          return Fail(Http2Error::FrameSizeError);
+        }
+        if (input.GetSize() < FrameHeaderLength + length)
+        {
+          break;
+        }
+
+        payload.clear();
+        input.CopyTo(FrameHeaderLength, length, payload);
+        input.Consume(FrameHeaderLength + length);
+
+        if (!isSettingsReceived && type != Http2FrameType::Settings)
+        {
+          return Fail(Http2Error::ProtocolError); // the client preface must end with SETTINGS
+        }
+
+        auto error = HandleFrame(type, flags, streamId);
+        if (error != Http2Error::NoError)
+        {
+          return Fail(error);
+        }
+      }
+
+      return true;
+    }
+
+    // Abandons a stream whose request was read, telling the client why. With Http11Required, clients retry the
+    // request over HTTP/1.1.
+    void ResetStream(unsigned streamId, Http2Error::Value error)
+    {
+      WriteResetStream(streamId, error);
+      streams.erase(streamId);
+    }
+
+    // Queues the response on its stream. The body is sent as the peer's flow-control windows allow; whatever
+    // does not fit yet goes out as WINDOW_UPDATE frames arrive. With isTracked, TakeFinishedStream reports when
+    // the last frame has been queued.
+    void SendResponse(unsigned streamId, HttpResponse const& response, bool isTracked = false)
+    {
+      auto it = streams.find(streamId);
+      if (it == streams.end())
+      {
+        return; // reset by the client
+      }
+
+      auto& data = response.GetData();
+      auto block = std::string();
+      encoder.Encode(":status", std::to_string(static_cast<long long>(response.GetStatus())), block);
+      encoder.Encode("content-type", response.GetContentType(), block);
+      encoder.Encode("content-length", std::to_string(static_cast<unsigned long long>(data.size())), block);
+
+      auto& params = response.GetParams();
+      for (auto param = params.begin(); param != params.end(); ++param)
+      {
+        auto name = param->first;
+        for (auto c = name.begin(); c != name.end(); ++c)
+        {
+          *c = static_cast<char>(std::tolower(static_cast<unsigned char>(*c)));
+        }
+        if (name != "connection" && name != "keep-alive" && name != "transfer-encoding" && name != "upgrade")
+        {
+          encoder.Encode(name, param->second, block);
+        }
+      }
+
+      WriteHeaders(streamId, block, data.empty());
+
+      auto& stream = it->second;
+      stream.isResponding = true;
+      stream.isTracked = isTracked;
+      stream.pendingData = data;
+      stream.pendingOffset = 0;
+      if (WriteData(streamId, stream))
+      {
+        FinishStream(it);
+      }
+    }
+
+    // Takes a tracked stream whose response has been queued in full, with the length the output had just past its
+    // last frame. Offsets are into the output as it stands, so these must be taken before any of it is removed.
+    bool TakeFinishedStream(unsigned& streamId, std::size_t& outputEnd)
+    {
+      if (finishedStreams.empty())
+      {
+        return false;
+      }
+
+      streamId = finishedStreams.back().first;
+      outputEnd = finishedStreams.back().second;
+      finishedStreams.pop_back();
+      return true;
+    }
+
+  private: // methods
+
+    Http2Session(Http2Session const&);
+    Http2Session& operator=(Http2Session const&);
+
+    Http2Error::Value ApplySettings(char const* data, std::size_t length)
+    {
+      for (auto i = std::size_t(); i + 6 <= length; i += 6)
+      {
+        auto id = (static_cast<unsigned char>(data[i]) << 8) | static_cast<unsigned char>(data[i + 1]);
+        auto value = ReadUint32(data + i + 2);
+
+        switch (id)
+        {
+        case Http2Setting::HeaderTableSize:
+          encoder.SetMaxTableSize(value);
+          break;
+
+        case Http2Setting::EnablePush:
+          if (value > 1)
+          {
+            return Http2Error::ProtocolError;
+          }
+          break;
+
+        case Http2Setting::InitialWindowSize:
+          {
+            if (value > MaxWindow)
+            {
+              return Http2Error::FlowControlError;
+            }
+
+            // The change applies to the windows of every open stream, and may leave them negative.
+            auto delta = static_cast<long long>(value) - peerInitialWindow;
+            for (auto it = streams.begin(); it != streams.end(); ++it)
+            {
+              it->second.sendWindow += delta;
+              if (it->second.sendWindow > MaxWindow)
+              {
+                return Http2Error::FlowControlError;
+              }
+            }
+            peerInitialWindow = value;
+          }
+          break;
+
+        case Http2Setting::MaxFrameSize:
+          if (value < 16384 || value > 16777215)
+          {
+            return Http2Error::ProtocolError;
+          }
+          peerMaxFrameLength = value;
+          break;
+        }
+      }
+
+      return Http2Error::NoError;
+    }
+
+    bool Fail(Http2Error::Value error)
+    {
+      // Queued behind what is already waiting, as the connection may have written part of a frame from it.
+      WriteFrameHeader(8, Http2FrameType::GoAway, 0, 0);
+      WriteUint32(lastStreamId);
+      WriteUint32(error);
+      isClosing = true;
+
+      return false;
+    }
+
+    // Closes a stream whose response has been queued in full.
+    std::unordered_map<unsigned, Stream>::iterator FinishStream(std::unordered_map<unsigned, Stream>::iterator it)
+    {
+      if (it->second.isTracked)
+      {
+        finishedStreams.push_back(std::make_pair(it->first, output.size()));
+      }
+
+      return streams.erase(it);
+    }
+
+    // Sends what the windows allow of every stream whose response is waiting on flow control.
+    void FlushStreams()
+    {
+      for (auto it = streams.begin(); it != streams.end();)
+      {
+        if (it->second.isResponding && WriteData(it->first, it->second))
+        {
+          it = FinishStream(it);
+        }
+        else
+        {
+          ++it;
+        }
+      }
+    }
+
+    Http2Error::Value HandleData(unsigned char flags, unsigned streamId)
+    {
+      if (streamId == 0)
+      {
+        return Http2Error::ProtocolError;
+      }
+
+      // Flow control counts the whole payload, padding included, even for streams that are then discarded.
+      auto frameLength = static_cast<long long>(payload.size());
+      connectionReceiveWindow -= frameLength;
+      if (connectionReceiveWindow < 0)
+      {
+        return Http2Error::FlowControlError;
+      }
+      if (connectionReceiveWindow <= ConnectionWindow / 2)
+      {
+        WriteWindowUpdate(0, static_cast<unsigned>(ConnectionWindow - connectionReceiveWindow));
+        connectionReceiveWindow = ConnectionWindow;
+      }
+
+      auto it = streams.find(streamId);
+      if (it == streams.end() || it->second.isRequestComplete)
+      {
+        if (streamId > lastStreamId)
+        {
+          return Http2Error::ProtocolError; // DATA on a stream that was never opened
+        }
+        WriteResetStream(streamId, Http2Error::StreamClosed);
+        return Http2Error::NoError;
+      }
+
+      auto offset = std::size_t();
+      auto length = payload.size();
+      if (!RemovePadding(flags, offset, length))
+      {
+        return Http2Error::ProtocolError;
+      }
+
+      auto& stream = it->second;
+      stream.receiveWindow -= frameLength;
+      if (stream.receiveWindow < 0)
+      {
+        WriteResetStream(streamId, Http2Error::FlowControlError);
+        streams.erase(it);
+        return Http2Error::NoError;
+      }
+
+      stream.body.append(payload, offset, length);
+      if ((flags & Http2Flag::EndStream) != 0)
+      {
+        stream.isRequestComplete = true;
+        readyStreams.push_back(streamId);
+      }
+
+      return Http2Error::NoError;
+    }
+
+    Http2Error::Value HandleFrame(unsigned char type, unsigned char flags, unsigned streamId)
+    {
+      // A header block must be finished by CONTINUATION frames on its stream before anything else.
+      if (headerBlockStream != 0 && (type != Http2FrameType::Continuation || streamId != headerBlockStream))
+      {
+        return Http2Error::ProtocolError;
+      }
+
+      switch (type)
+      {
+      case Http2FrameType::Data:
+        return HandleData(flags, streamId);
+
+      case Http2FrameType::Headers:
+        return HandleHeaders(flags, streamId);
+
+      case Http2FrameType::Priority:
+        if (streamId == 0)
+        {
+          return Http2Error::ProtocolError;
+        }
+        return payload.size() == 5 ? Http2Error::NoError : Http2Error::FrameSizeError;
+
+      case Http2FrameType::ResetStream:
+        if (streamId == 0 || streamId > lastStreamId)
+        {
+          return Http2Error::ProtocolError;
+        }
+        if (payload.size() != 4)
+        {
+          return Http2Error::FrameSizeError;
+        }
+        streams.erase(streamId);
+        return Http2Error::NoError;
+
+      case Http2FrameType::Settings:
+        return HandleSettings(flags, streamId);
+
+      case Http2FrameType::PushPromise:
+        return Http2Error::ProtocolError; // clients cannot push
+
+      case Http2FrameType::Ping:
+        if (streamId != 0)
+        {
+          return Http2Error::ProtocolError;
+        }
+        if (payload.size() != 8)
+        {
+          return Http2Error::FrameSizeError;
+        }
+        if ((flags & Http2Flag::Ack) == 0)
+        {
+          WriteFrameHeader(8, Http2FrameType::Ping, Http2Flag::Ack, 0);
+          output += payload;
+        }
+        return Http2Error::NoError;
+
+      case Http2FrameType::GoAway:
+        return streamId == 0 ? Http2Error::NoError : Http2Error::ProtocolError;
+
+      case Http2FrameType::WindowUpdate:
+        return HandleWindowUpdate(streamId);
+
+      case Http2FrameType::Continuation:
+        if (headerBlockStream == 0)
+        {
+          return Http2Error::ProtocolError;
+        }
+        return HandleHeaderFragment(flags, 0, payload.size());
+
+      default:
+        return Http2Error::NoError; // unknown frame types must be ignored
+      }
+    }
+
+    // Decodes a complete header block and opens its stream, or takes it as the trailers of an open one.
+    Http2Error::Value HandleHeaderBlock()
+    {
+      auto streamId = headerBlockStream;
+      headerBlockStream = 0;
+
+      auto headers = HttpHeaderList();
+      auto isDecoded = decoder.Decode(headerBlock.data(), headerBlock.size(), headers);
+      headerBlock.clear();
+      if (!isDecoded)
+      {
+        return Http2Error::CompressionError;
+      }
+
+      auto it = streams.find(streamId);
+      if (it != streams.end())
+      {
+        if (it->second.isRequestComplete || !headerBlockEndsStream)
+        {
+          return Http2Error::ProtocolError;
+        }
+
+        // Trailers only end the request; HttpRequest has nowhere to put them.
+        it->second.isRequestComplete = true;
+        readyStreams.push_back(streamId);
+        return Http2Error::NoError;
+      }
+
+      if (streamId <= lastStreamId)
+      {
+        return Http2Error::StreamClosed;
+      }
+      lastStreamId = streamId;
+
+      if (streams.size() >= MaxStreams)
+      {
+        WriteResetStream(streamId, Http2Error::RefusedStream);
+        return Http2Error::NoError;
+      }
+
+      auto stream = Stream();
+      stream.headers = std::move(headers);
+      stream.isRequestComplete = headerBlockEndsStream;
+      stream.sendWindow = peerInitialWindow;
+      streams.insert(std::make_pair(streamId, std::move(stream)));
+
+      if (headerBlockEndsStream)
+      {
+        readyStreams.push_back(streamId);
+      }
+
+      return Http2Error::NoError;
+    }
+
+    Http2Error::Value HandleHeaderFragment(unsigned char flags, std::size_t offset, std::size_t length)
+    {
+      if (headerBlock.size() + length > MaxHeaderBlockLength)
+      {
+        return Http2Error::EnhanceYourCalm;
+      }
+
+      headerBlock.append(payload, offset, length);
+      if ((flags & Http2Flag::EndHeaders) == 0)
+      {
+        return Http2Error::NoError;
+      }
+
+      return HandleHeaderBlock();
+    }
+
+    Http2Error::Value HandleHeaders(unsigned char flags, unsigned streamId)
+    {
+      if (streamId == 0 || streamId % 2 == 0)
+      {
+        return Http2Error::ProtocolError; // clients open odd-numbered streams
+      }
+
+      auto offset = std::size_t();
+      auto length = payload.size();
+      if (!RemovePadding(flags, offset, length))
+      {
+        return Http2Error::ProtocolError;
+      }
+
+      if ((flags & Http2Flag::Priority) != 0) // stream dependency and weight, which are not used
+      {
+        if (length < 5)
+        {
+          return Http2Error::FrameSizeError;
+        }
+        offset += 5;
+        length -= 5;
+      }
+
+      headerBlockStream = streamId;
+      headerBlockEndsStream = (flags & Http2Flag::EndStream) != 0;
+      return HandleHeaderFragment(flags, offset, length);
+    }
+
+    Http2Error::Value HandleSettings(unsigned char flags, unsigned streamId)
+    {
+      if (streamId != 0)
+      {
+        return Http2Error::ProtocolError;
+      }
+      if ((flags & Http2Flag::Ack) != 0)
+      {
+        return payload.empty() ? Http2Error::NoError : Http2Error::FrameSizeError;
+      }
+      if (payload.size() % 6 != 0)
+      {
+        return Http2Error::FrameSizeError;
+      }
+
+      auto error = ApplySettings(payload.data(), payload.size());
+      if (error != Http2Error::NoError)
+      {
+        return error;
+      }
+
+      WriteFrameHeader(0, Http2FrameType::Settings, Http2Flag::Ack, 0);
+      isSettingsReceived = true;
+      FlushStreams();
+
+      return Http2Error::NoError;
+    }
+
+    Http2Error::Value HandleWindowUpdate(unsigned streamId)
+    {
+      if (payload.size() != 4)
+      {
+        return Http2Error::FrameSizeError;
+      }
+
+      auto increment = static_cast<long long>(ReadUint32(payload.data()) & 0x7FFFFFFFu);
+      if (streamId == 0)
+      {
+        if (increment == 0 || connectionSendWindow + increment > MaxWindow)
+        {
+          return increment == 0 ? Http2Error::ProtocolError : Http2Error::FlowControlError;
+        }
+        connectionSendWindow += increment;
+        FlushStreams();
+        return Http2Error::NoError;
+      }
+
+      auto it = streams.find(streamId);
+      if (it == streams.end())
+      {
+        return streamId > lastStreamId ? Http2Error::ProtocolError : Http2Error::NoError;
+      }
+
+      auto& stream = it->second;
+      if (increment == 0 || stream.sendWindow + increment > MaxWindow)
+      {
+        WriteResetStream(streamId, increment == 0 ? Http2Error::ProtocolError : Http2Error::FlowControlError);
+        streams.erase(it);
+        return Http2Error::NoError;
+      }
+
+      stream.sendWindow += increment;
+      if (stream.isResponding && WriteData(streamId, stream))
+      {
+        FinishStream(it);
+      }
+
+      return Http2Error::NoError;
+    }
+
+    // Fields that only describe an HTTP/1.1 connection are not allowed in HTTP/2, apart from "te: trailers".
+    static bool IsConnectionSpecific(std::string const& name, std::string const& value)
+    {
+      return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+        name == "transfer-encoding" || name == "upgrade" || (name == "te" && value != "trailers");
+    }
+
+    // True if a content-length value is a number equal to the length of the body that arrived.
+    static bool IsContentLength(std::string const& value, std::size_t bodyLength)
+    {
+      auto length = 0ull;
+      for (auto c = value.begin(); c != value.end(); ++c)
+      {
+        if (*c < '0' || *c > '9' || length > (static_cast<unsigned long long>(-1) - 9) / 10)
+        {
+          return false;
+        }
+        length = length * 10 + static_cast<unsigned long long>(*c - '0');
+      }
+
+      return !value.empty() && length == bodyLength;
+    }
+
+    // Checks a request field as RFC 9113 section 8.2.1 requires. The name is lower case with no controls,
+    // spaces or colons, other than the colon that starts a pseudo-header. The value has no NUL, CR or LF and
+    // neither starts nor ends with whitespace.
+    static bool IsValidField(std::string const& name, std::string const& value)
+    {
+      if (name.empty())
+      {
+        return false;
+      }
+      for (auto i = 0u; i < name.size(); ++i)
+      {
+        auto c = static_cast<unsigned char>(name[i]);
+        if (c <= 0x20 || c >= 0x7F || (c >= 'A' && c <= 'Z') || (c == ':' && i != 0))
+        {
+          return false;
+        }
+      }
+
+      for (auto c = value.begin(); c != value.end(); ++c)
+      {
+        if (*c == '\0' || *c == '\r' || *c == '\n')
+        {
+          return false;
+        }
+      }
+
+      return value.empty() || (value[0] != ' ' && value[0] != '\t' &&
+        value[value.size() - 1] != ' ' && value[value.size() - 1] != '\t');
+    }
+
+    // True if text is non-empty and all visible ASCII, as :method and :path must be to form a request line.
+    static bool IsVisible(std::string const& text)
+    {
+      for (auto c = text.begin(); c != text.end(); ++c)
+      {
+        if (static_cast<unsigned char>(*c) <= 0x20 || static_cast<unsigned char>(*c) >= 0x7F)
+        {
+          return false;
+        }
+      }
+
+      return !text.empty();
+    }
+
+    // Narrows [offset, offset + length) of the payload to the data between the pad length and the padding.
+    bool RemovePadding(unsigned char flags, std::size_t& offset, std::size_t& length) const
+    {
+      if ((flags & Http2Flag::Padded) == 0)
+      {
+        return true;
+      }
+      if (length == 0)
+      {
+        return false;
+      }
+
+      auto padLength = static_cast<unsigned char>(payload[offset]);
+      if (padLength >= length)
+      {
+        return false;
+      }
+
+      offset += 1;
+      length -= 1 + padLength;
+      return true;
+    }
+
+    // Writes as much of the stream's pending body as the windows allow. Returns true once all of it is written.
+    bool WriteData(unsigned streamId, Stream& stream)
+    {
+      while (stream.pendingOffset < stream.pendingData.size())
+      {
+        auto window = stream.sendWindow < connectionSendWindow ? stream.sendWindow : connectionSendWindow;
+        if (window <= 0)
+        {
+          return false;
+        }
+
+        auto length = stream.pendingData.size() - stream.pendingOffset;
+        if (length > peerMaxFrameLength)
+        {
+          length = peerMaxFrameLength;
+        }
+        if (static_cast<long long>(length) > window)
+        {
+          length = static_cast<std::size_t>(window);
+        }
+
+        auto isLast = stream.pendingOffset + length == stream.pendingData.size();
+        WriteFrameHeader(length, Http2FrameType::Data, isLast ? Http2Flag::EndStream : 0, streamId);
+        output.append(stream.pendingData, stream.pendingOffset, length);
+
+        stream.pendingOffset += length;
+        stream.sendWindow -= length;
+        connectionSendWindow -= length;
+      }
+
+      return true;
+    }
+
+    void WriteFrameHeader(std::size_t length, Http2FrameType::Value type, unsigned char flags, unsigned streamId)
+    {
+      AppendFrameHeader(output, length, type, flags, streamId);
+    }
+
+    // Writes a header block as a HEADERS frame followed by as many CONTINUATION frames as the peer's maximum frame
+    // size requires.
+    void WriteHeaders(unsigned streamId, std::string const& block, bool endStream)
+    {
+      auto offset = std::size_t();
+      auto type = Http2FrameType::Headers;
+      auto flags = static_cast<unsigned char>(endStream ? Http2Flag::EndStream : 0);
+
+      do
+      {
+        auto length = block.size() - offset;
+        if (length > peerMaxFrameLength)
+        {
+          length = peerMaxFrameLength;
+        }
+        if (offset + length == block.size())
+        {
+          flags |= Http2Flag::EndHeaders;
+        }
+
+        WriteFrameHeader(length, type, flags, streamId);
+        output.append(block, offset, length);
+
+        offset += length;
+        type = Http2FrameType::Continuation;
+        flags = 0;
+      } while (offset < block.size());
+    }
+
+    void WriteResetStream(unsigned streamId, Http2Error::Value error)
+    {
+      WriteFrameHeader(4, Http2FrameType::ResetStream, 0, streamId);
+      WriteUint32(error);
+    }
+
+    void WriteSetting(Http2Setting::Value id, unsigned value)
+    {
+      output.push_back(static_cast<char>((id >> 8) & 0xFF));
+      output.push_back(static_cast<char>(id & 0xFF));
+      WriteUint32(value);
+    }
+
+    void WriteUint32(unsigned value)
+    {
+      AppendUint32(output, value);
+    }
+
+    void WriteWindowUpdate(unsigned streamId, unsigned increment)
+    {
+      WriteFrameHeader(4, Http2FrameType::WindowUpdate, 0, streamId);
+      WriteUint32(increment);
+    }
+  };
+} // namespace OlympusWebServer
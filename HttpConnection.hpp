@@ -0,0 +1,787 @@
+#pragma once
+
+#include <cctype>
+#include <cstring>
+#include "Http2Session.hpp"
+#include "HttpResponse.hpp"
+#include <memory>
+#include "ProxyExchange.hpp"
+#include "RateLimiter.hpp"
+#include "ReceiveBuffer.hpp"
+#include "ReverseProxy.hpp"
+#include <string>
+#include "TcpSocket.hpp"
+#include "TlsStream.hpp"
+#include "Trace.hpp"
+#include <vector>
+#include "WebSocketSession.hpp"
+
+namespace OlympusWebServer
+{
+  // A client connection speaking HTTP/1.x, or HTTP/2 once it opens with the HTTP/2 preface (prior knowledge) or
+  // upgrades with "Upgrade: h2c". Either way, requests come out of ReadRequest and responses go back through
+  // SendResponse, tagged with the HTTP/2 stream they belong to (zero for HTTP/1.x).
+  //
+  // An HTTP/1.1 connection can instead become a WebSocket, once the server accepts its upgrade request with
+  // AcceptWebSocket. From then on it carries messages, read with ReadMessage, rather than requests.
+  //
+  // Connections accepted on a TLS listener run all of this over a TlsStream. HTTP/2 is then negotiated with ALPN,
+  // after which the client's preface arrives like prior knowledge.
+  //
+  // An HTTP/1.x request whose path has a reverse proxy route never comes out of ReadRequest. It is forwarded as
+  // soon as its headers have arrived, with its body and the response streamed through a ProxyExchange, and the
+  // connection reads its next request once that has finished. HTTP/2 streams on proxied paths are refused with
+  // HTTP_1_1_REQUIRED, which makes clients retry them over HTTP/1.1.
+  //
+  // With a RateLimiter, each request (or HTTP/2 stream) is checked once its headers have arrived, before its body
+  // is read or it is forwarded. One over its client's limit is answered with a 429 rendered once for every
+  // connection, and never comes out of ReadRequest.
+  //
+  // A sampled request's trace goes along with its response, which may take several updates to go out. The
+  // connection marks when the first byte of the response is written and when the last one is, and commits the
+  // trace then.
+  class HttpConnection
+  {
+  public: // data
+
+    static const std::size_t MaxBodyLength = 1024u * 1024u;
+    static const std::size_t MaxHeaderLength = 64u * 1024u;
+
+  private: // types
+
+    // A traced response still going out, located by byte counts of the output it was queued on: output for
+    // HTTP/1.x, the HTTP/2 session's output for a stream.
+    class PendingTrace
+    {
+    public: // data
+
+      unsigned long long end; // zero until an HTTP/2 response has been queued in full
+      unsigned long long start;
+      unsigned streamId;
+      RequestTrace trace;
+    };
+
+  private: // data
+
+    long long acceptTime;
+    unsigned long long clientKey; // identifies the client to the rate limiter
+    long long firstByteTime;
+    std::size_t headerScanned; // where FindHeaderEnd resumes, as the headers have not ended before it
+    std::unique_ptr<Http2Session> http2;
+    unsigned long long http2Sent; // bytes of the HTTP/2 session's output written
+    ReceiveBuffer input;
+    bool isAdmitted; // the request being received has passed the rate limiter
+    bool isClosing;
+    bool isContinueSent;
+    std::string output;
+    unsigned long long outputSent; // bytes of output written
+    std::vector<PendingTrace> pendingTraces;
+    std::shared_ptr<ReverseProxy> proxy;
+    std::unique_ptr<ProxyExchange> proxyExchange;
+    std::shared_ptr<RateLimiter> rateLimiter;
+    TcpSocket socket;
+    std::unique_ptr<TlsStream> tls;
+    std::unique_ptr<WebSocketSession> webSocket;
+    std::string webSocketKey;
+
+  public: // methods
+
+    HttpConnection(HttpConnection&& b)
+    {
+      *this = std::move(b);
+    }
+
+    HttpConnection& operator=(HttpConnection&& b)
+    {
+      acceptTime = b.acceptTime;
+      firstByteTime = b.firstByteTime;
+      headerScanned = b.headerScanned;
+      http2 = std::move(b.http2);
+      http2Sent = b.http2Sent;
+      input = std::move(b.input);
+      clientKey = b.clientKey;
+      isAdmitted = b.isAdmitted;
+      isClosing = b.isClosing;
+      isContinueSent = b.isContinueSent;
+      output = std::move(b.output);
+      outputSent = b.outputSent;
+      pendingTraces = std::move(b.pendingTraces);
+      proxy = std::move(b.proxy);
+      proxyExchange = std::move(b.proxyExchange);
+      rateLimiter = std::move(b.rateLimiter);
+      socket = std::move(b.socket);
+      tls = std::move(b.tls);
+      webSocket = std::move(b.webSocket);
+      webSocketKey = std::move(b.webSocketKey);
+
+      b.acceptTime = 0;
+      b.firstByteTime = 0;
+      b.pendingTraces.clear();
+
+      return *this;
+    }
+
+    // With a TLS context, the connection starts with a TLS handshake. With a proxy, requests on its routes are
+    // forwarded to their upstreams. With a rate limiter, requests over the client's limits are refused.
+    explicit HttpConnection(
+      TcpSocket socket_,
+      TlsContext* tlsContext = NULL,
+      std::shared_ptr<ReverseProxy> proxy_ = std::shared_ptr<ReverseProxy>(),
+      std::shared_ptr<RateLimiter> rateLimiter_ = std::shared_ptr<RateLimiter>()) :
+        acceptTime(TraceClock::Now()),
+        clientKey(rateLimiter_ ? RateLimiter::GetClientKey(socket_.GetPeer()) : 0),
+        firstByteTime(0),
+        headerScanned(0),
+        http2Sent(0),
+        isAdmitted(false),
+        isClosing(false),
+        isContinueSent(false),
+        outputSent(0),
+        proxy(std::move(proxy_)),
+        rateLimiter(std::move(rateLimiter_)),
+        socket(std::move(socket_))
+    {
+      if (tlsContext != NULL)
+      {
+        tls.reset(new TlsStream(*tlsContext, socket.GetHandle()));
+      }
+    }
+
+    ~HttpConnection()
+    {
+      CommitTraces();
+    }
+
+    // Completes the handshake for the WebSocket upgrade request just read (see IsWebSocketRequested) and
+    // subscribes the connection to channel.
+    void AcceptWebSocket(std::string channel)
+    {
+      auto response = HttpResponse(HttpStatus::SwitchingProtocols);
+      response.SetParam("Connection", "Upgrade");
+      response.SetParam("Sec-WebSocket-Accept", WebSocketSession::GetAcceptKey(webSocketKey));
+      response.SetParam("Upgrade", "websocket");
+      Send(response.GetFormattedResponse());
+
+      webSocket.reset(new WebSocketSession(std::move(channel), TraceClock::Now()));
+      webSocketKey.clear();
+    }
+
+    // Writes any responses, HTTP/2 or WebSocket frames, or proxied bytes still waiting to be sent.
+    // Returns true once nothing is left. Closes a WebSocket whose session has finished, a TLS connection the peer
+    // has closed, or a connection whose proxied response had to end it once that has been sent.
+    bool Flush()
+    {
+      UpdateTraces(); // before the HTTP/2 output shrinks, so finished streams can still be located in it
+
+      auto isFlushed = FlushBuffer(output, outputSent);
+      if (webSocket)
+      {
+        isFlushed = isFlushed && socket.IsOpen() && webSocket->Flush([this](std::string const& data, std::size_t offset)
+        {
+          return SendSome(data, offset);
+        });
+        if (webSocket->IsFinished())
+        {
+          Close();
+        }
+      }
+      else if (http2)
+      {
+        isFlushed = isFlushed && FlushBuffer(http2->GetOutput(), http2Sent);
+      }
+      UpdateTraces();
+
+      if ((tls && tls->IsClosed()) || (isClosing && isFlushed))
+      {
+        Close();
+      }
+      return isFlushed;
+    }
+
+    // Time the oldest unread byte in the receive buffer arrived.
+    long long GetFirstByteTime() const
+    {
+      return firstByteTime;
+    }
+
+    TcpSocket& GetSocket()
+    {
+      return socket;
+    }
+
+    // The session once the connection has become a WebSocket, or NULL.
+    WebSocketSession* GetWebSocket()
+    {
+      return webSocket.get();
+    }
+
+    bool IsHttp2() const
+    {
+      return http2 != NULL;
+    }
+
+    bool IsOpen() const
+    {
+      return socket.IsOpen();
+    }
+
+    // True if the request just read was a valid WebSocket upgrade request, which the server may accept with
+    // AcceptWebSocket or answer like any other request.
+    bool IsWebSocketRequested() const
+    {
+      return !webSocketKey.empty();
+    }
+
+    // Takes the next complete WebSocket message. Returns false if none has arrived or this is not a WebSocket.
+    bool ReadMessage(std::string& message, bool& isBinary)
+    {
+      return webSocket && webSocket->ReadMessage(input, message, isBinary);
+    }
+
+    // Takes the next complete request (headers plus Content-Length body) out of the receive buffer. Returns false
+    // if one has not fully arrived yet, sending 100 Continue if the client is holding its body back for one. Closes
+    // the connection if the client exceeds the header or body limits, and after answering a request whose body is
+    // framed any other way, such as with Transfer-Encoding.
+    bool ReadRequest(std::string& request, unsigned& streamId)
+    {
+      streamId = 0;
+      webSocketKey.clear();
+
+      // A client that is not taking its responses is not given more until it does.
+      if (webSocket || proxyExchange || isClosing || !output.empty())
+      {
+        return false;
+      }
+      if (!http2 && input.GetSize() >= 3 && input[0] == 'P' && input[1] == 'R' && input[2] == 'I')
+      {
+        http2.reset(new Http2Session()); // prior knowledge; the session checks the rest of the preface
+      }
+      if (http2)
+      {
+        return ReadHttp2Request(request, streamId);
+      }
+
+      auto headerEnd = FindHeaderEnd();
+      if (headerEnd == std::string::npos)
+      {
+        if (input.GetSize() > MaxHeaderLength)
+        {
+          Close();
+        }
+        return false;
+      }
+
+      request.clear();
+      input.CopyTo(0, headerEnd, request);
+
+      // Only Content-Length bodies are understood. A body framed any other way cannot be told apart from the request
+      // after it, so the request is refused and the connection closed rather than misread.
+      auto bodyLength = std::size_t();
+      auto framingStatus = FindBodyLength(request, bodyLength);
+      if (framingStatus != HttpStatus::Ok)
+      {
+        RejectRequest(framingStatus);
+        return false;
+      }
+
+      if (!isAdmitted && rateLimiter && !rateLimiter->IsAllowed(request, clientKey, TraceClock::Now()))
+      {
+        RefuseRequest(headerEnd, bodyLength);
+        return false;
+      }
+      isAdmitted = true;
+
+      auto route = proxy ? proxy->FindRoute(request) : -1;
+      if (route >= 0)
+      {
+        StartProxy(route, request, headerEnd, bodyLength);
+        return false;
+      }
+      if (bodyLength > MaxBodyLength)
+      {
+        Close();
+        return false;
+      }
+      if (input.GetSize() < headerEnd + bodyLength)
+      {
+        if (!isContinueSent && FindHeader(request, "expect") == "100-continue")
+        {
+          Send(HttpResponse(HttpStatus::Continue).GetFormattedResponse());
+          isContinueSent = true;
+        }
+        return false;
+      }
+
+      input.CopyTo(headerEnd, bodyLength, request);
+      input.Consume(headerEnd + bodyLength);
+      isAdmitted = false;
+      isContinueSent = false;
+
+      auto upgrade = FindHeader(request, "upgrade");
+      if (upgrade == "h2c")
+      {
+        UpgradeToHttp2(request, streamId);
+      }
+      else if (upgrade == "websocket" && request.compare(0, 4, "GET ") == 0 &&
+        FindHeader(request, "connection").find("upgrade") != std::string::npos &&
+        FindHeader(request, "sec-websocket-version") == "13")
+      {
+        webSocketKey = FindHeader(request, "sec-websocket-key", true);
+      }
+      return true;
+    }
+
+    // Reads whatever the client has sent into the receive buffer. Returns the number of bytes read.
+    std::size_t Receive()
+    {
+      // While a request is being forwarded, its body is read only as the upstream takes it, and not at all if it
+      // is being spliced.
+      if (isClosing || (proxyExchange && !proxyExchange->IsReadingClient(input.GetSize())))
+      {
+        return 0;
+      }
+
+      auto wasEmpty = input.IsEmpty();
+      auto received = tls ? tls->Receive(input) : socket.Receive(input);
+      if (wasEmpty && received > 0)
+      {
+        firstByteTime = TraceClock::Now();
+      }
+      if (tls && tls->IsClosed())
+      {
+        Close();
+      }
+
+      return received;
+    }
+
+    // Sends the response for a request from ReadRequest. What the socket does not take at once is written by Flush
+    // in later updates. HTTP/2 responses are always queued as frames and written by Flush, so responses to many
+    // streams share sends; returns true only if the response was written in full. A sampled trace is committed
+    // once the last byte of the response has been written.
+    bool SendResponse(unsigned streamId, HttpResponse const& response, RequestTrace const& trace = RequestTrace())
+    {
+      auto pending = PendingTrace();
+      pending.streamId = streamId;
+      pending.trace = trace;
+
+      if (http2)
+      {
+        if (trace.IsSampled())
+        {
+          pending.start = http2Sent + http2->GetOutput().size();
+          pending.end = 0;
+          pendingTraces.push_back(pending);
+        }
+        http2->SendResponse(streamId, response, trace.IsSampled());
+        return false;
+      }
+
+      auto& data = response.GetFormattedResponse();
+      if (trace.IsSampled())
+      {
+        pending.start = outputSent + output.size();
+        pending.end = pending.start + data.size();
+        pendingTraces.push_back(pending);
+      }
+      return Send(data);
+    }
+
+    // Moves along the request being forwarded to an upstream, if any. The response is written to the client as it
+    // arrives; once it is complete, ReadRequest takes requests again.
+    void UpdateProxy(long long now)
+    {
+      if (!proxyExchange || !socket.IsOpen())
+      {
+        return;
+      }
+
+      auto status = proxyExchange->Update(input, output, socket.GetHandle(), now);
+      if (status != ProxyStatus::Forwarding)
+      {
+        isClosing = status == ProxyStatus::Closing;
+        proxyExchange.reset();
+      }
+      FlushBuffer(output, outputSent);
+    }
+
+    // Returns the accept time on the first call and zero afterwards, so only the first request on a keep-alive
+    // connection is charged for the wait between accept and its first byte.
+    long long TakeAcceptTime()
+    {
+      auto result = acceptTime;
+      acceptTime = 0;
+      return result;
+    }
+
+  private: // methods
+
+    void Close()
+    {
+      if (tls && socket.IsOpen())
+      {
+        tls->Shutdown();
+      }
+      input.Release();
+      proxyExchange.reset();
+      socket.Close();
+      CommitTraces();
+    }
+
+    // Commits the traces of responses that will not finish going out, without a LastByteFlushed time.
+    void CommitTraces()
+    {
+      for (auto it = pendingTraces.begin(); it != pendingTraces.end(); ++it)
+      {
+        Tracer::Commit(it->trace);
+      }
+      pendingTraces.clear();
+    }
+
+    // Reads the length of the body from Content-Length, zero if there is none. Returns BadRequest for a length that
+    // is not a number, for two different lengths, for whitespace before a header's colon or for a folded line,
+    // since another server could frame any of those differently. Returns NotImplemented for Transfer-Encoding,
+    // which is not supported, or BadRequest if Content-Length is also given (RFC 9112 section 6.3).
+    static HttpStatus::Value FindBodyLength(std::string const& headers, std::size_t& bodyLength)
+    {
+      static const std::string lengthName = "content-length";
+      static const std::string encodingName = "transfer-encoding";
+
+      auto isEncoded = false;
+      auto isLengthSeen = false;
+      bodyLength = 0;
+
+      for (auto line = headers.find('\n'); line != std::string::npos; line = headers.find('\n', line + 1))
+      {
+        auto start = line + 1;
+        if (start == headers.size() || headers[start] == '\r' || headers[start] == '\n')
+        {
+          continue; // the blank line that ends the headers
+        }
+
+        auto nameEnd = start;
+        while (nameEnd < headers.size() && headers[nameEnd] != ':' && headers[nameEnd] != '\r' &&
+          headers[nameEnd] != '\n' && headers[nameEnd] != ' ' && headers[nameEnd] != '\t')
+        {
+          ++nameEnd;
+        }
+        if (nameEnd == start || nameEnd == headers.size() || headers[nameEnd] != ':')
+        {
+          return HttpStatus::BadRequest;
+        }
+
+        auto name = headers.substr(start, nameEnd - start);
+        for (auto c = name.begin(); c != name.end(); ++c)
+        {
+          *c = static_cast<char>(std::tolower(static_cast<unsigned char>(*c)));
+        }
+        if (name == encodingName)
+        {
+          isEncoded = true;
+          continue;
+        }
+        if (name != lengthName)
+        {
+          continue;
+        }
+
+        auto i = nameEnd + 1;
+        while (i < headers.size() && (headers[i] == ' ' || headers[i] == '\t'))
+        {
+          ++i;
+        }
+        auto length = std::size_t();
+        auto digitsStart = i;
+        for (; i < headers.size() && headers[i] >= '0' && headers[i] <= '9'; ++i)
+        {
+          if (length > (static_cast<std::size_t>(-1) - 9) / 10)
+          {
+            return HttpStatus::BadRequest;
+          }
+          length = length * 10 + static_cast<std::size_t>(headers[i] - '0');
+        }
+        auto isNumber = i > digitsStart;
+        while (i < headers.size() && (headers[i] == ' ' || headers[i] == '\t' || headers[i] == '\r'))
+        {
+          ++i;
+        }
+
+        if (!isNumber || (i < headers.size() && headers[i] != '\n') || (isLengthSeen && length != bodyLength))
+        {
+          return HttpStatus::BadRequest;
+        }
+        isLengthSeen = true;
+        bodyLength = length;
+      }
+
+      if (isEncoded)
+      {
+        return isLengthSeen ? HttpStatus::BadRequest : HttpStatus::NotImplemented;
+      }
+
+      return HttpStatus::Ok;
+    }
+
+    // Sends the front of buffer as far as the connection allows, removes what was sent and adds it to sent.
+    // Returns true once the buffer is empty.
+    bool FlushBuffer(std::string& buffer, unsigned long long& sent)
+    {
+      if (!buffer.empty() && socket.IsOpen())
+      {
+        auto length = SendSome(buffer);
+        buffer.erase(0, length);
+        sent += length;
+      }
+
+      return buffer.empty();
+    }
+
+    // Returns the offset just past the blank line ending the headers, accepting CRLF or bare LF line endings. A
+    // search that fails is resumed from where it stopped once more arrives, so headers trickling in a few bytes at
+    // a time are not rescanned from the start on every read; a search that succeeds starts the next one afresh,
+    // as the request it found is consumed.
+    std::size_t FindHeaderEnd()
+    {
+      auto size = input.GetSize();
+      auto newline = input.Find("\n", headerScanned);
+      for (; newline != std::string::npos; newline = input.Find("\n", newline + 1))
+      {
+        if (newline + 1 < size && input[newline + 1] == '\n')
+        {
+          headerScanned = 0;
+          return newline + 2;
+        }
+        if (newline + 2 < size && input[newline + 1] == '\r' && input[newline + 2] == '\n')
+        {
+          headerScanned = 0;
+          return newline + 3;
+        }
+      }
+
+      // The blank line can still be completed by a newline at either of the last two bytes.
+      headerScanned = size > 2 ? size - 2 : 0;
+      return std::string::npos;
+    }
+
+    // Returns the value of the named header, which must be given in lower case, or an empty string. The value is
+    // lower-cased unless isCaseKept.
+    static std::string FindHeader(std::string const& headers, char const* name, bool isCaseKept = false)
+    {
+      auto nameLength = std::strlen(name);
+
+      for (auto line = headers.find('\n'); line != std::string::npos; line = headers.find('\n', line + 1))
+      {
+        auto start = line + 1;
+        if (headers.size() - start <= nameLength || headers[start + nameLength] != ':')
+        {
+          continue;
+        }
+
+        auto matches = true;
+        for (auto i = 0u; i < nameLength && matches; ++i)
+        {
+          matches = std::tolower(static_cast<unsigned char>(headers[start + i])) == name[i];
+        }
+        if (!matches)
+        {
+          continue;
+        }
+
+        auto value = std::string();
+        for (auto i = start + nameLength + 1; i < headers.size() && headers[i] != '\r' && headers[i] != '\n'; ++i)
+        {
+          if (headers[i] != ' ' && headers[i] != '\t')
+          {
+            value.push_back(isCaseKept ? headers[i] : static_cast<char>(std::tolower(static_cast<unsigned char>(headers[i]))));
+          }
+        }
+
+        return value;
+      }
+
+      return std::string();
+    }
+
+    // The answer to a request over its client's rate limit, rendered once. With isClosing, it tells the client that
+    // the connection is being closed.
+    static HttpResponse const& GetTooManyRequests(bool isClosing)
+    {
+      static const auto keptAlive = RenderTooManyRequests(false);
+      static const auto closing = RenderTooManyRequests(true);
+      return isClosing ? closing : keptAlive;
+    }
+
+    bool ReadHttp2Request(std::string& request, unsigned& streamId)
+    {
+      if (!http2->Receive(input))
+      {
+        Flush(); // best effort to deliver the GOAWAY
+        Close();
+        return false;
+      }
+
+      while (http2->ReadRequest(request, streamId))
+      {
+        if (rateLimiter && !rateLimiter->IsAllowed(request, clientKey, TraceClock::Now()))
+        {
+          http2->SendResponse(streamId, GetTooManyRequests(false));
+        }
+        else if (!proxy || proxy->FindRoute(request) < 0)
+        {
+          return true;
+        }
+        else
+        {
+          http2->ResetStream(streamId, Http2Error::Http11Required);
+        }
+      }
+
+      return false;
+    }
+
+    // Answers a request over its client's rate limit. A body that has not all arrived is not waited for, since it
+    // would only be thrown away; the connection is closed after the answer instead.
+    void RefuseRequest(std::size_t headerEnd, std::size_t bodyLength)
+    {
+      isClosing = input.GetSize() - headerEnd < bodyLength;
+      if (!isClosing)
+      {
+        input.Consume(headerEnd + bodyLength);
+      }
+
+      Send(GetTooManyRequests(isClosing).GetFormattedResponse());
+    }
+
+    // Answers a request whose body could not be framed and closes the connection, since whatever follows its
+    // headers cannot be told apart from the next request.
+    void RejectRequest(HttpStatus::Value status)
+    {
+      auto response = HttpResponse(status);
+      response.SetParam("Connection", "close");
+
+      isClosing = true;
+      Send(response.GetFormattedResponse());
+    }
+
+    static HttpResponse RenderTooManyRequests(bool isClosing)
+    {
+      auto response = HttpResponse(HttpStatus::TooManyRequests);
+      response.SetParam("Retry-After", "1");
+      if (isClosing)
+      {
+        response.SetParam("Connection", "close");
+      }
+
+      return response;
+    }
+
+    // Writes data as far as the socket allows without blocking, queued behind anything still unsent. Flush sends
+    // the rest in later updates. Returns true if all of it went out.
+    bool Send(std::string const& data)
+    {
+      if (!output.empty() || !socket.IsOpen())
+      {
+        output += data;
+        FlushBuffer(output, outputSent);
+      }
+      else
+      {
+        // Nothing is queued, so the usual whole write needs no copy.
+        auto sent = SendSome(data);
+        outputSent += sent;
+        if (sent < data.size())
+        {
+          output.append(data, sent, std::string::npos);
+        }
+      }
+
+      UpdateTraces();
+      return output.empty();
+    }
+
+    // Sends from data[offset..] without blocking, returning the number of bytes sent. TLS connections write through
+    // OpenSSL until kTLS takes over the encryption, and then straight to the socket.
+    std::size_t SendSome(std::string const& data, std::size_t offset = 0)
+    {
+      if (tls && !tls->IsKernelSend())
+      {
+        return tls->Write(data.data() + offset, data.size() - offset);
+      }
+
+      return socket.SendSome(data, offset);
+    }
+
+    // Forwards the request whose headers were just read, sending 100 Continue first if the client is holding its
+    // body back for one, since the Expect header is not passed on.
+    void StartProxy(int route, std::string const& headers, std::size_t headerEnd, std::size_t bodyLength)
+    {
+      input.Consume(headerEnd);
+      if (bodyLength > input.GetSize() && FindHeader(headers, "expect") == "100-continue")
+      {
+        output += HttpResponse(HttpStatus::Continue).GetFormattedResponse();
+      }
+      isAdmitted = false;
+      isContinueSent = false;
+
+      proxyExchange.reset(
+        new ProxyExchange(*proxy, route, headers, socket.GetPeer(), bodyLength, !tls, !tls || tls->IsKernelSend()));
+      UpdateProxy(TraceClock::Now());
+    }
+
+    // Marks the traced responses whose first or last byte has now been written, and commits those that are done.
+    void UpdateTraces()
+    {
+      if (pendingTraces.empty())
+      {
+        return;
+      }
+
+      auto streamId = 0u;
+      auto outputEnd = std::size_t();
+      while (http2 && http2->TakeFinishedStream(streamId, outputEnd))
+      {
+        for (auto it = pendingTraces.begin(); it != pendingTraces.end(); ++it)
+        {
+          if (it->streamId == streamId && it->end == 0)
+          {
+            it->end = http2Sent + outputEnd;
+          }
+        }
+      }
+
+      auto now = TraceClock::Now();
+      for (auto it = pendingTraces.begin(); it != pendingTraces.end();)
+      {
+        auto sent = it->streamId == 0 ? outputSent : http2Sent;
+        if (sent > it->start && it->trace.GetTimestamp(TracePhase::FirstByteSent) == 0)
+        {
+          it->trace.Mark(TracePhase::FirstByteSent, now);
+        }
+        if (it->end == 0 || sent < it->end)
+        {
+          ++it;
+          continue;
+        }
+
+        it->trace.Mark(TracePhase::LastByteFlushed, now);
+        Tracer::Commit(it->trace);
+        it = pendingTraces.erase(it);
+      }
+    }
+
+    // Switches to HTTP/2 after an "Upgrade: h2c" request, which becomes stream 1. A request whose HTTP2-Settings
+    // do not decode is answered over HTTP/1.1 instead, as if the upgrade had not been offered.
+    void UpgradeToHttp2(std::string const& request, unsigned& streamId)
+    {
+      auto session = std::unique_ptr<Http2Session>(new Http2Session());
+      if (!session->AcceptUpgrade(FindHeader(request, "http2-settings", true)))
+      {
+        return;
+      }
+
+      Send("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+      http2 = std::move(session);
+      streamId = 1;
+    }
+  };
+} // namespace OlympusWebServer
\ No newline at end of file
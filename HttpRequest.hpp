@@ -16,7 +16,7 @@ namespace OlympusWebServer
   private: // data
 
     std::vector<std::string> collections;
-    float httpVersion;
+    HttpVersion::Value httpVersion;
     HttpMethod::Value method;
     std::unordered_map<std::string, std::string> params;
     std::string path;
@@ -45,7 +45,9 @@ namespace OlympusWebServer
       return *this;
     }
 
-    HttpRequest(std::string request)
+    HttpRequest(std::string request) :
+      httpVersion(HttpVersion::Http11),
+      method(HttpMethod::Unknown)
     {
       // Read the method, path, and protocol.
       auto istream = std::istringstream(std::move(request));
@@ -56,8 +58,11 @@ namespace OlympusWebServer
         return; // invalid request
       }
 
-      std::transform(methodString.begin(), methodString.end(), methodString.begin(), std::toupper);
-      httpVersion = std::stof(protocol.substr(protocol.find('/') + 1));
+      std::transform(methodString.begin(), methodString.end(), methodString.begin(), [](char c)
+      {
+        return static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+      });
+      httpVersion = ParseVersion(protocol);
 
       method = ParseMethod(methodString);
       if (method == HttpMethod::Unknown)
@@ -75,14 +80,37 @@ namespace OlympusWebServer
       ParseParameters(istream);
     }
 
-    float GetHttpVersion() const
+    HttpVersion::Value GetHttpVersion() const
     {
       return httpVersion;
     }
 
+    HttpMethod::Value GetMethod() const
+    {
+      return method;
+    }
+
+    std::string GetPath() const
+    {
+      return path.substr(0, path.rfind('?'));
+    }
+
+    std::string GetQuery(std::string const& queryKey) const
+    {
+      auto it = queries.find(queryKey);
+      if (it == queries.end())
+      {
+        return std::string();
+      }
+
+      return it->second;
+    }
+
+    // Returns the named header's value. Names are matched without regard to case, so a handler sees the same
+    // headers whether they arrived in an HTTP/1.1 request or in the lower case HTTP/2 requires.
     std::string operator[](std::string const& paramKey) const
     {
-      auto it = params.find(paramKey);
+      auto it = params.find(ToLower(paramKey));
       if (it == params.end())
       {
         return std::string();
@@ -149,6 +177,7 @@ namespace OlympusWebServer
           break;
         }
         key.pop_back(); // removing ':'
+        key = ToLower(std::move(key));
 
         // Seek through non-alphanumeric text (usually whitespace).
         while (!std::isalnum(istream.peek()))
@@ -204,5 +233,31 @@ namespace OlympusWebServer
         queries.emplace(std::make_pair(kvPair.substr(0, equals), kvPair.substr(equals + 1)));
       }
     }
+
+    // HTTP/2 requests arrive as "HTTP/2.0", the form the HTTP/2 session rewrites them into. Unrecognized versions
+    // are treated as 1.1.
+    static HttpVersion::Value ParseVersion(std::string const& protocol)
+    {
+      if (protocol == "HTTP/1.0")
+      {
+        return HttpVersion::Http10;
+      }
+      else if (protocol == "HTTP/2.0" || protocol == "HTTP/2")
+      {
+        return HttpVersion::Http2;
+      }
+
+      return HttpVersion::Http11;
+    }
+
+    static std::string ToLower(std::string text)
+    {
+      std::transform(text.begin(), text.end(), text.begin(), [](char c)
+      {
+        return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+      });
+
+      return text;
+    }
   };
 } // namespace OlympusWebServer
\ No newline at end of file
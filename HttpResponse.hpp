@@ -15,7 +15,7 @@ namespace OlympusWebServer
     std::string data;
     HttpDataType::Value dataType;
     std::string fullResponse;
-    float httpVersion;
+    HttpVersion::Value httpVersion;
     std::unordered_map<std::string, std::string> params;
     HttpStatus::Value status;
 
@@ -24,6 +24,7 @@ namespace OlympusWebServer
     HttpResponse() :
       data("<html><heading>Hi there! I'm a web server for Olympus. :)</heading></html>"),
       dataType(HttpDataType::Html),
+      httpVersion(HttpVersion::Http11),
       status(HttpStatus::Ok)
     {
       FormatResponse();
@@ -50,8 +51,9 @@ namespace OlympusWebServer
       std::string data_,
       HttpDataType::Value dataType_ = HttpDataType::Json,
       HttpStatus::Value status_ = HttpStatus::Ok) :
+        data(std::move(data_)),
         dataType(dataType_),
-        httpVersion(1.1f),
+        httpVersion(HttpVersion::Http11),
         status(status_)
     {
       FormatResponse();
@@ -59,17 +61,53 @@ namespace OlympusWebServer
 
     explicit HttpResponse(HttpStatus::Value status_) :
       dataType(HttpDataType::Html),
-      httpVersion(1.1f),
+      httpVersion(HttpVersion::Http11),
       status(status_)
     {
       FormatResponse();
     }
 
-    std::string GetFormattedResponse() const
+    // Value for the Content-Type header.
+    char const* GetContentType() const
+    {
+      switch (dataType)
+      {
+      case HttpDataType::Html:
+        return "text/html; charset=utf-8";
+      case HttpDataType::Json:
+        return "application/json; charset=utf-8";
+      default:
+        throw std::runtime_error("HttpResponse.GetContentType - Unknown HttpDataType being used");
+      }
+    }
+
+    std::string const& GetData() const
+    {
+      return data;
+    }
+
+    std::string const& GetFormattedResponse() const
     {
       return fullResponse;
     }
 
+    std::unordered_map<std::string, std::string> const& GetParams() const
+    {
+      return params;
+    }
+
+    HttpStatus::Value GetStatus() const
+    {
+      return status;
+    }
+
+    // Adds or replaces a header.
+    void SetParam(std::string const& name, std::string value)
+    {
+      params[name] = std::move(value);
+      FormatResponse();
+    }
+
   private: // methods
 
     void FormatResponse()
@@ -77,32 +115,23 @@ namespace OlympusWebServer
       auto ostream = std::ostringstream();
 
       // Write the header.
-      ostream << "HTTP/" << (httpVersion == 1.0f ? "1.0" : "1.1") << " ";
+      ostream << "HTTP/" << (httpVersion == HttpVersion::Http10 ? "1.0" : "1.1") << " ";
       ostream << ToString(status);
       for (auto it = params.begin(); it != params.end(); ++it)
       {
         auto& param = *it;
-        ostream << std::endl << param.first << ": " << param.second;
+        ostream << "\r\n" << param.first << ": " << param.second;
       }
-      ostream << std::endl;
+      ostream << "\r\n";
 
-      ostream << "Content-Type: ";
-      switch (dataType)
+      // Interim (1xx) responses have no body, so they carry no content headers either.
+      if (status >= 200)
       {
-      case HttpDataType::Html: 
-        ostream << "text/html;"; 
-        break;
-      case HttpDataType::Json:
-        ostream << "application/json";
-        break;
-      default:
-        throw std::runtime_error("HttpResponse.FormatResponse - Unknown HttpDataType being used");
+        ostream << "Content-Type: " << GetContentType() << "\r\n";
+        ostream << "Content-Length: " << data.size() << "\r\n";
       }
 
-      ostream << "charset=utf-8" << std::endl;
-      ostream << "Content-Length: " << data.size();
-
-      ostream << std::endl << std::endl << std::move(data);
+      ostream << "\r\n" << data;
       fullResponse = ostream.str();
     }
   };
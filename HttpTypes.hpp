@@ -25,19 +25,34 @@ namespace OlympusWebServer
     };
   }
 
+  namespace HttpVersion
+  {
+    enum Value
+    {
+      Http10,
+      Http11,
+      Http2
+    };
+  }
+
   namespace HttpStatus
   {
     enum Value
     {
       Continue = 100,
+      SwitchingProtocols = 101,
       Ok = 200,
       Created = 201,
       BadRequest = 400,
       Unauthorized = 401,
       Forbidden = 403,
       NotFound = 404,
+      TooManyRequests = 429,
       ServerError = 500,
-      ServiceUnavailable = 503
+      NotImplemented = 501,
+      BadGateway = 502,
+      ServiceUnavailable = 503,
+      GatewayTimeout = 504
     };
   }
 
@@ -46,14 +61,19 @@ namespace OlympusWebServer
     switch (status)
     {
     case HttpStatus::Continue:            return "100 Continue";
+    case HttpStatus::SwitchingProtocols:  return "101 Switching Protocols";
     case HttpStatus::Ok:                  return "200 OK";
     case HttpStatus::Created:             return "201 Created";
     case HttpStatus::BadRequest:          return "400 Bad Request";
     case HttpStatus::Unauthorized:        return "401 Unauthorized";
     case HttpStatus::Forbidden:           return "403 Forbidden";
     case HttpStatus::NotFound:            return "404 Not Found";
+    case HttpStatus::TooManyRequests:     return "429 Too Many Requests";
     case HttpStatus::ServerError:         return "500 Server Error";
+    case HttpStatus::NotImplemented:      return "501 Not Implemented";
+    case HttpStatus::BadGateway:          return "502 Bad Gateway";
     case HttpStatus::ServiceUnavailable:  return "503 Service Unavailable";
+    case HttpStatus::GatewayTimeout:      return "504 Gateway Timeout";
     default:                              return 0;
     }
   }
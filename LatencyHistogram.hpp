@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace OlympusWebServer
+{
+  // Log-linear histogram of nanosecond values with 1/64 relative precision, in the style of HdrHistogram. Memory is
+  // fixed regardless of how many values are recorded.
+  class LatencyHistogram
+  {
+  private: // data
+
+    static const int SubBucketBits = 7;
+    static const int SubBucketHalf = 1 << (SubBucketBits - 1);
+    static const int BucketCount = 64 - SubBucketBits + 1;
+
+    std::vector<unsigned long long> counts;
+    unsigned long long maximum;
+    unsigned long long total;
+
+  public: // methods
+
+    LatencyHistogram() :
+      counts((BucketCount + 1) * SubBucketHalf),
+      maximum(0),
+      total(0)
+    {
+    }
+
+    LatencyHistogram(LatencyHistogram&& b)
+    {
+      *this = std::move(b);
+    }
+
+    LatencyHistogram& operator=(LatencyHistogram&& b)
+    {
+      counts = std::move(b.counts);
+      maximum = b.maximum;
+      total = b.total;
+
+      b.maximum = 0;
+      b.total = 0;
+
+      return *this;
+    }
+
+    unsigned long long GetCount() const
+    {
+      return total;
+    }
+
+    unsigned long long GetMaximum() const
+    {
+      return maximum;
+    }
+
+    // Returns the value at the given percentile (0-100), accurate to the histogram's precision.
+    unsigned long long GetPercentile(double percentile) const
+    {
+      if (total == 0)
+      {
+        return 0;
+      }
+
+      auto rank = static_cast<unsigned long long>(percentile / 100.0 * static_cast<double>(total) + 0.5);
+      if (rank < 1)
+      {
+        rank = 1;
+      }
+
+      auto seen = 0ull;
+      for (auto i = 0u; i < counts.size(); ++i)
+      {
+        seen += counts[i];
+        if (seen >= rank)
+        {
+          auto value = ValueAt(i);
+          return value < maximum ? value : maximum;
+        }
+      }
+
+      return maximum;
+    }
+
+    void Merge(LatencyHistogram const& b)
+    {
+      for (auto i = 0u; i < counts.size(); ++i)
+      {
+        counts[i] += b.counts[i];
+      }
+
+      total += b.total;
+      if (b.maximum > maximum)
+      {
+        maximum = b.maximum;
+      }
+    }
+
+    void Record(unsigned long long value)
+    {
+      ++counts[IndexOf(value)];
+      ++total;
+      if (value > maximum)
+      {
+        maximum = value;
+      }
+    }
+
+  private: // methods
+
+    static std::size_t IndexOf(unsigned long long value)
+    {
+      auto bucket = 0;
+      while ((value >> bucket) >= 2 * SubBucketHalf)
+      {
+        ++bucket;
+      }
+
+      return static_cast<std::size_t>(bucket * SubBucketHalf + (value >> bucket));
+    }
+
+    // Returns the midpoint of the values that map to the given index.
+    static unsigned long long ValueAt(std::size_t index)
+    {
+      auto bucket = index < 2 * SubBucketHalf ? 0 : static_cast<int>(index / SubBucketHalf) - 1;
+      auto subBucket = static_cast<unsigned long long>(index - bucket * SubBucketHalf);
+      return (subBucket << bucket) + ((1ull << bucket) >> 1);
+    }
+  };
+} // namespace OlympusWebServer
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+namespace OlympusWebServer
+{
+  // Tuning for a listening socket and the connections accepted from it. Options the platform does not support are
+  // ignored.
+  class ListenerOptions
+  {
+  public: // data
+
+    // Most connections accepted per WebServer::Update, so a connection storm cannot starve established clients.
+    unsigned acceptBudget;
+
+    // Length of the accept queue. Linux silently caps it at net.core.somaxconn.
+    int backlog;
+
+    // TCP_DEFER_ACCEPT: seconds the kernel holds a handshaken connection waiting for its first bytes before waking
+    // the server, so idle and port-scan connections never reach Update. Zero disables.
+    int deferAcceptSeconds;
+
+    // TCP_FASTOPEN: number of pending fast-open requests, letting returning clients send their request in the SYN.
+    // Zero disables. Linux also needs net.ipv4.tcp_fastopen to include 2 (server).
+    int fastOpenQueue;
+
+    // TCP_NODELAY on accepted connections. Responses are written whole, so Nagle only adds delay when the client's
+    // delayed ACK for the previous response has not arrived yet.
+    bool noDelay;
+
+    // SO_REUSEADDR, so a restarted server can bind while old connections sit in TIME_WAIT. Not set on Windows,
+    // where it would allow other processes to steal the port. For a Unix domain socket, removes a stale socket
+    // file left at the path instead.
+    bool reuseAddress;
+
+  public: // methods
+
+    ListenerOptions() :
+      acceptBudget(64),
+      backlog(1024),
+      deferAcceptSeconds(0),
+      fastOpenQueue(0),
+      noDelay(true),
+      reuseAddress(true)
+    {
+    }
+  };
+} // namespace OlympusWebServer
\ No newline at end of file
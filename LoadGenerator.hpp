@@ -0,0 +1,712 @@
+#pragma once
+
+#include <cctype>
+#include <cstdlib>
+#include <deque>
+#include "Endpoint.hpp"
+#include "Http2Session.hpp"
+#include "LatencyHistogram.hpp"
+#include <memory>
+#include <string>
+#include "Threading.hpp"
+#include "Trace.hpp"
+#include <vector>
+#include "Winsock.hpp"
+
+namespace OlympusWebServer
+{
+  class LoadGeneratorOptions
+  {
+  public: // data
+
+    unsigned connections;
+    unsigned depth;
+    double durationSeconds;
+    Endpoint endpoint;
+
+    // Speak cleartext HTTP/2 with prior knowledge, with depth concurrent streams per connection instead of depth
+    // pipelined requests.
+    bool http2;
+    double rate;
+    std::string request;
+    unsigned threads;
+
+  public: // methods
+
+    LoadGeneratorOptions() :
+      connections(16),
+      depth(1),
+      durationSeconds(5.0),
+      endpoint(Endpoint::Loopback(8800)),
+      http2(false),
+      rate(0.0),
+      request(
+        "GET /index.html HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "User-Agent: rs-webserver-benchmark\r\n"
+        "Accept: */*\r\n"
+        "\r\n"),
+      threads(2)
+    {
+    }
+  };
+
+  class LoadGeneratorResult
+  {
+  public: // data
+
+    unsigned long long completed;
+    double elapsedSeconds;
+    unsigned long long errors;
+    LatencyHistogram latency;
+    unsigned long long timeouts;
+
+  public: // methods
+
+    LoadGeneratorResult() :
+      completed(0),
+      elapsedSeconds(0.0),
+      errors(0),
+      timeouts(0)
+    {
+    }
+
+    LoadGeneratorResult(LoadGeneratorResult&& b)
+    {
+      *this = std::move(b);
+    }
+
+    LoadGeneratorResult& operator=(LoadGeneratorResult&& b)
+    {
+      completed = b.completed;
+      elapsedSeconds = b.elapsedSeconds;
+      errors = b.errors;
+      latency = std::move(b.latency);
+      timeouts = b.timeouts;
+
+      return *this;
+    }
+
+    void Merge(LoadGeneratorResult const& b)
+    {
+      completed += b.completed;
+      errors += b.errors;
+      latency.Merge(b.latency);
+      timeouts += b.timeouts;
+    }
+  };
+
+  // Drives a server over loopback with a fixed schedule of requests per connection. With a target rate the schedule
+  // is open-loop: latency is measured from when a request was due rather than when it could be sent, so a stalled
+  // server is charged for the requests queued behind the stall (no coordinated omission). A rate of zero runs
+  // closed-loop, keeping every connection at its pipelining depth.
+  class LoadGenerator
+  {
+  private: // types
+
+    class Request
+    {
+    public: // data
+
+      long long due;
+      bool isSuccess;
+      unsigned streamId; // zero for HTTP/1.1
+
+    public: // methods
+
+      Request(long long due_, unsigned streamId_) :
+        due(due_),
+        isSuccess(false),
+        streamId(streamId_)
+      {
+      }
+    };
+
+    class Connection
+    {
+    public: // data
+
+      HpackDecoder decoder;
+      HpackEncoder encoder;
+      std::string input;
+      long long nextDue;
+      unsigned nextStreamId;
+      std::deque<Request> outstanding;
+      std::string output;
+      std::size_t receivedData;
+      SOCKET socket;
+
+    public: // methods
+
+      Connection() :
+        nextDue(0),
+        nextStreamId(1),
+        receivedData(0),
+        socket(INVALID_SOCKET)
+      {
+      }
+
+      Connection(Connection&& b)
+      {
+        *this = std::move(b);
+      }
+
+      Connection& operator=(Connection&& b)
+      {
+        decoder = std::move(b.decoder);
+        encoder = std::move(b.encoder);
+        input = std::move(b.input);
+        nextDue = b.nextDue;
+        nextStreamId = b.nextStreamId;
+        outstanding = std::move(b.outstanding);
+        output = std::move(b.output);
+        receivedData = b.receivedData;
+        socket = b.socket;
+
+        b.socket = INVALID_SOCKET;
+
+        return *this;
+      }
+
+      ~Connection()
+      {
+        Close();
+      }
+
+      void Close()
+      {
+        if (socket != INVALID_SOCKET)
+        {
+          Winsock::DestroySocket(socket);
+          socket = INVALID_SOCKET;
+        }
+      }
+    };
+
+  private: // data
+
+    HttpHeaderList http2Headers;
+    LoadGeneratorOptions options;
+
+  public: // methods
+
+    explicit LoadGenerator(LoadGeneratorOptions options_) :
+      options(std::move(options_))
+    {
+      if (options.threads == 0 || options.connections < options.threads || options.depth == 0)
+      {
+        throw std::runtime_error("LoadGenerator.LoadGenerator - Needs at least one connection per thread and a depth");
+      }
+
+      if (options.http2)
+      {
+        http2Headers = ToHttp2Headers(options.request);
+      }
+    }
+
+    // Returns the length of the first complete response in input, zero if it is incomplete, or npos if malformed.
+    static std::size_t ParseResponse(std::string const& input, std::size_t offset, bool& isSuccess)
+    {
+      auto crlfEnd = input.find("\r\n\r\n", offset);
+      auto lfEnd = input.find("\n\n", offset);
+      if (crlfEnd == std::string::npos && lfEnd == std::string::npos)
+      {
+        return 0;
+      }
+      auto headerEnd = crlfEnd < lfEnd ? crlfEnd + 4 : lfEnd + 2;
+
+      if (input.compare(offset, 7, "HTTP/1.") != 0 || input.size() < offset + 12)
+      {
+        return std::string::npos;
+      }
+      isSuccess = input[offset + 9] == '2';
+
+      auto contentLength = 0ul;
+      static const std::string lengthHeader = "content-length:";
+      for (auto line = input.find('\n', offset); line != std::string::npos && line + 1 < headerEnd;
+        line = input.find('\n', line + 1))
+      {
+        auto matches = true;
+        for (auto i = 0u; i < lengthHeader.size() && matches; ++i)
+        {
+          matches = line + 1 + i < headerEnd &&
+            std::tolower(static_cast<unsigned char>(input[line + 1 + i])) == lengthHeader[i];
+        }
+
+        if (matches)
+        {
+          contentLength = std::strtoul(input.c_str() + line + 1 + lengthHeader.size(), NULL, 10);
+          break;
+        }
+      }
+
+      if (input.size() < headerEnd + contentLength)
+      {
+        return 0;
+      }
+
+      return headerEnd + contentLength - offset;
+    }
+
+    LoadGeneratorResult Run()
+    {
+      Winsock::Initialize();
+
+      auto results = std::vector<LoadGeneratorResult>(options.threads);
+      auto threads = std::vector<std::unique_ptr<Thread>>();
+
+      // Give every thread time to connect before the schedule starts, so setup is not charged as latency.
+      static const auto setupMicroseconds = 250000.0;
+      auto start = TraceClock::Now() + TraceClock::FromMicroseconds(setupMicroseconds);
+      auto end = start + TraceClock::FromMicroseconds(options.durationSeconds * 1000000.0);
+
+      for (auto i = 0u; i < options.threads; ++i)
+      {
+        auto connections = options.connections / options.threads + (i < options.connections % options.threads ? 1 : 0);
+        auto& result = results[i];
+        threads.push_back(std::unique_ptr<Thread>(new Thread([this, connections, start, end, &result]()
+        {
+          RunThread(connections, start, end, result);
+        })));
+      }
+
+      for (auto it = threads.begin(); it != threads.end(); ++it)
+      {
+        (*it)->Join();
+      }
+
+      auto total = LoadGeneratorResult();
+      for (auto it = results.begin(); it != results.end(); ++it)
+      {
+        total.Merge(*it);
+      }
+      total.elapsedSeconds = options.durationSeconds;
+
+      return total;
+    }
+
+  private: // methods
+
+    // Opens the next stream with a HEADERS frame carrying the request.
+    void AppendHttp2Request(Connection& connection)
+    {
+      auto block = std::string();
+      for (auto it = http2Headers.begin(); it != http2Headers.end(); ++it)
+      {
+        connection.encoder.Encode(it->first, it->second, block);
+      }
+
+      auto flags = Http2Flag::EndHeaders | Http2Flag::EndStream;
+      Http2Session::AppendFrameHeader(
+        connection.output, block.size(), Http2FrameType::Headers, static_cast<unsigned char>(flags), connection.nextStreamId);
+      connection.output += block;
+      connection.nextStreamId += 2;
+    }
+
+    // Retires the request on an HTTP/2 stream. Returns false if no such request is outstanding.
+    bool Finish(Connection& connection, unsigned streamId, bool isSuccess, long long now, LoadGeneratorResult& result)
+    {
+      for (auto it = connection.outstanding.begin(); it != connection.outstanding.end(); ++it)
+      {
+        if (it->streamId == streamId)
+        {
+          Record(*it, isSuccess, now, result);
+          connection.outstanding.erase(it);
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    bool Flush(Connection& connection)
+    {
+      if (connection.output.empty())
+      {
+        return true;
+      }
+
+      auto sent = Winsock::Send(connection.socket, connection.output);
+      if (sent == SOCKET_ERROR)
+      {
+        return WSAGetLastError() == WSAEWOULDBLOCK;
+      }
+
+      connection.output.erase(0, static_cast<std::size_t>(sent));
+      return true;
+    }
+
+    // Reads everything available and retires complete responses. Returns false if the connection is unusable.
+    bool Read(Connection& connection, long long now, LoadGeneratorResult& result)
+    {
+      static const auto bufferSize = 64u * 1024u;
+      char buffer[bufferSize];
+
+      for (;;)
+      {
+        auto received = Winsock::Receive(connection.socket, buffer);
+        if (received == SOCKET_ERROR)
+        {
+          if (WSAGetLastError() == WSAEWOULDBLOCK)
+          {
+            break;
+          }
+          return false;
+        }
+        if (received == 0)
+        {
+          return false;
+        }
+
+        connection.input.append(buffer, static_cast<std::size_t>(received));
+        if (received < static_cast<int>(bufferSize))
+        {
+          break;
+        }
+      }
+
+      return options.http2 ? ReadFrames(connection, now, result) : ReadResponses(connection, now, result);
+    }
+
+    // Handles every complete HTTP/2 frame in the input. A stream's response is complete at END_STREAM; its status
+    // comes from the HEADERS frame, which the server always sends whole.
+    bool ReadFrames(Connection& connection, long long now, LoadGeneratorResult& result)
+    {
+      auto& input = connection.input;
+      auto offset = std::size_t();
+      auto headers = HttpHeaderList();
+
+      while (input.size() - offset >= Http2Session::FrameHeaderLength)
+      {
+        auto header = reinterpret_cast<unsigned char const*>(input.data() + offset);
+        auto length = (static_cast<std::size_t>(header[0]) << 16) | (header[1] << 8) | header[2];
+        if (input.size() - offset < Http2Session::FrameHeaderLength + length)
+        {
+          break;
+        }
+
+        auto type = header[3];
+        auto flags = header[4];
+        auto streamId = Http2Session::ReadUint32(input.data() + offset + 5) & 0x7FFFFFFFu;
+        auto payload = input.data() + offset + Http2Session::FrameHeaderLength;
+        offset += Http2Session::FrameHeaderLength + length;
+
+        switch (type)
+        {
+        case Http2FrameType::Data:
+          connection.receivedData += length;
+          if ((flags & Http2Flag::EndStream) != 0)
+          {
+            auto isSuccess = false;
+            for (auto it = connection.outstanding.begin(); it != connection.outstanding.end(); ++it)
+            {
+              isSuccess = isSuccess || (it->streamId == streamId && it->isSuccess);
+            }
+            if (!Finish(connection, streamId, isSuccess, now, result))
+            {
+              return false;
+            }
+          }
+          break;
+
+        case Http2FrameType::Headers:
+          {
+            if ((flags & (Http2Flag::EndHeaders | Http2Flag::Padded | Http2Flag::Priority)) != Http2Flag::EndHeaders)
+            {
+              return false;
+            }
+
+            headers.clear();
+            if (!connection.decoder.Decode(payload, length, headers))
+            {
+              return false;
+            }
+
+            auto isSuccess = false;
+            for (auto it = headers.begin(); it != headers.end(); ++it)
+            {
+              isSuccess = isSuccess || (it->first == ":status" && !it->second.empty() && it->second[0] == '2');
+            }
+
+            if ((flags & Http2Flag::EndStream) != 0)
+            {
+              if (!Finish(connection, streamId, isSuccess, now, result))
+              {
+                return false;
+              }
+              break;
+            }
+
+            for (auto it = connection.outstanding.begin(); it != connection.outstanding.end(); ++it)
+            {
+              if (it->streamId == streamId)
+              {
+                it->isSuccess = isSuccess;
+              }
+            }
+          }
+          break;
+
+        case Http2FrameType::ResetStream:
+          if (!Finish(connection, streamId, false, now, result))
+          {
+            return false;
+          }
+          break;
+
+        case Http2FrameType::Settings:
+          if ((flags & Http2Flag::Ack) == 0)
+          {
+            Http2Session::AppendFrameHeader(connection.output, 0, Http2FrameType::Settings, Http2Flag::Ack, 0);
+          }
+          break;
+
+        case Http2FrameType::Ping:
+          if ((flags & Http2Flag::Ack) == 0)
+          {
+            Http2Session::AppendFrameHeader(connection.output, 8, Http2FrameType::Ping, Http2Flag::Ack, 0);
+            connection.output.append(payload, 8);
+          }
+          break;
+
+        case Http2FrameType::GoAway:
+          return false;
+        }
+      }
+
+      input.erase(0, offset);
+
+      // Give the connection window back once half of the default has been used. Stream windows are fresh for each
+      // request, and the responses under test fit in them.
+      if (connection.receivedData >= 32768)
+      {
+        Http2Session::AppendFrameHeader(connection.output, 4, Http2FrameType::WindowUpdate, 0, 0);
+        Http2Session::AppendUint32(connection.output, static_cast<unsigned>(connection.receivedData));
+        connection.receivedData = 0;
+      }
+
+      return true;
+    }
+
+    bool ReadResponses(Connection& connection, long long now, LoadGeneratorResult& result)
+    {
+      auto offset = std::size_t();
+      for (;;)
+      {
+        auto isSuccess = false;
+        auto length = ParseResponse(connection.input, offset, isSuccess);
+        if (length == std::string::npos)
+        {
+          return false;
+        }
+        if (length == 0)
+        {
+          break;
+        }
+        offset += length;
+
+        if (connection.outstanding.empty())
+        {
+          return false; // response nobody asked for
+        }
+        Record(connection.outstanding.front(), isSuccess, now, result);
+        connection.outstanding.pop_front();
+      }
+
+      connection.input.erase(0, offset);
+      return true;
+    }
+
+    static void Record(Request const& request, bool isSuccess, long long now, LoadGeneratorResult& result)
+    {
+      if (!isSuccess)
+      {
+        ++result.errors;
+        return;
+      }
+
+      ++result.completed;
+      result.latency.Record(static_cast<unsigned long long>(TraceClock::ToMicroseconds(now - request.due) * 1000.0));
+    }
+
+    void RunThread(unsigned connectionCount, long long start, long long end, LoadGeneratorResult& result)
+    {
+      auto connections = std::vector<Connection>(connectionCount);
+      auto descriptors = std::vector<pollfd>(connectionCount);
+
+      // Each connection carries rate / connections of the load, staggered so they do not all fire at once.
+      auto interval = options.rate > 0.0 ?
+        TraceClock::FromMicroseconds(1000000.0 * options.connections / options.rate) : 0ll;
+
+      for (auto i = 0u; i < connectionCount; ++i)
+      {
+        auto& connection = connections[i];
+        connection.socket = Winsock::CreateStreamSocket(options.endpoint.GetFamily());
+        if (connection.socket == INVALID_SOCKET ||
+          !Winsock::Connect(connection.socket, options.endpoint.GetAddress(), options.endpoint.GetLength()) ||
+          !Winsock::IoctlSocket(connection.socket, false))
+        {
+          throw std::runtime_error("LoadGenerator.RunThread - Unable to connect to the server");
+        }
+        connection.nextDue = start + (interval * i) / connectionCount;
+        if (options.http2)
+        {
+          connection.output = Http2Session::GetPreface();
+          Http2Session::AppendFrameHeader(connection.output, 0, Http2FrameType::Settings, 0, 0);
+        }
+
+        descriptors[i].fd = connection.socket;
+      }
+
+      // Requests still outstanding this long after the run ends are counted as timeouts.
+      auto drainEnd = end + TraceClock::FromMicroseconds(1000000.0);
+      auto openConnections = connectionCount;
+
+      for (auto now = TraceClock::Now(); now < drainEnd && openConnections > 0; now = TraceClock::Now())
+      {
+        auto isSending = now >= start && now < end;
+        auto isDrained = true;
+        auto nextWake = now < start ? start : isSending ? end : drainEnd;
+
+        for (auto i = 0u; i < connectionCount; ++i)
+        {
+          auto& connection = connections[i];
+          descriptors[i].events = 0;
+          if (connection.socket == INVALID_SOCKET)
+          {
+            descriptors[i].fd = INVALID_SOCKET;
+            continue;
+          }
+
+          while (isSending && connection.outstanding.size() < options.depth && (interval == 0 || connection.nextDue <= now))
+          {
+            auto due = interval == 0 ? now : connection.nextDue;
+            if (options.http2)
+            {
+              connection.outstanding.push_back(Request(due, connection.nextStreamId));
+              AppendHttp2Request(connection);
+            }
+            else
+            {
+              connection.output += options.request;
+              connection.outstanding.push_back(Request(due, 0));
+            }
+            connection.nextDue += interval;
+          }
+
+          if (!Flush(connection))
+          {
+            result.errors += connection.outstanding.size();
+            connection.outstanding.clear();
+            connection.Close();
+            --openConnections;
+            continue;
+          }
+
+          if (isSending && interval != 0 && connection.nextDue < nextWake)
+          {
+            nextWake = connection.nextDue;
+          }
+          isDrained = isDrained && connection.outstanding.empty();
+
+          descriptors[i].events = static_cast<short>(POLLIN | (connection.output.empty() ? 0 : POLLOUT));
+        }
+
+        if (now >= end && isDrained)
+        {
+          break;
+        }
+
+        auto timeoutMilliseconds = static_cast<int>(TraceClock::ToMicroseconds(nextWake - now) / 1000.0);
+        if (Winsock::Poll(descriptors.data(), descriptors.size(), timeoutMilliseconds < 1 ? 0 : timeoutMilliseconds) <= 0)
+        {
+          continue;
+        }
+
+        now = TraceClock::Now();
+        for (auto i = 0u; i < connectionCount; ++i)
+        {
+          auto& connection = connections[i];
+          if (connection.socket == INVALID_SOCKET || (descriptors[i].revents & (POLLIN | POLLERR | POLLHUP)) == 0)
+          {
+            continue;
+          }
+
+          if (!Read(connection, now, result))
+          {
+            result.errors += connection.outstanding.size();
+            connection.outstanding.clear();
+            connection.Close();
+            --openConnections;
+          }
+        }
+      }
+
+      // At a fixed rate, requests that fell due before the end but never went out, because the connection already
+      // had depth requests outstanding or had failed, count as well; leaving them out would hide a stalled server.
+      for (auto it = connections.begin(); it != connections.end(); ++it)
+      {
+        auto unsent = interval != 0 && it->nextDue < end ? (end - it->nextDue + interval - 1) / interval : 0;
+        if (it->socket == INVALID_SOCKET)
+        {
+          result.errors += unsent;
+        }
+        else
+        {
+          result.timeouts += it->outstanding.size() + unsent;
+        }
+      }
+    }
+
+    // Converts the HTTP/1.1 request to send into an HTTP/2 header list. Host becomes :authority and headers HTTP/2
+    // forbids are dropped. Only body-less requests are supported.
+    static HttpHeaderList ToHttp2Headers(std::string const& request)
+    {
+      auto lineEnd = request.find('\n');
+      auto requestLine = request.substr(0, lineEnd);
+      auto methodEnd = requestLine.find(' ');
+      auto pathEnd = requestLine.find(' ', methodEnd + 1);
+
+      auto headers = HttpHeaderList();
+      headers.push_back(HttpHeader(":method", requestLine.substr(0, methodEnd)));
+      headers.push_back(HttpHeader(":scheme", "http"));
+      headers.push_back(HttpHeader(":path", requestLine.substr(methodEnd + 1, pathEnd - methodEnd - 1)));
+
+      while (lineEnd != std::string::npos)
+      {
+        auto lineStart = lineEnd + 1;
+        lineEnd = request.find('\n', lineStart);
+        auto line = request.substr(lineStart, lineEnd == std::string::npos ? std::string::npos : lineEnd - lineStart);
+        if (!line.empty() && line[line.size() - 1] == '\r')
+        {
+          line.erase(line.size() - 1);
+        }
+
+        auto colon = line.find(':');
+        if (line.empty() || colon == std::string::npos)
+        {
+          break;
+        }
+
+        auto name = line.substr(0, colon);
+        for (auto c = name.begin(); c != name.end(); ++c)
+        {
+          *c = static_cast<char>(std::tolower(static_cast<unsigned char>(*c)));
+        }
+        auto valueStart = line.find_first_not_of(" \t", colon + 1);
+        auto value = valueStart == std::string::npos ? std::string() : line.substr(valueStart);
+
+        if (name == "host")
+        {
+          headers.insert(headers.begin() + 3, HttpHeader(":authority", value));
+        }
+        else if (name != "connection" && name != "keep-alive" && name != "transfer-encoding" && name != "upgrade")
+        {
+          headers.push_back(HttpHeader(name, value));
+        }
+      }
+
+      return headers;
+    }
+  };
+} // namespace OlympusWebServer
\ No newline at end of file
@@ -1,12 +1,141 @@
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 #include "WebServer.hpp"
 using namespace OlympusWebServer;
 
-int main()
+// Each argument is an endpoint to listen on, e.g. "*:8000", "[::1]:8000" or "unix:/run/rs-webserver.sock".
+// Endpoints prefixed with "tls:", e.g. "tls:*:8443", serve TLS with the certificate and key given by --cert and
+// --key. With no endpoints, listens on loopback port 8000.
+//
+// "--proxy PREFIX=UPSTREAM[,UPSTREAM...]" forwards requests whose path starts with PREFIX to the upstream
+// endpoints, e.g. "--proxy /api/=127.0.0.1:9000,unix:/run/api.sock".
+//
+// "--rate-limit PREFIX=RATE,BURST[,HEADER]" limits each client to RATE requests per second, with bursts of up to
+// BURST, on paths starting with PREFIX. Clients are told apart by address, or by the value of HEADER if given, e.g.
+// "--rate-limit /api/=10,20,x-api-key".
+int main(int argc, char** argv)
 {
-  auto webServer = WebServer(8000);
+  auto endpoints = std::vector<Endpoint>();
+  auto proxyRoutes = std::vector<std::pair<std::string, std::vector<Endpoint>>>();
+  auto rateLimiter = std::shared_ptr<RateLimiter>();
+  auto tlsEndpoints = std::vector<Endpoint>();
+  auto tlsOptions = TlsOptions();
+
+  for (auto i = 1; i < argc; ++i)
+  {
+    if (std::strcmp(argv[i], "--cert") == 0 && i + 1 < argc)
+    {
+      tlsOptions.certificateFile = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--key") == 0 && i + 1 < argc)
+    {
+      tlsOptions.privateKeyFile = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--proxy") == 0 && i + 1 < argc)
+    {
+      auto route = std::string(argv[++i]);
+      auto equals = route.find('=');
+      if (equals == std::string::npos)
+      {
+        std::cerr << "--proxy needs PREFIX=UPSTREAM[,UPSTREAM...]" << std::endl;
+        return 1;
+      }
+
+      auto upstreams = std::vector<Endpoint>();
+      for (auto start = equals + 1; start <= route.size();)
+      {
+        auto comma = route.find(',', start);
+        if (comma == std::string::npos)
+        {
+          comma = route.size();
+        }
+        upstreams.push_back(Endpoint::Parse(route.substr(start, comma - start)));
+        start = comma + 1;
+      }
+      proxyRoutes.push_back(std::make_pair(route.substr(0, equals), upstreams));
+    }
+    else if (std::strcmp(argv[i], "--rate-limit") == 0 && i + 1 < argc)
+    {
+      auto rule = std::string(argv[++i]);
+      auto equals = rule.find('=');
+      auto options = RateLimitOptions();
+      auto end = static_cast<char*>(NULL);
+      if (equals != std::string::npos)
+      {
+        options.requestsPerSecond = std::strtod(rule.c_str() + equals + 1, &end);
+        options.burst = *end == ',' ? std::strtod(end + 1, &end) : 0.0;
+      }
+      if (equals == std::string::npos || (*end != '\0' && *end != ','))
+      {
+        std::cerr << "--rate-limit needs PREFIX=RATE,BURST[,HEADER]" << std::endl;
+        return 1;
+      }
+      if (*end == ',')
+      {
+        options.headerName = end + 1;
+      }
+
+      try
+      {
+        if (!rateLimiter)
+        {
+          rateLimiter = std::make_shared<RateLimiter>();
+        }
+        rateLimiter->AddRule(rule.substr(0, equals), options);
+      }
+      catch (std::exception const& e)
+      {
+        std::cerr << e.what() << std::endl;
+        return 1;
+      }
+    }
+    else if (std::strncmp(argv[i], "tls:", 4) == 0)
+    {
+      tlsEndpoints.push_back(Endpoint::Parse(argv[i] + 4));
+    }
+    else
+    {
+      endpoints.push_back(Endpoint::Parse(argv[i]));
+    }
+  }
+
+  auto webServer = endpoints.empty() && tlsEndpoints.empty() ? WebServer(8000) : WebServer(endpoints);
+  for (auto it = proxyRoutes.begin(); it != proxyRoutes.end(); ++it)
+  {
+    webServer.AddProxyRoute(it->first, it->second);
+  }
+  webServer.SetRateLimiter(rateLimiter);
+
+  if (!tlsEndpoints.empty())
+  {
+#ifndef _WIN32
+    // OpenSSL writes with write(2), so a client that disconnects mid-response would otherwise kill the process.
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+    try
+    {
+      auto tls = std::make_shared<TlsContext>(tlsOptions);
+      for (auto it = tlsEndpoints.begin(); it != tlsEndpoints.end(); ++it)
+      {
+        webServer.AddListener(*it, tls);
+      }
+    }
+    catch (std::exception const& e)
+    {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  }
 
   while (webServer.IsRunning())
   {
     webServer.Update();
   }
-}
\ No newline at end of file
+}
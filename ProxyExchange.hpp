@@ -0,0 +1,871 @@
+#pragma once
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include "Endpoint.hpp"
+#include "HttpResponse.hpp"
+#include "ReceiveBuffer.hpp"
+#include "ReverseProxy.hpp"
+#include "SplicePipe.hpp"
+#include <string>
+#include "Trace.hpp"
+#include "Upstream.hpp"
+#include "Winsock.hpp"
+
+namespace OlympusWebServer
+{
+  namespace ProxyStatus
+  {
+    enum Value
+    {
+      Forwarding,
+      Finished, // the client connection can carry on with its next request
+      Closing   // the client connection should be closed once its output is flushed
+    };
+  }
+
+  namespace ProxyBodyState
+  {
+    enum Value
+    {
+      Headers,      // waiting for the response headers
+      Length,       // Content-Length body
+      ChunkSize,    // chunked body, waiting for a chunk-size line
+      ChunkData,    // chunked body, inside a chunk (including its closing CRLF)
+      ChunkTrailer, // chunked body, after the last chunk
+      UntilClose,   // body delimited by the upstream closing the connection
+      Done
+    };
+  }
+
+  // One request forwarded from a client connection to an upstream, and the upstream's response relayed back.
+  // Neither body is held whole: the request body is forwarded as the client sends it and the response as the
+  // upstream does, with at most MaxBuffered bytes of each in user space at once. Where both sockets allow it, bodies
+  // skip user space altogether through a SplicePipe.
+  //
+  // The request goes out with its hop-by-hop headers removed, including any its Connection header names, so the
+  // upstream connection can be kept alive and go back to the pool afterwards. The client's address is added to
+  // X-Forwarded-For and Forwarded, after whatever proxies in front of this one put there. The response has the
+  // same hop-by-hop headers removed and keeps its own framing (Content-Length or chunked). A response that
+  // ends when the upstream closes is relayed with "Connection: close", and the client connection is closed after it.
+  class ProxyExchange
+  {
+  public: // data
+
+    // Most bytes of either body held in user space at once.
+    static const std::size_t MaxBuffered = 64u * 1024u;
+
+    static const std::size_t MaxHeaderLength = 64u * 1024u;
+
+  private: // data
+
+    unsigned attempts;
+    std::size_t bodyRemaining; // bytes of the current Length body or chunk not yet taken from the upstream
+    ProxyBodyState::Value bodyState;
+    bool canSpliceIn;
+    bool canSpliceOut;
+    UpstreamConnection connection;
+    long long deadline;
+    bool hasConnection;
+    bool isCloseDelimited; // the response body ends when the upstream closes, so the client connection closes too
+    bool isHead;
+    bool isIdempotent;
+    bool isPipeToClient; // the pipe carries the response, rather than the request body
+    bool isProbe; // the current attempt is the one its upstream lets through while out of rotation
+    bool isRequestStarted; // some of the request has been sent on the current attempt
+    bool isResponseStarted;
+    bool isRetryable; // there is no body, so the request can be sent again
+    bool isReused;
+    bool isUpstreamReusable;
+    SplicePipe pipe;
+    ReverseProxy* proxy;
+    std::string request; // the rewritten request headers, then each piece of body being sent
+    std::size_t requestBodyRemaining; // body bytes not yet taken from the client
+    std::size_t requestOffset;
+    int route;
+    ProxyStatus::Value status;
+    Upstream* upstream;
+
+  public: // methods
+
+    // Forwards the request whose headers are given, from client, and whose body of bodyLength bytes follows in the
+    // client's receive buffer and socket. A body can be spliced from a client socket that is not TLS (canSpliceIn),
+    // and the response to one that is not TLS or sends through kTLS (canSpliceOut).
+    ProxyExchange(
+      ReverseProxy& proxy_,
+      int route_,
+      std::string const& headers,
+      Endpoint const& client,
+      std::size_t bodyLength,
+      bool canSpliceIn_,
+      bool canSpliceOut_) :
+        attempts(0),
+        bodyRemaining(0),
+        bodyState(ProxyBodyState::Headers),
+        canSpliceIn(canSpliceIn_ && proxy_.GetOptions(route_).splice),
+        canSpliceOut(canSpliceOut_ && proxy_.GetOptions(route_).splice),
+        deadline(0),
+        hasConnection(false),
+        isCloseDelimited(false),
+        isHead(headers.compare(0, 5, "HEAD ") == 0),
+        isIdempotent(IsIdempotent(headers)),
+        isPipeToClient(false),
+        isProbe(false),
+        isRequestStarted(false),
+        isResponseStarted(false),
+        isRetryable(bodyLength == 0),
+        isReused(false),
+        isUpstreamReusable(false),
+        proxy(&proxy_),
+        requestBodyRemaining(bodyLength),
+        requestOffset(0),
+        route(route_),
+        status(ProxyStatus::Forwarding),
+        upstream(NULL)
+    {
+      auto connectionOptions = GetConnectionOptions(headers);
+      auto forwarded = std::string();
+      auto forwardedFor = std::string();
+      auto position = std::size_t();
+      auto lineStart = std::size_t();
+      auto lineLength = std::size_t();
+      request.reserve(headers.size() + 64);
+      for (auto isFirst = true; NextLine(headers, position, lineStart, lineLength); isFirst = false)
+      {
+        auto line = headers.data() + lineStart;
+        if (!isFirst && IsHeader(line, lineLength, "forwarded"))
+        {
+          AppendListItem(forwarded, GetRawValue(line, lineLength));
+        }
+        else if (!isFirst && IsHeader(line, lineLength, "x-forwarded-for"))
+        {
+          AppendListItem(forwardedFor, GetRawValue(line, lineLength));
+        }
+        else if (isFirst || !IsHopByHop(line, lineLength, connectionOptions))
+        {
+          request.append(headers, lineStart, lineLength);
+          request += "\r\n";
+        }
+      }
+
+      // A Unix domain socket peer has no address to pass on.
+      auto host = client.GetHost();
+      if (!host.empty())
+      {
+        AppendListItem(forwarded, client.GetFamily() == AF_INET6 ? "for=\"[" + host + "]\"" : "for=" + host);
+        AppendListItem(forwardedFor, host);
+      }
+      if (!forwarded.empty())
+      {
+        request += "Forwarded: " + forwarded + "\r\n";
+      }
+      if (!forwardedFor.empty())
+      {
+        request += "X-Forwarded-For: " + forwardedFor + "\r\n";
+      }
+      request += "\r\n";
+    }
+
+    ~ProxyExchange()
+    {
+      Release(false, 0);
+    }
+
+    // True if the connection should receive more of the request body from the client into its buffer, given how
+    // much it holds. A body that can be spliced is left in the socket instead.
+    bool IsReadingClient(std::size_t buffered) const
+    {
+      return status == ProxyStatus::Forwarding && !canSpliceIn && requestBodyRemaining > buffered &&
+        buffered < MaxBuffered;
+    }
+
+    // Moves the exchange along as far as the sockets allow: connects, sends the request, takes more of its body
+    // from clientInput (or splices it from clientSocket), and appends the response to clientOutput (or splices it
+    // to clientSocket once clientOutput is empty). A failure before any of the response was relayed is answered
+    // with 502 Bad Gateway, 503 Service Unavailable or 504 Gateway Timeout.
+    ProxyStatus::Value Update(ReceiveBuffer& clientInput, std::string& clientOutput, SOCKET clientSocket, long long now)
+    {
+      if (status != ProxyStatus::Forwarding)
+      {
+        return status;
+      }
+      if (!hasConnection && !Connect(now, HttpStatus::ServiceUnavailable, clientOutput))
+      {
+        return status;
+      }
+
+      auto isProgress = false;
+      if (!UpdateRequest(clientInput, clientOutput, clientSocket, isProgress, now) ||
+        !UpdateResponse(clientOutput, clientSocket, isProgress, now))
+      {
+        return status;
+      }
+
+      if (bodyState == ProxyBodyState::Done && pipe.GetBuffered() == 0)
+      {
+        // An upstream can answer without reading the whole body. The rest of it is still on its way from the
+        // client, where it would be taken for the next request, so that connection has to close.
+        auto isRequestDone = IsRequestDone();
+        Release(isRequestDone && isUpstreamReusable, now);
+        status = isRequestDone && !isCloseDelimited ? ProxyStatus::Finished : ProxyStatus::Closing;
+      }
+      else if (isProgress)
+      {
+        deadline = now + TraceClock::FromMicroseconds(proxy->GetOptions(route).responseTimeoutSeconds * 1000000.0);
+      }
+      else if (now > deadline)
+      {
+        Fail(now, HttpStatus::GatewayTimeout, clientOutput);
+      }
+
+      return status;
+    }
+
+  private: // methods
+
+    ProxyExchange(ProxyExchange const&);
+    ProxyExchange& operator=(ProxyExchange const&);
+
+    // Appends an element to a comma-separated header value.
+    static void AppendListItem(std::string& list, std::string const& item)
+    {
+      if (!list.empty())
+      {
+        list += ", ";
+      }
+      list += item;
+    }
+
+    // Takes a connection to the least loaded available upstream. Upstreams that refuse at once are marked failed
+    // and the next is tried. Answers errorStatus if none is left: 503 for a first attempt, or the error that ended
+    // the previous one for a retry.
+    bool Connect(long long now, HttpStatus::Value errorStatus, std::string& clientOutput)
+    {
+      auto maxAttempts = proxy->GetUpstreamCount(route) + 1;
+      while (attempts < maxAttempts)
+      {
+        ++attempts;
+        upstream = proxy->PickUpstream(route, now);
+        if (upstream == NULL)
+        {
+          break;
+        }
+
+        if (upstream->Acquire(connection, isReused, isProbe))
+        {
+          hasConnection = true;
+          deadline = now + TraceClock::FromMicroseconds(proxy->GetOptions(route).responseTimeoutSeconds * 1000000.0);
+          isRequestStarted = false;
+          requestOffset = 0;
+          return true;
+        }
+        upstream->OnFailure(now, isProbe);
+      }
+
+      Respond(errorStatus, clientOutput);
+      return false;
+    }
+
+    // Ends the attempt on the current upstream, which has failed or timed out. Before the client has had any of the
+    // response, a request without a body is retried on another connection, and anything else is answered with
+    // errorStatus. A request that is not idempotent is only retried if the upstream cannot have acted on it: none
+    // of it was sent, or it went out on a pooled connection the upstream had already closed. Once the response has
+    // started, all that can be done is to close the client connection, so the client sees that it was cut short.
+    void Fail(long long now, HttpStatus::Value errorStatus, std::string& clientOutput)
+    {
+      // A pooled connection that the backend closed while it sat idle is not the backend failing.
+      auto isStale = isReused && bodyState == ProxyBodyState::Headers && connection.input.IsEmpty() &&
+        errorStatus != HttpStatus::GatewayTimeout;
+      if (!isStale)
+      {
+        upstream->OnFailure(now, isProbe);
+      }
+      Release(false, now);
+
+      if (isResponseStarted)
+      {
+        status = ProxyStatus::Closing;
+      }
+      else if (!isRetryable || (!isIdempotent && isRequestStarted && !isStale) ||
+        errorStatus == HttpStatus::GatewayTimeout || !Connect(now, errorStatus, clientOutput))
+      {
+        if (status == ProxyStatus::Forwarding)
+        {
+          Respond(errorStatus, clientOutput);
+        }
+      }
+    }
+
+    // Relays bytes of the body that have arrived in the upstream connection's buffer, following its framing, until
+    // the buffer or clientOutput's allowance runs out. Returns false if the framing is broken.
+    bool ForwardBuffered(std::string& clientOutput)
+    {
+      auto& input = connection.input;
+      while (!input.IsEmpty() && clientOutput.size() < MaxBuffered)
+      {
+        switch (bodyState)
+        {
+        case ProxyBodyState::Length:
+        case ProxyBodyState::ChunkData:
+        case ProxyBodyState::UntilClose:
+          {
+            auto length = input.GetSize();
+            if (bodyState != ProxyBodyState::UntilClose && length > bodyRemaining)
+            {
+              length = bodyRemaining;
+            }
+            if (length > MaxBuffered - clientOutput.size())
+            {
+              length = MaxBuffered - clientOutput.size();
+            }
+
+            input.CopyTo(0, length, clientOutput);
+            input.Consume(length);
+            if (bodyState != ProxyBodyState::UntilClose)
+            {
+              bodyRemaining -= length;
+              OnBodyRemainingTaken();
+            }
+          }
+          break;
+
+        case ProxyBodyState::ChunkSize:
+        case ProxyBodyState::ChunkTrailer:
+          {
+            auto lineEnd = input.Find("\n");
+            if (lineEnd == std::string::npos)
+            {
+              return input.GetSize() < 4096;
+            }
+
+            auto lineStart = clientOutput.size();
+            input.CopyTo(0, lineEnd + 1, clientOutput);
+            input.Consume(lineEnd + 1);
+
+            if (bodyState == ProxyBodyState::ChunkTrailer)
+            {
+              if (lineEnd <= 1) // the blank line ending the trailers
+              {
+                bodyState = ProxyBodyState::Done;
+              }
+              break;
+            }
+
+            if (!std::isxdigit(static_cast<unsigned char>(clientOutput[lineStart])))
+            {
+              return false;
+            }
+            bodyRemaining = std::strtoul(clientOutput.c_str() + lineStart, NULL, 16);
+            if (bodyRemaining == 0)
+            {
+              bodyState = ProxyBodyState::ChunkTrailer;
+            }
+            else
+            {
+              bodyRemaining += 2; // the CRLF after the chunk's data
+              bodyState = ProxyBodyState::ChunkData;
+            }
+          }
+          break;
+
+        default:
+          isUpstreamReusable = false; // bytes past the end of the response
+          return true;
+        }
+      }
+
+      return true;
+    }
+
+    // Returns the options of every Connection header in the headers, lower-cased and each with a comma on either
+    // side, such as ",close,x-trace,".
+    static std::string GetConnectionOptions(std::string const& headers)
+    {
+      auto options = std::string();
+      auto position = std::size_t();
+      auto lineStart = std::size_t();
+      auto lineLength = std::size_t();
+      for (auto isFirst = true; NextLine(headers, position, lineStart, lineLength); isFirst = false)
+      {
+        if (!isFirst && IsHeader(headers.data() + lineStart, lineLength, "connection"))
+        {
+          options += "," + GetValue(headers.data() + lineStart, lineLength);
+        }
+      }
+
+      return options.empty() ? options : options + ",";
+    }
+
+    // Returns the value of a header line with the whitespace around it removed, otherwise as it was sent.
+    static std::string GetRawValue(char const* line, std::size_t length)
+    {
+      auto colon = static_cast<char const*>(std::memchr(line, ':', length));
+      auto start = colon == NULL ? line + length : colon + 1;
+      auto end = line + length;
+      while (start != end && (*start == ' ' || *start == '\t'))
+      {
+        ++start;
+      }
+      while (end != start && (end[-1] == ' ' || end[-1] == '\t'))
+      {
+        --end;
+      }
+
+      return std::string(start, end);
+    }
+
+    // Returns the value of a header line, trimmed and lower-cased.
+    static std::string GetValue(char const* line, std::size_t length)
+    {
+      auto value = std::string();
+      auto colon = static_cast<char const*>(std::memchr(line, ':', length));
+      for (auto it = colon == NULL ? line + length : colon + 1; it != line + length; ++it)
+      {
+        if (*it != ' ' && *it != '\t')
+        {
+          value.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(*it))));
+        }
+      }
+
+      return value;
+    }
+
+    // True if the line is a header with the given name, which must be lower case.
+    static bool IsHeader(char const* line, std::size_t length, char const* name)
+    {
+      auto nameLength = std::strlen(name);
+      if (length <= nameLength || line[nameLength] != ':')
+      {
+        return false;
+      }
+
+      for (auto i = 0u; i < nameLength; ++i)
+      {
+        if (std::tolower(static_cast<unsigned char>(line[i])) != name[i])
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    // Headers that describe one connection rather than the message, so they are not passed on: the standard ones,
+    // and any the message's Connection header names (connectionOptions, from GetConnectionOptions). Expect is
+    // answered by the connection itself, which sends 100 Continue before streaming the body.
+    static bool IsHopByHop(char const* line, std::size_t length, std::string const& connectionOptions)
+    {
+      static char const* const names[] =
+      {
+        "connection", "expect", "keep-alive", "proxy-connection", "te", "trailer", "transfer-encoding", "upgrade"
+      };
+      for (auto i = 0u; i < sizeof(names) / sizeof(names[0]); ++i)
+      {
+        if (IsHeader(line, length, names[i]))
+        {
+          return true;
+        }
+      }
+
+      auto colon = static_cast<char const*>(std::memchr(line, ':', length));
+      if (colon == NULL || connectionOptions.empty())
+      {
+        return false;
+      }
+
+      auto name = std::string(",");
+      for (auto it = line; it != colon; ++it)
+      {
+        name.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(*it))));
+      }
+      name += ",";
+      return connectionOptions.find(name) != std::string::npos;
+    }
+
+    // Methods whose effect is the same however many times a request is made (RFC 9110 section 9.2.2), so a proxy
+    // may send the request again after the upstream could have acted on it.
+    static bool IsIdempotent(std::string const& headers)
+    {
+      static char const* const methods[] = { "DELETE ", "GET ", "HEAD ", "OPTIONS ", "PUT ", "TRACE " };
+      for (auto i = 0u; i < sizeof(methods) / sizeof(methods[0]); ++i)
+      {
+        if (headers.compare(0, std::strlen(methods[i]), methods[i]) == 0)
+        {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    bool IsRequestDone() const
+    {
+      return requestOffset == request.size() && requestBodyRemaining == 0 && (isPipeToClient || pipe.GetBuffered() == 0);
+    }
+
+    // Finds the next line of text at or after position, without its line ending. Returns false at the end of the
+    // text or at a blank line.
+    static bool NextLine(std::string const& text, std::size_t& position, std::size_t& lineStart, std::size_t& lineLength)
+    {
+      if (position >= text.size())
+      {
+        return false;
+      }
+
+      auto lineEnd = text.find('\n', position);
+      if (lineEnd == std::string::npos)
+      {
+        lineEnd = text.size();
+      }
+
+      lineStart = position;
+      lineLength = lineEnd - position;
+      if (lineLength > 0 && text[lineEnd - 1] == '\r')
+      {
+        --lineLength;
+      }
+
+      position = lineEnd + 1;
+      return lineLength > 0;
+    }
+
+    // Moves on from a Length body or chunk once all of it has been taken from the upstream.
+    void OnBodyRemainingTaken()
+    {
+      if (bodyRemaining == 0)
+      {
+        bodyState = bodyState == ProxyBodyState::Length ? ProxyBodyState::Done : ProxyBodyState::ChunkSize;
+      }
+    }
+
+    // Parses a complete block of response headers from the upstream connection's buffer, relaying it to the client
+    // with its hop-by-hop headers removed and working out how the body is delimited. Returns false if the response
+    // is malformed.
+    bool ReadResponseHeaders(std::string& clientOutput)
+    {
+      auto& input = connection.input;
+      auto headerEnd = input.Find("\r\n\r\n");
+      if (headerEnd == std::string::npos)
+      {
+        return input.GetSize() <= MaxHeaderLength;
+      }
+
+      auto headers = std::string();
+      input.CopyTo(0, headerEnd + 4, headers);
+      input.Consume(headerEnd + 4);
+      if (headers.size() < 12 || headers.compare(0, 7, "HTTP/1.") != 0)
+      {
+        return false;
+      }
+
+      auto statusCode = std::atoi(headers.c_str() + 9);
+      auto isChunked = false;
+      auto isKeptAlive = headers[7] == '1'; // HTTP/1.1 keeps connections open unless told otherwise
+      auto contentLength = std::string();
+      auto position = std::size_t();
+      auto lineStart = std::size_t();
+      auto lineLength = std::size_t();
+      auto relayStart = clientOutput.size();
+      auto connectionOptions = GetConnectionOptions(headers);
+
+      for (auto isFirst = true; NextLine(headers, position, lineStart, lineLength); isFirst = false)
+      {
+        auto line = headers.data() + lineStart;
+        if (!isFirst && IsHeader(line, lineLength, "connection"))
+        {
+          auto value = GetValue(line, lineLength);
+          isKeptAlive = value.find("close") == std::string::npos &&
+            (isKeptAlive || value.find("keep-alive") != std::string::npos);
+        }
+        else if (!isFirst && IsHeader(line, lineLength, "content-length"))
+        {
+          contentLength = GetValue(line, lineLength);
+        }
+        else if (!isFirst && IsHeader(line, lineLength, "transfer-encoding"))
+        {
+          isChunked = GetValue(line, lineLength).find("chunked") != std::string::npos;
+        }
+
+        // Transfer-Encoding stays, since the body is relayed in the framing it arrives in.
+        if (isFirst || IsHeader(line, lineLength, "transfer-encoding") ||
+          !IsHopByHop(line, lineLength, connectionOptions))
+        {
+          clientOutput.append(headers, lineStart, lineLength);
+          clientOutput += "\r\n";
+        }
+      }
+
+      // Interim responses (100 Continue, 103 Early Hints) are relayed ahead of the final one. The upgrade
+      // request headers were removed, so 101 can only be a broken upstream.
+      if (statusCode == 101)
+      {
+        clientOutput.resize(relayStart);
+        return false;
+      }
+      if (statusCode < 200)
+      {
+        clientOutput += "\r\n";
+        return true;
+      }
+
+      if (isHead || statusCode == 204 || statusCode == 304)
+      {
+        bodyState = ProxyBodyState::Done;
+      }
+      else if (isChunked)
+      {
+        bodyState = ProxyBodyState::ChunkSize;
+      }
+      else if (!contentLength.empty())
+      {
+        bodyRemaining = std::strtoul(contentLength.c_str(), NULL, 10);
+        bodyState = ProxyBodyState::Length;
+        OnBodyRemainingTaken();
+      }
+      else
+      {
+        bodyState = ProxyBodyState::UntilClose;
+        clientOutput += "Connection: close\r\n";
+        isCloseDelimited = true;
+        isKeptAlive = false;
+      }
+      clientOutput += "\r\n";
+
+      isUpstreamReusable = isKeptAlive;
+      isResponseStarted = true;
+      upstream->OnSuccess(isProbe);
+      return true;
+    }
+
+    // Returns the upstream connection, to the pool if isReusable, and any pipe.
+    void Release(bool isReusable, long long now)
+    {
+      if (hasConnection)
+      {
+        upstream->Release(connection, isReusable, isProbe, now);
+        hasConnection = false;
+      }
+      if (pipe.IsOpen())
+      {
+        proxy->ReleasePipe(pipe);
+      }
+    }
+
+    // Answers the client with an error of our own, when none of the upstream's response has been relayed.
+    void Respond(HttpStatus::Value errorStatus, std::string& clientOutput)
+    {
+      clientOutput += HttpResponse(errorStatus).GetFormattedResponse();
+      isResponseStarted = true;
+
+      // A client still sending a body would have the rest taken for its next request.
+      status = requestBodyRemaining > 0 ? ProxyStatus::Closing : ProxyStatus::Finished;
+    }
+
+    // Splices the next part of a body through the pipe, delivering what the pipe still holds first. Returns the
+    // number of bytes taken from the source, and sets isFromClosed or isToFailed if either socket failed.
+    std::size_t Splice(SOCKET from, SOCKET to, std::size_t length, bool& isFromClosed, bool& isToFailed)
+    {
+      isFromClosed = false;
+      isToFailed = !pipe.Drain(to);
+      if (isToFailed || pipe.GetBuffered() > 0 || length == 0)
+      {
+        return 0;
+      }
+
+      auto taken = pipe.Fill(from, length < MaxBuffered ? length : MaxBuffered, isFromClosed);
+      isToFailed = taken > 0 && !pipe.Drain(to);
+      return taken;
+    }
+
+    // Sends the request headers, then as much of the body as is available. Returns false if the exchange has failed.
+    bool UpdateRequest(
+      ReceiveBuffer& clientInput,
+      std::string& clientOutput,
+      SOCKET clientSocket,
+      bool& isProgress,
+      long long now)
+    {
+      auto& socket = connection.socket;
+      while (!IsRequestDone())
+      {
+        if (requestOffset < request.size())
+        {
+          auto sent = socket.IsOpen() ? socket.SendSome(request, requestOffset) : 0;
+          if (!socket.IsOpen())
+          {
+            Fail(now, HttpStatus::BadGateway, clientOutput);
+            return false;
+          }
+
+          requestOffset += sent;
+          isProgress = isProgress || sent > 0;
+          isRequestStarted = isRequestStarted || sent > 0;
+          if (requestOffset < request.size())
+          {
+            return true;
+          }
+        }
+        else if (!clientInput.IsEmpty() && requestBodyRemaining > 0)
+        {
+          auto length = clientInput.GetSize();
+          if (length > requestBodyRemaining)
+          {
+            length = requestBodyRemaining;
+          }
+          if (length > MaxBuffered)
+          {
+            length = MaxBuffered;
+          }
+
+          request.clear();
+          clientInput.CopyTo(0, length, request);
+          clientInput.Consume(length);
+          requestBodyRemaining -= length;
+          requestOffset = 0;
+        }
+        else if (canSpliceIn && (pipe.IsOpen() || (pipe = proxy->AcquirePipe()).IsOpen()))
+        {
+          auto isClientClosed = false;
+          auto isUpstreamFailed = false;
+          auto taken = Splice(clientSocket, socket.GetHandle(), requestBodyRemaining, isClientClosed, isUpstreamFailed);
+          requestBodyRemaining -= taken;
+          isProgress = isProgress || taken > 0;
+
+          if (isClientClosed)
+          {
+            Release(false, now);
+            status = ProxyStatus::Closing;
+            return false;
+          }
+          if (isUpstreamFailed)
+          {
+            Fail(now, HttpStatus::BadGateway, clientOutput);
+            return false;
+          }
+          return true;
+        }
+        else
+        {
+          canSpliceIn = false; // no pipe to be had, so the connection receives the body for us
+          return true;
+        }
+      }
+
+      return true;
+    }
+
+    // Reads the response headers, then relays as much of the body as has arrived. Returns false if the exchange
+    // has failed.
+    bool UpdateResponse(std::string& clientOutput, SOCKET clientSocket, bool& isProgress, long long now)
+    {
+      auto& input = connection.input;
+      auto& socket = connection.socket;
+
+      while (bodyState == ProxyBodyState::Headers)
+      {
+        if (input.Find("\r\n\r\n") == std::string::npos)
+        {
+          auto received = socket.IsOpen() ? socket.Receive(input, MaxBuffered) : 0;
+          isProgress = isProgress || received > 0;
+          if (input.Find("\r\n\r\n") == std::string::npos)
+          {
+            if (!socket.IsOpen() || input.GetSize() > MaxHeaderLength)
+            {
+              Fail(now, HttpStatus::BadGateway, clientOutput);
+              return false;
+            }
+            return true;
+          }
+        }
+
+        if (!ReadResponseHeaders(clientOutput))
+        {
+          Fail(now, HttpStatus::BadGateway, clientOutput);
+          return false;
+        }
+      }
+
+      // Whatever was spliced toward the client goes out before anything more is appended to its output.
+      if (isPipeToClient && pipe.GetBuffered() > 0)
+      {
+        if (!pipe.Drain(clientSocket))
+        {
+          Release(false, now);
+          status = ProxyStatus::Closing;
+          return false;
+        }
+        if (pipe.GetBuffered() > 0)
+        {
+          return true;
+        }
+      }
+
+      if (!ForwardBuffered(clientOutput))
+      {
+        Fail(now, HttpStatus::BadGateway, clientOutput);
+        return false;
+      }
+      if (bodyState == ProxyBodyState::Done || clientOutput.size() >= MaxBuffered)
+      {
+        return true;
+      }
+
+      // The buffer is drained, or holds only part of a chunk-size or trailer line: splice the next part of the body
+      // straight to the client, or read it.
+      auto isSpliceable = bodyState == ProxyBodyState::Length || bodyState == ProxyBodyState::ChunkData ||
+        bodyState == ProxyBodyState::UntilClose;
+      if (canSpliceOut && isSpliceable && input.IsEmpty() && clientOutput.empty() && IsRequestDone() &&
+        socket.IsOpen() && (pipe.IsOpen() || (pipe = proxy->AcquirePipe()).IsOpen()))
+      {
+        isPipeToClient = true;
+
+        auto isUpstreamClosed = false;
+        auto isClientFailed = false;
+        auto length = bodyState == ProxyBodyState::UntilClose ? MaxBuffered : bodyRemaining;
+        auto taken = Splice(socket.GetHandle(), clientSocket, length, isUpstreamClosed, isClientFailed);
+        isProgress = isProgress || taken > 0;
+
+        if (isClientFailed)
+        {
+          Release(false, now);
+          status = ProxyStatus::Closing;
+          return false;
+        }
+        if (isUpstreamClosed)
+        {
+          socket.Close();
+        }
+        if (bodyState != ProxyBodyState::UntilClose)
+        {
+          bodyRemaining -= taken;
+          OnBodyRemainingTaken();
+        }
+      }
+      else if (clientOutput.size() < MaxBuffered && socket.IsOpen())
+      {
+        isProgress = socket.Receive(input, MaxBuffered - clientOutput.size()) > 0 || isProgress;
+        if (!ForwardBuffered(clientOutput))
+        {
+          Fail(now, HttpStatus::BadGateway, clientOutput);
+          return false;
+        }
+      }
+
+      // The upstream closing ends a body delimited by the close, and cuts any other short. Input that is left while
+      // the client's output has room is part of a line that will never be finished.
+      if (!socket.IsOpen() && (input.IsEmpty() || clientOutput.size() < MaxBuffered) &&
+        bodyState != ProxyBodyState::Done)
+      {
+        if (bodyState != ProxyBodyState::UntilClose)
+        {
+          Fail(now, HttpStatus::BadGateway, clientOutput);
+          return false;
+        }
+        bodyState = ProxyBodyState::Done;
+      }
+
+      return true;
+    }
+  };
+} // namespace OlympusWebServer
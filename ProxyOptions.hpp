@@ -0,0 +1,45 @@
+#pragma once
+
+namespace OlympusWebServer
+{
+  // Tuning for the upstreams of one proxy route (see WebServer::AddProxyRoute).
+  class ProxyOptions
+  {
+  public: // data
+
+    // Seconds an upstream stays out of rotation after maxFailures consecutive failures. After that, a single
+    // request is let through to try it again.
+    int failTimeoutSeconds;
+
+    // Seconds an idle upstream connection is kept for reuse. Keep it below the backend's own keep-alive timeout, so
+    // the proxy rarely picks a connection the backend is about to close.
+    int idleTimeoutSeconds;
+
+    // Consecutive failures (refused or reset connections, timeouts) after which an upstream is taken out of
+    // rotation.
+    unsigned maxFailures;
+
+    // Idle keep-alive connections kept per upstream, on each WebServer.
+    unsigned maxIdleConnections;
+
+    // Seconds to wait for the upstream to send more of its response, or to take more of the request, before the
+    // exchange fails. A client that has not had a byte of the response yet gets 504 Gateway Timeout.
+    int responseTimeoutSeconds;
+
+    // Moves bodies between sockets with splice(2) where both ends allow it, so they are never copied into user
+    // space. Bodies to or from a TLS client (other than through kTLS) are always copied.
+    bool splice;
+
+  public: // methods
+
+    ProxyOptions() :
+      failTimeoutSeconds(10),
+      idleTimeoutSeconds(30),
+      maxFailures(3),
+      maxIdleConnections(32),
+      responseTimeoutSeconds(30),
+      splice(true)
+    {
+    }
+  };
+} // namespace OlympusWebServer
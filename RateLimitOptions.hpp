@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+
+namespace OlympusWebServer
+{
+  // How fast each client may make requests on one rate-limited path (see RateLimiter::AddRule).
+  class RateLimitOptions
+  {
+  public: // data
+
+    // Requests a client that has been idle may make at once: the size of its token bucket.
+    double burst;
+
+    // A header, in lower case, whose value identifies the client instead of its address, e.g. "x-api-key".
+    // Requests without the header are limited by address. Empty to limit by address alone.
+    std::string headerName;
+
+    // Requests per second each client may keep up: the rate its bucket refills at.
+    double requestsPerSecond;
+
+  public: // methods
+
+    RateLimitOptions() :
+      burst(20.0),
+      requestsPerSecond(10.0)
+    {
+    }
+  };
+} // namespace OlympusWebServer
@@ -0,0 +1,362 @@
+#pragma once
+
+#include <cctype>
+#include <cstddef>
+#include <cstring>
+#include "Endpoint.hpp"
+#include <memory>
+#include "RateLimitOptions.hpp"
+#include <stdexcept>
+#include <string>
+#include "Threading.hpp"
+#include "Trace.hpp"
+#include <vector>
+
+namespace OlympusWebServer
+{
+  // Token-bucket rate limits per client, which may be shared by several WebServers and the threads that run them.
+  //
+  // Buckets live in a table of fixed size, allocated up front, so a flood of new client addresses cannot grow it.
+  // The table is split into ShardCount shards, each with its own lock, so two threads only wait on each other when
+  // they touch the same shard at the same moment. A key may sit in any of the ProbeLength slots after its hash.
+  // When all of them are taken, one is evicted by CLOCK: the shard's hand sweeps the window, clearing reference
+  // bits, and takes the first slot not used since the last sweep. A new bucket starts unreferenced, so a spray of
+  // one-off addresses evicts its own buckets before those of clients that keep coming back. An evicted client
+  // starts again with a full bucket.
+  class RateLimiter
+  {
+  private: // types
+
+    class Rule
+    {
+    public: // data
+
+      RateLimitOptions options;
+      std::string pathPrefix;
+      double tokensPerTick;
+    };
+
+    class Slot
+    {
+    public: // data
+
+      bool isReferenced; // set when the bucket is used, cleared as the CLOCK hand passes
+      unsigned long long key; // zero for an empty slot
+      long long time; // when tokens was last brought up to date
+      double tokens;
+    };
+
+    class Shard
+    {
+    public: // data
+
+      unsigned hand; // the CLOCK hand, as an offset into a key's probe window
+      Mutex mutex;
+      std::vector<Slot> slots;
+
+      // Keeps each shard's lock off its neighbours' cache lines.
+      char padding[64];
+
+    public: // methods
+
+      Shard() :
+        hand(0)
+      {
+      }
+    };
+
+  public: // data
+
+    static const unsigned ProbeLength = 8;
+    static const unsigned ShardBits = 6;
+    static const unsigned ShardCount = 1u << ShardBits;
+
+  private: // data
+
+    std::vector<Rule> rules;
+    std::unique_ptr<Shard[]> shards;
+    std::size_t slotMask; // slots per shard, less one
+
+  public: // methods
+
+    // Keeps buckets for at least capacity clients, rounded up to a power of two. Each bucket takes 32 bytes.
+    explicit RateLimiter(std::size_t capacity = 64u * 1024u) :
+      shards(new Shard[ShardCount])
+    {
+      auto slotCount = std::size_t(ProbeLength);
+      while (slotCount * ShardCount < capacity)
+      {
+        slotCount *= 2;
+      }
+      slotMask = slotCount - 1;
+
+      auto empty = Slot();
+      for (auto i = 0u; i < ShardCount; ++i)
+      {
+        shards[i].slots.assign(slotCount, empty);
+      }
+    }
+
+    // Limits each client's requests whose target starts with pathPrefix. Where several rules match, the longest
+    // prefix wins. Rules must be added before requests are checked.
+    void AddRule(std::string pathPrefix, RateLimitOptions const& options)
+    {
+      if (!(options.requestsPerSecond > 0.0) || !(options.burst >= 1.0))
+      {
+        throw std::runtime_error("RateLimiter.AddRule - A rule needs a positive rate and a burst of at least 1");
+      }
+      if (pathPrefix.find_first_of(" \r\n") != std::string::npos)
+      {
+        throw std::runtime_error("RateLimiter.AddRule - A path prefix cannot hold spaces or line breaks");
+      }
+
+      auto rule = Rule();
+      rule.options = options;
+      rule.pathPrefix = std::move(pathPrefix);
+      rule.tokensPerTick = options.requestsPerSecond / static_cast<double>(TraceClock::FromMicroseconds(1000000.0));
+      rules.push_back(rule);
+    }
+
+    // Buckets the table holds.
+    std::size_t GetCapacity() const
+    {
+      return (slotMask + 1) * ShardCount;
+    }
+
+    // Identifies a client by its address, without the port. IPv6 clients are identified by their /64 prefix,
+    // which is what a single host is usually given, and IPv4 clients of a dual-stack listener by their IPv4
+    // address. Returns zero for clients with no address, such as those of a Unix domain socket.
+    static unsigned long long GetClientKey(Endpoint const& peer)
+    {
+      switch (peer.GetFamily())
+      {
+      case AF_INET:
+        {
+          auto& address = reinterpret_cast<sockaddr_in const*>(peer.GetAddress())->sin_addr;
+          return Hash(reinterpret_cast<char const*>(&address), sizeof(address));
+        }
+
+      case AF_INET6:
+        {
+          static const unsigned char mappedPrefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF };
+          auto bytes = reinterpret_cast<char const*>(&reinterpret_cast<sockaddr_in6 const*>(peer.GetAddress())->sin6_addr);
+          if (std::memcmp(bytes, mappedPrefix, sizeof(mappedPrefix)) == 0)
+          {
+            return Hash(bytes + 12, 4);
+          }
+          return Hash(bytes, 8);
+        }
+
+      default:
+        return 0;
+      }
+    }
+
+    bool HasRules() const
+    {
+      return !rules.empty();
+    }
+
+    // Takes a token from the bucket of the client making the request (given as its request line and headers),
+    // under the rule for its path. Returns false if the bucket is empty and the request should be refused. A
+    // request no rule covers, or from a client with neither a key header nor an address, is always allowed.
+    bool IsAllowed(std::string const& request, unsigned long long clientKey, long long now)
+    {
+      auto ruleIndex = FindRule(request);
+      if (ruleIndex < 0)
+      {
+        return true;
+      }
+
+      auto& rule = rules[ruleIndex];
+      auto key = clientKey;
+      if (!rule.options.headerName.empty())
+      {
+        auto valueLength = std::size_t();
+        auto value = FindHeaderValue(request, rule.options.headerName, valueLength);
+        if (value != NULL)
+        {
+          key = Hash(value, valueLength) ^ 0x9E3779B97F4A7C15ull; // apart from any address with the same hash
+        }
+      }
+      if (key == 0)
+      {
+        return true;
+      }
+
+      key = Mix(key + static_cast<unsigned long long>(ruleIndex) * 0xBF58476D1CE4E5B9ull);
+      return Take(key == 0 ? 1 : key, rule, now);
+    }
+
+  private: // methods
+
+    RateLimiter(RateLimiter const&);
+    RateLimiter& operator=(RateLimiter const&);
+
+    // Sweeps the shard's CLOCK hand around the probe window starting at home, giving each referenced slot a second
+    // chance, and returns the first slot that has not been used since the hand last passed it.
+    Slot& Evict(Shard& shard, std::size_t home)
+    {
+      for (;;)
+      {
+        auto& slot = shard.slots[(home + shard.hand) & slotMask];
+        shard.hand = (shard.hand + 1) % ProbeLength;
+        if (!slot.isReferenced)
+        {
+          return slot;
+        }
+        slot.isReferenced = false;
+      }
+    }
+
+    // Returns the start of the named header's value, which must be given in lower case, and its length, with
+    // surrounding spaces trimmed. Returns NULL if the header is missing or empty.
+    static char const* FindHeaderValue(std::string const& request, std::string const& name, std::size_t& length)
+    {
+      auto end = request.data() + request.size();
+      auto line = static_cast<char const*>(std::memchr(request.data(), '\n', request.size()));
+      while (line != NULL)
+      {
+        auto start = line + 1;
+        line = static_cast<char const*>(std::memchr(start, '\n', end - start));
+        auto lineEnd = line != NULL ? line : end;
+        if (static_cast<std::size_t>(lineEnd - start) <= name.size() || start[name.size()] != ':')
+        {
+          continue;
+        }
+
+        // Header names are tokens, so only letters differ in case.
+        auto matches = true;
+        for (auto i = 0u; i < name.size() && matches; ++i)
+        {
+          auto c = start[i];
+          matches = c == name[i] || (c >= 'A' && c <= 'Z' && c + ('a' - 'A') == name[i]);
+        }
+        if (!matches)
+        {
+          continue;
+        }
+
+        auto valueStart = start + name.size() + 1;
+        auto valueEnd = lineEnd;
+        while (valueStart < valueEnd && (*valueStart == ' ' || *valueStart == '\t'))
+        {
+          ++valueStart;
+        }
+        while (valueEnd > valueStart && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t' || valueEnd[-1] == '\r'))
+        {
+          --valueEnd;
+        }
+
+        length = valueEnd - valueStart;
+        return length > 0 ? valueStart : NULL;
+      }
+
+      return NULL;
+    }
+
+    // Returns the rule whose prefix matches the most of the request line's target, or -1 if none does. A path
+    // prefix holds no spaces or line breaks, so one that matches cannot run past the end of the target.
+    int FindRule(std::string const& request) const
+    {
+      auto targetStart = request.find(' ');
+      if (targetStart == std::string::npos)
+      {
+        return -1;
+      }
+      ++targetStart;
+
+      auto best = -1;
+      for (auto i = 0u; i < rules.size(); ++i)
+      {
+        auto& prefix = rules[i].pathPrefix;
+        if (request.size() - targetStart >= prefix.size() &&
+          std::memcmp(request.data() + targetStart, prefix.data(), prefix.size()) == 0 &&
+          (best < 0 || prefix.size() > rules[best].pathPrefix.size()))
+        {
+          best = static_cast<int>(i);
+        }
+      }
+
+      return best;
+    }
+
+    // Hashes eight bytes at a time, finished with Mix so both the low bits (the slot) and the high bits (the shard)
+    // are well spread.
+    static unsigned long long Hash(char const* data, std::size_t length)
+    {
+      auto hash = 0xCBF29CE484222325ull ^ length;
+      for (auto i = std::size_t(); i < length; i += 8)
+      {
+        auto word = 0ull;
+        std::memcpy(&word, data + i, length - i < 8 ? length - i : 8);
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 32;
+      }
+
+      return Mix(hash);
+    }
+
+    // The SplitMix64 finalizer.
+    static unsigned long long Mix(unsigned long long value)
+    {
+      value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+      value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+      return value ^ (value >> 31);
+    }
+
+    // Finds or makes the key's bucket, refills it for the time since it was last used and takes a token if there
+    // is one.
+    bool Take(unsigned long long key, Rule const& rule, long long now)
+    {
+      auto& shard = shards[static_cast<std::size_t>(key >> (64 - ShardBits))];
+      auto home = static_cast<std::size_t>(key);
+
+      MutexLock lock(shard.mutex);
+
+      auto bucket = static_cast<Slot*>(NULL);
+      for (auto i = 0u; i < ProbeLength && bucket == NULL; ++i)
+      {
+        auto& slot = shard.slots[(home + i) & slotMask];
+        if (slot.key == key)
+        {
+          bucket = &slot;
+          bucket->isReferenced = true;
+        }
+        else if (slot.key == 0)
+        {
+          bucket = &slot;
+        }
+      }
+
+      if (bucket == NULL || bucket->key != key)
+      {
+        if (bucket == NULL)
+        {
+          bucket = &Evict(shard, home);
+        }
+        bucket->isReferenced = false;
+        bucket->key = key;
+        bucket->time = now;
+        bucket->tokens = rule.options.burst;
+      }
+      else if (now > bucket->time)
+      {
+        bucket->tokens += static_cast<double>(now - bucket->time) * rule.tokensPerTick;
+        if (bucket->tokens > rule.options.burst)
+        {
+          bucket->tokens = rule.options.burst;
+        }
+        bucket->time = now;
+      }
+
+      if (bucket->tokens < 1.0)
+      {
+        return false;
+      }
+
+      bucket->tokens -= 1.0;
+      return true;
+    }
+  };
+} // namespace OlympusWebServer
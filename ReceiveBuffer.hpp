@@ -0,0 +1,269 @@
+#pragma once
+
+#include "BufferPool.hpp"
+#include <cstring>
+#include <string>
+
+namespace OlympusWebServer
+{
+  // Bytes received on a connection, held in a chain of pooled chunks. Data is read from the front and written at
+  // the back; chunks are returned to the thread's pool as soon as they are drained, so an idle connection holds no
+  // buffer memory at all.
+  class ReceiveBuffer
+  {
+  private: // data
+
+    BufferChunk* head;
+    std::size_t readOffset;
+    std::size_t size;
+    BufferChunk* tail;
+    std::size_t writeOffset;
+
+  public: // methods
+
+    ReceiveBuffer() :
+      head(NULL),
+      readOffset(0),
+      size(0),
+      tail(NULL),
+      writeOffset(0)
+    {
+    }
+
+    ReceiveBuffer(ReceiveBuffer&& b)
+    {
+      head = NULL;
+      *this = std::move(b);
+    }
+
+    ReceiveBuffer& operator=(ReceiveBuffer&& b)
+    {
+      if (this == &b)
+      {
+        return *this;
+      }
+      Release();
+
+      head = b.head;
+      readOffset = b.readOffset;
+      size = b.size;
+      tail = b.tail;
+      writeOffset = b.writeOffset;
+
+      b.head = NULL;
+      b.readOffset = 0;
+      b.size = 0;
+      b.tail = NULL;
+      b.writeOffset = 0;
+
+      return *this;
+    }
+
+    ~ReceiveBuffer()
+    {
+      Release();
+    }
+
+    // Records that length bytes were written into the span returned by GetWritable.
+    void Commit(std::size_t length)
+    {
+      writeOffset += length;
+      size += length;
+
+      if (size == 0)
+      {
+        Release(); // nothing arrived, so do not hold on to the chunk that was leased for it
+      }
+    }
+
+    // Drops length bytes from the front, returning drained chunks to the pool.
+    void Consume(std::size_t length)
+    {
+      size -= length;
+      if (size == 0)
+      {
+        Release();
+        return;
+      }
+
+      readOffset += length;
+      while (readOffset >= BufferChunk::Capacity)
+      {
+        auto drained = head;
+        head = head->next;
+        readOffset -= BufferChunk::Capacity;
+        BufferPool::GetThreadPool().Release(drained);
+      }
+    }
+
+    // Appends length bytes starting at offset to destination.
+    void CopyTo(std::size_t offset, std::size_t length, std::string& destination) const
+    {
+      auto chunk = head;
+      offset += readOffset;
+      while (offset >= BufferChunk::Capacity)
+      {
+        chunk = chunk->next;
+        offset -= BufferChunk::Capacity;
+      }
+
+      destination.reserve(destination.size() + length);
+      while (length > 0)
+      {
+        auto count = BufferChunk::Capacity - offset;
+        if (count > length)
+        {
+          count = length;
+        }
+
+        destination.append(chunk->data + offset, count);
+        length -= count;
+        offset = 0;
+        chunk = chunk->next;
+      }
+    }
+
+    // Returns the offset of the first occurrence of pattern at or after from, or npos. Matches may straddle chunks.
+    std::size_t Find(char const* pattern, std::size_t from = 0) const
+    {
+      auto patternLength = std::strlen(pattern);
+      if (patternLength == 0 || size < patternLength)
+      {
+        return std::string::npos;
+      }
+
+      auto chunk = head;
+      auto chunkStart = std::size_t(); // offset of the chunk's first readable byte
+      auto begin = readOffset;
+      while (chunk != NULL)
+      {
+        auto end = chunk == tail ? writeOffset : BufferChunk::Capacity;
+        auto segmentLength = end - begin;
+
+        if (from < chunkStart + segmentLength)
+        {
+          char const* scan = chunk->data + begin + (from > chunkStart ? from - chunkStart : 0);
+          char const* scanEnd = chunk->data + end;
+          while (scan < scanEnd)
+          {
+            auto match = static_cast<char const*>(std::memchr(scan, pattern[0], scanEnd - scan));
+            if (match == NULL)
+            {
+              break;
+            }
+
+            auto position = chunkStart + (match - (chunk->data + begin));
+            if (Matches(pattern, patternLength, position))
+            {
+              return position;
+            }
+            scan = match + 1;
+          }
+        }
+
+        chunkStart += segmentLength;
+        chunk = chunk->next;
+        begin = 0;
+      }
+
+      return std::string::npos;
+    }
+
+    std::size_t GetSize() const
+    {
+      return size;
+    }
+
+    // Returns space at the end of the buffer to receive into, leasing a chunk from the pool if the last is full.
+    char* GetWritable(std::size_t& length)
+    {
+      if (tail == NULL)
+      {
+        head = tail = BufferPool::GetThreadPool().Acquire();
+        readOffset = writeOffset = 0;
+      }
+      else if (writeOffset == BufferChunk::Capacity)
+      {
+        tail->next = BufferPool::GetThreadPool().Acquire();
+        tail = tail->next;
+        writeOffset = 0;
+      }
+
+      length = BufferChunk::Capacity - writeOffset;
+      return tail->data + writeOffset;
+    }
+
+    bool IsEmpty() const
+    {
+      return size == 0;
+    }
+
+    char operator[](std::size_t position) const
+    {
+      auto chunk = head;
+      position += readOffset;
+      while (position >= BufferChunk::Capacity)
+      {
+        chunk = chunk->next;
+        position -= BufferChunk::Capacity;
+      }
+
+      return chunk->data[position];
+    }
+
+    void Release()
+    {
+      if (head != NULL)
+      {
+        auto& pool = BufferPool::GetThreadPool();
+        while (head != NULL)
+        {
+          auto chunk = head;
+          head = head->next;
+          pool.Release(chunk);
+        }
+      }
+
+      readOffset = 0;
+      size = 0;
+      tail = NULL;
+      writeOffset = 0;
+    }
+
+  private: // methods
+
+    ReceiveBuffer(ReceiveBuffer const&);
+    ReceiveBuffer& operator=(ReceiveBuffer const&);
+
+    bool Matches(char const* pattern, std::size_t patternLength, std::size_t position) const
+    {
+      if (position + patternLength > size)
+      {
+        return false;
+      }
+
+      auto chunk = head;
+      auto offset = readOffset + position;
+      while (offset >= BufferChunk::Capacity)
+      {
+        chunk = chunk->next;
+        offset -= BufferChunk::Capacity;
+      }
+
+      for (auto i = 0u; i < patternLength; ++i, ++offset)
+      {
+        if (offset == BufferChunk::Capacity)
+        {
+          chunk = chunk->next;
+          offset = 0;
+        }
+        if (chunk->data[offset] != pattern[i])
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+  };
+} // namespace OlympusWebServer
\ No newline at end of file
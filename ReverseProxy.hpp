@@ -0,0 +1,178 @@
+#pragma once
+
+#include "Endpoint.hpp"
+#include <memory>
+#include "ProxyOptions.hpp"
+#include "SplicePipe.hpp"
+#include <stdexcept>
+#include <string>
+#include "Upstream.hpp"
+#include <vector>
+
+namespace OlympusWebServer
+{
+  // The proxy routes of one WebServer and the upstreams they forward to. Everything here belongs to the thread
+  // that runs the server's Update, so each worker keeps its own connection pools and balances by the requests it
+  // has outstanding itself, with no locking.
+  class ReverseProxy
+  {
+  private: // types
+
+    class Route
+    {
+    public: // data
+
+      std::size_t next; // where the next search for the least loaded upstream starts, so ties rotate
+      ProxyOptions options;
+      std::string pathPrefix;
+      std::vector<Upstream*> upstreams;
+    };
+
+  private: // data
+
+    static const std::size_t MaxIdlePipes = 64;
+
+    std::vector<SplicePipe> pipes; // idle and empty, for reuse
+    std::vector<Route> routes;
+    std::vector<std::unique_ptr<Upstream>> upstreams;
+
+  public: // methods
+
+    ReverseProxy()
+    {
+    }
+
+    // Takes an idle pipe, or creates one. The result is not open where splice is unsupported.
+    SplicePipe AcquirePipe()
+    {
+      auto pipe = SplicePipe();
+      if (!pipes.empty())
+      {
+        pipe = std::move(pipes.back());
+        pipes.pop_back();
+      }
+      else
+      {
+        pipe.Open();
+      }
+
+      return pipe;
+    }
+
+    // Forwards requests whose target starts with pathPrefix to the endpoints, balanced by outstanding requests.
+    void AddRoute(std::string pathPrefix, std::vector<Endpoint> const& endpoints, ProxyOptions const& options)
+    {
+      if (endpoints.empty())
+      {
+        throw std::runtime_error("ReverseProxy.AddRoute - A route needs at least one upstream");
+      }
+
+      auto route = Route();
+      route.next = 0;
+      route.options = options;
+      route.pathPrefix = std::move(pathPrefix);
+      for (auto it = endpoints.begin(); it != endpoints.end(); ++it)
+      {
+        upstreams.push_back(std::unique_ptr<Upstream>(new Upstream(*it, options)));
+        route.upstreams.push_back(upstreams.back().get());
+      }
+
+      routes.push_back(route);
+    }
+
+    // Returns the route whose prefix matches the most of the request line's target, or -1 if none does.
+    int FindRoute(std::string const& request) const
+    {
+      auto targetStart = request.find(' ');
+      if (targetStart == std::string::npos)
+      {
+        return -1;
+      }
+      ++targetStart;
+
+      auto targetEnd = request.find_first_of(" \r\n", targetStart);
+      auto targetLength = (targetEnd == std::string::npos ? request.size() : targetEnd) - targetStart;
+
+      auto best = -1;
+      for (auto i = 0u; i < routes.size(); ++i)
+      {
+        auto& prefix = routes[i].pathPrefix;
+        if (prefix.size() <= targetLength && request.compare(targetStart, prefix.size(), prefix) == 0 &&
+          (best < 0 || prefix.size() > routes[best].pathPrefix.size()))
+        {
+          best = static_cast<int>(i);
+        }
+      }
+
+      return best;
+    }
+
+    ProxyOptions const& GetOptions(int route) const
+    {
+      return routes[route].options;
+    }
+
+    std::size_t GetUpstreamCount(int route) const
+    {
+      return routes[route].upstreams.size();
+    }
+
+    // Every upstream of every route, in the order they were added.
+    std::vector<std::unique_ptr<Upstream>> const& GetUpstreams() const
+    {
+      return upstreams;
+    }
+
+    bool HasRoutes() const
+    {
+      return !routes.empty();
+    }
+
+    // Picks the available upstream of the route with the fewest outstanding requests, or NULL if every one is out
+    // of rotation.
+    Upstream* PickUpstream(int route, long long now)
+    {
+      auto& candidates = routes[route].upstreams;
+      auto& next = routes[route].next;
+
+      auto best = static_cast<Upstream*>(NULL);
+      for (auto i = 0u; i < candidates.size(); ++i)
+      {
+        auto upstream = candidates[(next + i) % candidates.size()];
+        if (upstream->IsAvailable(now) && (best == NULL || upstream->GetOutstanding() < best->GetOutstanding()))
+        {
+          best = upstream;
+        }
+      }
+      next = (next + 1) % candidates.size();
+
+      return best;
+    }
+
+    // Returns a pipe taken with AcquirePipe. One still holding bytes is closed rather than reused.
+    void ReleasePipe(SplicePipe& pipe)
+    {
+      if (pipe.IsOpen() && pipe.GetBuffered() == 0 && pipes.size() < MaxIdlePipes)
+      {
+        pipes.push_back(std::move(pipe));
+        return;
+      }
+
+      pipe.Close();
+    }
+
+    // Closes upstream connections that have been idle too long.
+    void Update(long long now)
+    {
+      for (auto it = upstreams.begin(); it != upstreams.end(); ++it)
+      {
+        (*it)->Update(now);
+      }
+    }
+
+  private: // methods
+
+    ReverseProxy(ReverseProxy const&);
+    ReverseProxy& operator=(ReverseProxy const&);
+  };
+} // namespace OlympusWebServer
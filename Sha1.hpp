@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+namespace OlympusWebServer
+{
+  // SHA-1 (RFC 3174). Only used where a protocol requires it, such as the WebSocket handshake; it is not a
+  // secure hash.
+  class Sha1
+  {
+  public: // data
+
+    static const std::size_t DigestLength = 20;
+
+  public: // methods
+
+    // Returns the 20-byte binary digest of data.
+    static std::string Hash(char const* data, std::size_t length)
+    {
+      unsigned state[5] = { 0x67452301u, 0xEFCDAB89u, 0x98BADCFEu, 0x10325476u, 0xC3D2E1F0u };
+
+      auto bytes = reinterpret_cast<unsigned char const*>(data);
+      auto remaining = length;
+      for (; remaining >= 64; remaining -= 64, bytes += 64)
+      {
+        ProcessBlock(bytes, state);
+      }
+
+      // Pad with a 1 bit, zeros, and the message length in bits, spilling into a second block if needed.
+      unsigned char tail[128] = {};
+      std::memcpy(tail, bytes, remaining);
+      tail[remaining] = 0x80;
+      auto tailLength = remaining < 56 ? 64u : 128u;
+      auto bitLength = static_cast<unsigned long long>(length) * 8;
+      for (auto i = 0u; i < 8; ++i)
+      {
+        tail[tailLength - 1 - i] = static_cast<unsigned char>(bitLength >> (8 * i));
+      }
+
+      ProcessBlock(tail, state);
+      if (tailLength == 128)
+      {
+        ProcessBlock(tail + 64, state);
+      }
+
+      auto digest = std::string(DigestLength, '\0');
+      for (auto i = 0u; i < DigestLength; ++i)
+      {
+        digest[i] = static_cast<char>((state[i / 4] >> (24 - 8 * (i % 4))) & 0xFF);
+      }
+
+      return digest;
+    }
+
+  private: // methods
+
+    static void ProcessBlock(unsigned char const* block, unsigned* state)
+    {
+      unsigned words[80];
+      for (auto i = 0u; i < 16; ++i)
+      {
+        words[i] = (static_cast<unsigned>(block[4 * i]) << 24) | (block[4 * i + 1] << 16) |
+          (block[4 * i + 2] << 8) | block[4 * i + 3];
+      }
+      for (auto i = 16u; i < 80; ++i)
+      {
+        words[i] = RotateLeft(words[i - 3] ^ words[i - 8] ^ words[i - 14] ^ words[i - 16], 1);
+      }
+
+      auto a = state[0];
+      auto b = state[1];
+      auto c = state[2];
+      auto d = state[3];
+      auto e = state[4];
+
+      for (auto i = 0u; i < 80; ++i)
+      {
+        auto f = 0u;
+        auto k = 0u;
+        if (i < 20)
+        {
+          f = (b & c) | (~b & d);
+          k = 0x5A827999u;
+        }
+        else if (i < 40)
+        {
+          f = b ^ c ^ d;
+          k = 0x6ED9EBA1u;
+        }
+        else if (i < 60)
+        {
+          f = (b & c) | (b & d) | (c & d);
+          k = 0x8F1BBCDCu;
+        }
+        else
+        {
+          f = b ^ c ^ d;
+          k = 0xCA62C1D6u;
+        }
+
+        auto temp = RotateLeft(a, 5) + f + e + k + words[i];
+        e = d;
+        d = c;
+        c = RotateLeft(b, 30);
+        b = a;
+        a = temp;
+      }
+
+      state[0] += a;
+      state[1] += b;
+      state[2] += c;
+      state[3] += d;
+      state[4] += e;
+    }
+
+    static unsigned RotateLeft(unsigned value, unsigned bits)
+    {
+      return (value << bits) | (value >> (32 - bits));
+    }
+  };
+} // namespace OlympusWebServer
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstddef>
+#include "Winsock.hpp"
+
+namespace OlympusWebServer
+{
+  // A pipe for moving bytes from one socket to another with splice(2): Fill pulls them from the source into the
+  // pipe and Drain pushes them on to the destination, so they never pass through user space. Bytes the destination
+  // has no room for wait in the pipe until the next Drain.
+  //
+  // Linux only. Elsewhere Open fails and callers copy through a buffer instead.
+  class SplicePipe
+  {
+  private: // data
+
+    std::size_t buffered;
+    int readEnd;
+    int writeEnd;
+
+  public: // methods
+
+    SplicePipe() :
+      buffered(0),
+      readEnd(-1),
+      writeEnd(-1)
+    {
+    }
+
+    SplicePipe(SplicePipe&& b)
+    {
+      readEnd = -1;
+      *this = std::move(b);
+    }
+
+    SplicePipe& operator=(SplicePipe&& b)
+    {
+      if (this == &b)
+      {
+        return *this;
+      }
+      Close();
+
+      buffered = b.buffered;
+      readEnd = b.readEnd;
+      writeEnd = b.writeEnd;
+
+      b.buffered = 0;
+      b.readEnd = -1;
+      b.writeEnd = -1;
+
+      return *this;
+    }
+
+    ~SplicePipe()
+    {
+      Close();
+    }
+
+    void Close()
+    {
+#ifdef __linux__
+      if (readEnd != -1)
+      {
+        ::close(readEnd);
+        ::close(writeEnd);
+      }
+#endif
+      buffered = 0;
+      readEnd = -1;
+      writeEnd = -1;
+    }
+
+    // Splices what the pipe holds into the socket, as far as it takes without blocking. Returns false if the socket
+    // has failed.
+    bool Drain(SOCKET to)
+    {
+#ifdef __linux__
+      while (buffered > 0)
+      {
+        auto result = Winsock::Splice(readEnd, to, buffered);
+        if (result < 0)
+        {
+          return WSAGetLastError() == WSAEWOULDBLOCK;
+        }
+
+        buffered -= static_cast<std::size_t>(result);
+      }
+#else
+      (void) to;
+#endif
+
+      return true;
+    }
+
+    // Splices up to length bytes that have arrived on the socket into the pipe, returning how many were taken. Sets
+    // isClosed if the peer has closed the connection or it has failed.
+    std::size_t Fill(SOCKET from, std::size_t length, bool& isClosed)
+    {
+      isClosed = false;
+#ifdef __linux__
+      auto result = Winsock::Splice(from, writeEnd, length);
+      if (result < 0)
+      {
+        isClosed = WSAGetLastError() != WSAEWOULDBLOCK;
+        return 0;
+      }
+      if (result == 0)
+      {
+        isClosed = true;
+        return 0;
+      }
+
+      buffered += static_cast<std::size_t>(result);
+      return static_cast<std::size_t>(result);
+#else
+      (void) from;
+      (void) length;
+      return 0;
+#endif
+    }
+
+    // Bytes taken by Fill that Drain has not yet delivered.
+    std::size_t GetBuffered() const
+    {
+      return buffered;
+    }
+
+    bool IsOpen() const
+    {
+      return readEnd != -1;
+    }
+
+    // Creates the pipe, non-blocking at both ends. Returns false where splice is not supported.
+    bool Open()
+    {
+      if (IsOpen())
+      {
+        return true;
+      }
+
+#ifdef __linux__
+      int descriptors[2];
+      if (::pipe2(descriptors, O_NONBLOCK | O_CLOEXEC) != 0)
+      {
+        return false;
+      }
+
+      readEnd = descriptors[0];
+      writeEnd = descriptors[1];
+      return true;
+#else
+      return false;
+#endif
+    }
+
+  private: // methods
+
+    SplicePipe(SplicePipe const&);
+    SplicePipe& operator=(SplicePipe const&);
+  };
+} // namespace OlympusWebServer
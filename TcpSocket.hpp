@@ -1,15 +1,27 @@
 #pragma once
 
+#include "Endpoint.hpp"
+#include "ListenerOptions.hpp"
+#include "ReceiveBuffer.hpp"
+#include <sstream>
+#include <stdexcept>
+#include <string>
 #include "Winsock.hpp"
 
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
 namespace OlympusWebServer
 {
+  // A stream socket: TCP over IPv4 or IPv6, or a Unix domain socket.
   class TcpSocket
   {
   private: // data
 
     bool isBlocking;
     bool isListening;
+    Endpoint peer; // the client's address, for an accepted socket
     SOCKET socket;
 
   public: // methods
@@ -17,7 +29,7 @@ namespace OlympusWebServer
     TcpSocket() :
       isBlocking(false),
       isListening(false),
-      socket(0)
+      socket(INVALID_SOCKET)
     {
     }
 
@@ -30,11 +42,12 @@ namespace OlympusWebServer
     {
       isBlocking = b.isBlocking;
       isListening = b.isListening;
+      peer = b.peer;
       socket = b.socket;
 
       b.isBlocking = false;
       b.isListening = false;
-      b.socket = 0;
+      b.socket = INVALID_SOCKET;
 
       return *this;
     }
@@ -51,14 +64,16 @@ namespace OlympusWebServer
         throw std::runtime_error("TcpSocket.Accept - Called on a socket that does not have listening mode enabled");
       }
 
-      auto newSocket = SOCKET(0);
-      auto address = sockaddr_in();
+      auto newSocket = SOCKET(INVALID_SOCKET);
+      auto peerAddress = sockaddr_storage();
+      auto peerLength = socklen_t();
       auto tryAgain = bool();
 
       do
       {
         tryAgain = false;
-        if (!Winsock::Accept(socket, address, newSocket))
+        peerLength = static_cast<socklen_t>(sizeof(peerAddress));
+        if (!Winsock::Accept(socket, newSocket, blocking, reinterpret_cast<sockaddr*>(&peerAddress), &peerLength))
         {
           switch (WSAGetLastError())
           {
@@ -70,6 +85,7 @@ namespace OlympusWebServer
             return false;
 
           case WSAECONNRESET:
+          case WSAECONNABORTED: // client gave up while queued; take the next one
             tryAgain = true;
             break;
 
@@ -86,12 +102,8 @@ namespace OlympusWebServer
 
       connection.socket = newSocket;
       connection.isListening = false;
-
-      if (!Winsock::IoctlSocket(connection.socket, blocking))
-      {
-        throw std::runtime_error("TcpSocket.Accept - Unable to set blocking mode on new connection");
-      }
       connection.isBlocking = blocking;
+      connection.peer = Endpoint::FromAddress(reinterpret_cast<sockaddr const*>(&peerAddress), peerLength);
 
       return true;
     }
@@ -103,22 +115,72 @@ namespace OlympusWebServer
         return;
       }
 
-      if (!Winsock::DestroySocket(socket))
+      auto closedSocket = socket;
+      socket = INVALID_SOCKET;
+      isListening = false;
+
+      if (!Winsock::DestroySocket(closedSocket))
       {
         throw std::runtime_error("TcpSocket.Close - Error shutting down socket");
       }
     }
 
+    // Starts connecting to endpoint without blocking. Sends made before the connection completes would block, and
+    // a refused connection surfaces as a failed send or receive, which closes the socket. TCP connections get
+    // TCP_NODELAY, since requests are written whole. Returns false if the connection failed immediately.
+    bool Connect(Endpoint const& endpoint)
+    {
+      if (IsOpen())
+      {
+        throw std::runtime_error("TcpSocket.Connect - Connect called on socket that is already open");
+      }
+
+      Winsock::Initialize();
+
+      auto newSocket = Winsock::CreateStreamSocket(endpoint.GetFamily());
+      if (newSocket == INVALID_SOCKET)
+      {
+        return false;
+      }
+
+      // A Unix domain socket connects at once; EWOULDBLOCK there means the listener's queue is full.
+      auto isStarted = Winsock::IoctlSocket(newSocket, false) &&
+        (Winsock::Connect(newSocket, endpoint.GetAddress(), endpoint.GetLength()) ||
+          (!endpoint.IsUnix() && (WSAGetLastError() == WSAEINPROGRESS || WSAGetLastError() == WSAEWOULDBLOCK)));
+      if (!isStarted)
+      {
+        Winsock::DestroySocket(newSocket);
+        return false;
+      }
+
+      if (!endpoint.IsUnix())
+      {
+        Winsock::SetOption(newSocket, IPPROTO_TCP, TCP_NODELAY, 1);
+      }
+
+      socket = newSocket;
+      isBlocking = false;
+      isListening = false;
+
+      return true;
+    }
+
+    SOCKET GetHandle() const
+    {
+      return socket;
+    }
+
+    // The address of the client, for a socket returned by Accept. A Unix domain socket's clients are unnamed.
+    Endpoint const& GetPeer() const
+    {
+      return peer;
+    }
+
     bool IsBlocking() const
     {
       return isBlocking;
     }
 
-#ifdef _MSC_VER
-#pragma warning(push)
-#pragma warning(disable: 4127)
-#endif
-
     bool IsConnected() const
     {
       if (!IsOpen())
@@ -126,39 +188,19 @@ namespace OlympusWebServer
         return false;
       }
 
-      auto timeout = timeval();
-      timeout.tv_sec = 0;
-      timeout.tv_usec = 1000 * 100;
-
-      fd_set writeSet;
-      FD_ZERO(&writeSet);
-      FD_SET(socket, &writeSet);
-
-      int result = select(0, NULL, &writeSet, NULL, &timeout);
-      switch (result)
+      switch (Winsock::PollWrite(socket, 100))
       {
       case SOCKET_ERROR:
-        throw std::runtime_error("TcpSocket.IsConnected - Error calling select");
+        throw std::runtime_error("TcpSocket.IsConnected - Error calling poll");
 
       case 0:
         return false;
 
       default:
-        if (FD_ISSET(socket, &writeSet))
-        {
-          return true;
-        }
-        else
-        {
-          return false;
-        }
+        return true;
       }
     }
 
-#ifdef _MSC_VER
-#pragma warning(pop)
-#endif
-
     bool IsListening() const
     {
       return isListening;
@@ -166,10 +208,24 @@ namespace OlympusWebServer
 
     bool IsOpen() const 
     { 
-      return socket != 0; 
+      return socket != INVALID_SOCKET;
+    }
+
+    // Opens a socket bound to the loopback interface.
+    bool Open(
+      bool listen = false,
+      unsigned short port = 0,
+      bool blocking = true,
+      ListenerOptions const& options = ListenerOptions())
+    {
+      return Open(Endpoint::Loopback(port), listen, blocking, options);
     }
 
-    bool Open(bool listen = false, unsigned short port = 0, bool blocking = true)
+    bool Open(
+      Endpoint const& endpoint,
+      bool listen = false,
+      bool blocking = true,
+      ListenerOptions const& options = ListenerOptions())
     {
       if (IsOpen()) 
       {
@@ -178,19 +234,29 @@ namespace OlympusWebServer
 
       Winsock::Initialize();
 
-      auto newSocket = Winsock::CreateTcpSocket();
+      auto newSocket = Winsock::CreateStreamSocket(endpoint.GetFamily());
       if (newSocket == INVALID_SOCKET)
       {
-        throw std::runtime_error("TcpSocket.Open - Failed to create a TCP socket");
+        throw std::runtime_error("TcpSocket.Open - Failed to create a socket for " + endpoint.ToString());
       }
 
-      auto loopback = Winsock::GetLoopbackAddress(port);
-      if (!Winsock::Bind(newSocket, loopback))
+      if (listen)
       {
-        throw std::runtime_error("TcpSocket.Open - Failed to bind the socket to the given address");
+        PrepareToBind(newSocket, endpoint, options);
       }
 
-      if (listen && !Winsock::Listen(newSocket))
+      if (!Winsock::Bind(newSocket, endpoint.GetAddress(), endpoint.GetLength()))
+      {
+        Winsock::DestroySocket(newSocket);
+        throw std::runtime_error("TcpSocket.Open - Failed to bind the socket to " + endpoint.ToString());
+      }
+
+      if (listen && !endpoint.IsUnix())
+      {
+        ApplyListenerOptions(newSocket, options);
+      }
+
+      if (listen && !Winsock::Listen(newSocket, options.backlog))
       {
         throw std::runtime_error("TcpSocket.Open - Failed to set socket to listening mode");
       }
@@ -209,45 +275,63 @@ namespace OlympusWebServer
       return true;
     }
 
-    std::string Receive()
+    // Receives whatever is available into the end of buffer, returning the number of bytes read. Reads continue
+    // into further chunks while the kernel keeps filling them, up to maxLength bytes per call.
+    std::size_t Receive(ReceiveBuffer& buffer, std::size_t maxLength = 64u * 1024u)
     {
       if (!IsOpen())
       {
         throw std::runtime_error("TcpSocket.Receive - Called on a closed/invalid socket");
       }
 
-      static const auto bufferSize = 64u * 1024u;
-      char buffer[bufferSize];
-
-      auto recvResult = Winsock::Receive(socket, buffer);
-      if (recvResult == SOCKET_ERROR)
+      auto total = std::size_t();
+      while (total < maxLength)
       {
-        switch (WSAGetLastError())
+        auto length = std::size_t();
+        auto writable = buffer.GetWritable(length);
+
+        auto recvResult = Winsock::Receive(socket, writable, length);
+        if (recvResult == SOCKET_ERROR)
         {
-        case WSAEWOULDBLOCK:
-          return std::string();
-
-        case WSAENOTCONN:
-        case WSAENETRESET:
-        case WSAESHUTDOWN:
-        case WSAECONNABORTED:
-        case WSAETIMEDOUT:
-        case WSAECONNRESET:
-          Close();
-          return std::string();
+          buffer.Commit(0);
+
+          switch (WSAGetLastError())
+          {
+          case WSAEWOULDBLOCK:
+            return total;
+
+          case WSAENOTCONN:
+          case WSAENETRESET:
+          case WSAESHUTDOWN:
+          case WSAECONNABORTED:
+          case WSAETIMEDOUT:
+          case WSAECONNRESET:
+          case WSAECONNREFUSED: // a connection started by Connect was refused
+            Close();
+            return total;
 
-        default:
-          return std::string();
-          //throw std::runtime_error("TcpSocket.Receive - Unable to receive data over socket");
+          default:
+            return total;
+            //throw std::runtime_error("TcpSocket.Receive - Unable to receive data over socket");
+          }
         }
-      }
 
-      if (recvResult == 0) // graceful close
-      {
-        Close();
+        buffer.Commit(static_cast<std::size_t>(recvResult));
+        total += static_cast<std::size_t>(recvResult);
+
+        if (recvResult == 0) // graceful close
+        {
+          Close();
+          return total;
+        }
+
+        if (static_cast<std::size_t>(recvResult) < length)
+        {
+          break; // drained the socket
+        }
       }
 
-      return std::string(buffer, recvResult);
+      return total;
     }
 
     bool Send(std::string const& data)
@@ -283,5 +367,104 @@ namespace OlympusWebServer
 
       return true;
     }
+
+    // Sends as much of data[offset..] as the socket will take without blocking, returning the number of bytes sent.
+    // Closes the socket if the peer has gone away.
+    std::size_t SendSome(std::string const& data, std::size_t offset = 0)
+    {
+      if (!IsOpen())
+      {
+        throw std::runtime_error("TcpSocket.SendSome - Called on a closed/invalid socket");
+      }
+      if (offset >= data.size())
+      {
+        return 0;
+      }
+
+      auto sendResult = Winsock::Send(socket, data.data() + offset, data.size() - offset);
+      if (sendResult == SOCKET_ERROR)
+      {
+        if (WSAGetLastError() != WSAEWOULDBLOCK)
+        {
+          Close();
+        }
+        return 0;
+      }
+
+      return static_cast<std::size_t>(sendResult);
+    }
+
+  private: // methods
+
+    // Options are best effort: a kernel that rejects one still gets a working listener.
+    static void ApplyListenerOptions(SOCKET listener, ListenerOptions const& options)
+    {
+      // Accepted sockets inherit TCP_NODELAY from the listener, saving a setsockopt per connection.
+      if (options.noDelay)
+      {
+        Winsock::SetOption(listener, IPPROTO_TCP, TCP_NODELAY, 1);
+      }
+
+#ifdef TCP_DEFER_ACCEPT
+      if (options.deferAcceptSeconds > 0)
+      {
+        Winsock::SetOption(listener, IPPROTO_TCP, TCP_DEFER_ACCEPT, options.deferAcceptSeconds);
+      }
+#endif
+
+#ifdef TCP_FASTOPEN
+      if (options.fastOpenQueue > 0)
+      {
+        Winsock::SetOption(listener, IPPROTO_TCP, TCP_FASTOPEN, options.fastOpenQueue);
+      }
+#endif
+    }
+
+#ifndef _WIN32
+    // Whether connecting to a Unix socket is refused, as it is once its listener has gone. The probe does not
+    // block, so a listener with a full accept queue counts as live.
+    static bool IsStale(Endpoint const& endpoint)
+    {
+      auto probe = Winsock::CreateStreamSocket(AF_UNIX);
+      if (probe == INVALID_SOCKET)
+      {
+        return false;
+      }
+
+      auto isStale = Winsock::IoctlSocket(probe, false) &&
+        !Winsock::Connect(probe, endpoint.GetAddress(), endpoint.GetLength()) && WSAGetLastError() == WSAECONNREFUSED;
+      Winsock::DestroySocket(probe);
+
+      return isStale;
+    }
+#endif
+
+    static void PrepareToBind(SOCKET listener, Endpoint const& endpoint, ListenerOptions const& options)
+    {
+#ifndef _WIN32
+      if (options.reuseAddress && endpoint.IsUnix())
+      {
+        // A Unix socket file outlives its listener, so a restarted server would fail to bind. Only a socket nobody
+        // is listening on is removed, which a refused connection shows; anything else at the path, a live server's
+        // socket included, is left for bind to report.
+        auto path = endpoint.GetUnixPath();
+        struct stat status;
+        if (!path.empty() && ::stat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode) && IsStale(endpoint))
+        {
+          ::unlink(path.c_str());
+        }
+      }
+      else if (options.reuseAddress)
+      {
+        Winsock::SetOption(listener, SOL_SOCKET, SO_REUSEADDR, 1);
+      }
+#endif
+
+      // Set explicitly either way: the default differs between platforms (and on Linux, with a sysctl).
+      if (endpoint.GetFamily() == AF_INET6)
+      {
+        Winsock::SetOption(listener, IPPROTO_IPV6, IPV6_V6ONLY, endpoint.IsDualStack() ? 0 : 1);
+      }
+    }
   };
 } // namespace OlympusWebServer
\ No newline at end of file
@@ -0,0 +1,1584 @@
+#include <cstdio>
+#include <cstring>
+#include "Hpack.hpp"
+#include "Http2Session.hpp"
+#include "HttpRequest.hpp"
+#include "HttpResponse.hpp"
+#include <memory>
+#include "ProxyExchange.hpp"
+#include "ReceiveBuffer.hpp"
+#include "ReverseProxy.hpp"
+#include <string>
+#include "TcpSocket.hpp"
+#include "Upstream.hpp"
+#include <vector>
+#include "WebSocketSession.hpp"
+using namespace OlympusWebServer;
+
+// Records a failed check with its line and carries on, so one run reports every failure in a test.
+#define OLYMPUS_CHECK(expression) Check((expression), #expression, __LINE__)
+
+namespace
+{
+  unsigned failureCount = 0;
+
+  void Check(bool isPassed, char const* expression, int line)
+  {
+    if (!isPassed)
+    {
+      std::printf("  line %d: check failed: %s\n", line, expression);
+      ++failureCount;
+    }
+  }
+
+  // A frame read back from a session's output.
+  class Frame
+  {
+  public: // data
+
+    unsigned char flags;
+    std::string payload;
+    unsigned streamId;
+    unsigned char type;
+  };
+
+  // Appends bytes to a receive buffer, as a socket read would.
+  void Append(ReceiveBuffer& buffer, std::string const& data)
+  {
+    auto offset = std::size_t();
+    while (offset < data.size())
+    {
+      auto length = std::size_t();
+      auto writable = buffer.GetWritable(length);
+      if (length > data.size() - offset)
+      {
+        length = data.size() - offset;
+      }
+      std::memcpy(writable, data.data() + offset, length);
+      buffer.Commit(length);
+      offset += length;
+    }
+  }
+
+  // Decodes hex digits, ignoring spaces, as the RFC 7541 examples are printed.
+  std::string FromHex(char const* hex)
+  {
+    auto bytes = std::string();
+    auto digitCount = 0u;
+    auto byte = 0u;
+    for (auto c = hex; *c != '\0'; ++c)
+    {
+      if (*c == ' ')
+      {
+        continue;
+      }
+
+      byte = byte * 16 + static_cast<unsigned>(*c <= '9' ? *c - '0' : *c - 'a' + 10);
+      if (++digitCount % 2 == 0)
+      {
+        bytes.push_back(static_cast<char>(byte));
+        byte = 0;
+      }
+    }
+
+    return bytes;
+  }
+
+  // Joins a header list into "name: value" lines, which read well in a failed check.
+  std::string JoinHeaders(HttpHeaderList const& headers)
+  {
+    auto text = std::string();
+    for (auto it = headers.begin(); it != headers.end(); ++it)
+    {
+      text += it->first + ": " + it->second + "\n";
+    }
+
+    return text;
+  }
+
+  // Decodes one block with the decoder, whose table carries over from earlier blocks, and joins the result.
+  std::string DecodeBlock(HpackDecoder& decoder, char const* hex)
+  {
+    auto block = FromHex(hex);
+    auto headers = HttpHeaderList();
+    if (!decoder.Decode(block.data(), block.size(), headers))
+    {
+      return "(error)";
+    }
+
+    return JoinHeaders(headers);
+  }
+
+  std::string MakeFrame(Http2FrameType::Value type, unsigned char flags, unsigned streamId, std::string const& payload)
+  {
+    auto frame = std::string();
+    Http2Session::AppendFrameHeader(frame, payload.size(), type, flags, streamId);
+    return frame + payload;
+  }
+
+  // The client preface and an empty SETTINGS frame, which every HTTP/2 connection starts with.
+  std::string MakePreface()
+  {
+    return std::string(Http2Session::GetPreface()) + MakeFrame(Http2FrameType::Settings, 0, 0, std::string());
+  }
+
+  // A header block for a GET request, encoded with a fresh encoder so it stands on its own, plus any extra fields.
+  std::string MakeRequestBlock(HttpHeaderList const& extraFields = HttpHeaderList())
+  {
+    auto encoder = HpackEncoder();
+    auto block = std::string();
+    encoder.Encode(":method", "GET", block);
+    encoder.Encode(":scheme", "http", block);
+    encoder.Encode(":path", "/", block);
+    encoder.Encode(":authority", "example.com", block);
+    for (auto it = extraFields.begin(); it != extraFields.end(); ++it)
+    {
+      encoder.Encode(it->first, it->second, block);
+    }
+
+    return block;
+  }
+
+  std::string MakeUint32(unsigned value)
+  {
+    auto bytes = std::string();
+    Http2Session::AppendUint32(bytes, value);
+    return bytes;
+  }
+
+  std::string MakeSetting(Http2Setting::Value id, unsigned value)
+  {
+    auto bytes = std::string();
+    bytes.push_back(static_cast<char>((id >> 8) & 0xFF));
+    bytes.push_back(static_cast<char>(id & 0xFF));
+    return bytes + MakeUint32(value);
+  }
+
+  // Removes and parses everything the session has written so far.
+  std::vector<Frame> TakeFrames(Http2Session& session)
+  {
+    auto frames = std::vector<Frame>();
+    auto& output = session.GetOutput();
+    auto offset = std::size_t();
+    while (offset + Http2Session::FrameHeaderLength <= output.size())
+    {
+      auto header = reinterpret_cast<unsigned char const*>(output.data() + offset);
+      auto length = (static_cast<std::size_t>(header[0]) << 16) | (header[1] << 8) | header[2];
+
+      auto frame = Frame();
+      frame.type = header[3];
+      frame.flags = header[4];
+      frame.streamId = Http2Session::ReadUint32(output.data() + offset + 5) & 0x7FFFFFFFu;
+      frame.payload = output.substr(offset + Http2Session::FrameHeaderLength, length);
+      frames.push_back(frame);
+
+      offset += Http2Session::FrameHeaderLength + length;
+    }
+    output.clear();
+
+    return frames;
+  }
+
+  // Feeds bytes to the session as if they had just been received. Returns what Receive returns.
+  bool Receive(Http2Session& session, std::string const& data)
+  {
+    auto input = ReceiveBuffer();
+    Append(input, data);
+    return session.Receive(input);
+  }
+
+  // Opens the connection as a client would, with the given SETTINGS, and drops the server's side of the handshake
+  // so later output holds only replies to what a test sends.
+  void StartSession(Http2Session& session, std::string const& settings = std::string())
+  {
+    Receive(session, std::string(Http2Session::GetPreface()) + MakeFrame(Http2FrameType::Settings, 0, 0, settings));
+    TakeFrames(session);
+  }
+
+  // Returns the error code of the GOAWAY among the frames, or -1 if there is none.
+  long long FindGoAwayError(std::vector<Frame> const& frames)
+  {
+    for (auto it = frames.begin(); it != frames.end(); ++it)
+    {
+      if (it->type == Http2FrameType::GoAway && it->payload.size() >= 8)
+      {
+        return Http2Session::ReadUint32(it->payload.data() + 4);
+      }
+    }
+
+    return -1;
+  }
+
+  // Returns the error code of the RST_STREAM for the stream among the frames, or -1 if there is none.
+  long long FindResetError(std::vector<Frame> const& frames, unsigned streamId)
+  {
+    for (auto it = frames.begin(); it != frames.end(); ++it)
+    {
+      if (it->type == Http2FrameType::ResetStream && it->streamId == streamId && it->payload.size() == 4)
+      {
+        return Http2Session::ReadUint32(it->payload.data());
+      }
+    }
+
+    return -1;
+  }
+
+  // Adds up the DATA the frames carry for the stream, and whether the last of it ended the stream.
+  std::size_t CountData(std::vector<Frame> const& frames, unsigned streamId, bool& isEnded)
+  {
+    auto length = std::size_t();
+    for (auto it = frames.begin(); it != frames.end(); ++it)
+    {
+      if (it->type == Http2FrameType::Data && it->streamId == streamId)
+      {
+        length += it->payload.size();
+        isEnded = (it->flags & Http2Flag::EndStream) != 0;
+      }
+    }
+
+    return length;
+  }
+
+  // A client frame. Clients must mask every frame; isMasked false makes one that breaks that rule.
+  std::string MakeClientFrame(bool isFinal, WebSocketOpcode::Value opcode, std::string payload, bool isMasked = true)
+  {
+    static unsigned char const mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+
+    auto frame = std::string();
+    frame.push_back(static_cast<char>((isFinal ? 0x80 : 0) | opcode));
+    auto maskBit = isMasked ? 0x80 : 0;
+    if (payload.size() < 126)
+    {
+      frame.push_back(static_cast<char>(maskBit | payload.size()));
+    }
+    else
+    {
+      auto lengthBytes = payload.size() <= 0xFFFF ? 2 : 8;
+      frame.push_back(static_cast<char>(maskBit | (lengthBytes == 2 ? 126 : 127)));
+      for (auto shift = (lengthBytes - 1) * 8; shift >= 0; shift -= 8)
+      {
+        frame.push_back(static_cast<char>((static_cast<unsigned long long>(payload.size()) >> shift) & 0xFF));
+      }
+    }
+
+    if (isMasked)
+    {
+      frame.append(reinterpret_cast<char const*>(mask), sizeof(mask));
+      for (auto i = std::size_t(); i < payload.size(); ++i)
+      {
+        payload[i] = static_cast<char>(payload[i] ^ mask[i % 4]);
+      }
+    }
+
+    return frame + payload;
+  }
+
+  // The close frame a server sends with the given status code.
+  std::string MakeCloseFrame(WebSocketCloseCode::Value code)
+  {
+    char payload[2] = { static_cast<char>((code >> 8) & 0xFF), static_cast<char>(code & 0xFF) };
+    return *WebSocketSession::EncodeFrame(WebSocketOpcode::Close, payload, sizeof(payload));
+  }
+
+  // Everything the session has queued for the client.
+  std::string TakeOutput(WebSocketSession& session)
+  {
+    auto sent = std::string();
+    session.Flush([&sent](std::string const& frame, std::size_t offset) -> std::size_t
+    {
+      sent.append(frame, offset, std::string::npos);
+      return frame.size() - offset;
+    });
+
+    return sent;
+  }
+
+  // Reads from a session given the bytes, and returns the messages it hands out, each prefixed "text:" or
+  // "binary:" and ended with a newline.
+  std::string ReadMessages(WebSocketSession& session, std::string const& frames)
+  {
+    auto input = ReceiveBuffer();
+    Append(input, frames);
+
+    auto messages = std::string();
+    auto message = std::string();
+    auto isBinary = false;
+    while (session.ReadMessage(input, message, isBinary))
+    {
+      messages += (isBinary ? "binary:" : "text:") + message + "\n";
+    }
+
+    return messages;
+  }
+
+  // A Unix socket path of this process's own, so test runs do not collide. Any file left from an earlier run is
+  // removed.
+  std::string MakeSocketPath(char const* name)
+  {
+    auto path = "/tmp/rs-webserver-tests-" + std::to_string(static_cast<long long>(getpid())) + "-" + name;
+    unlink(path.c_str());
+    return path;
+  }
+
+  // A stand-in upstream on a Unix socket. The test plays its part by hand between updates of a ProxyExchange, so
+  // each case decides exactly what the proxy sees and when.
+  class StubUpstream
+  {
+  public: // data
+
+    TcpSocket connection; // the connection from the proxy accepted last
+    Endpoint endpoint;
+    TcpSocket listener;
+    std::string path;
+
+  public: // methods
+
+    explicit StubUpstream(char const* name) :
+      path(MakeSocketPath(name))
+    {
+      endpoint = Endpoint::Unix(path);
+      listener.Open(endpoint, true, false);
+    }
+
+    ~StubUpstream()
+    {
+      connection.Close();
+      listener.Close();
+      unlink(path.c_str());
+    }
+
+    bool Accept()
+    {
+      return listener.Accept(connection, false);
+    }
+
+    // Whatever the proxy has sent on the connection since the last call.
+    std::string Receive()
+    {
+      auto buffer = ReceiveBuffer();
+      connection.Receive(buffer);
+      auto data = std::string();
+      buffer.CopyTo(0, buffer.GetSize(), data);
+      return data;
+    }
+
+    void Send(std::string const& data)
+    {
+      connection.Send(data);
+    }
+  };
+
+  // The client's side of one proxied request: the exchange, and everything it has written to the client.
+  class ProxyClient
+  {
+  public: // data
+
+    std::unique_ptr<ProxyExchange> exchange;
+    ReceiveBuffer input; // request body not yet taken by the exchange
+    long long now;
+    std::string received;
+    ProxyStatus::Value status;
+
+  public: // methods
+
+    ProxyClient() :
+      now(TraceClock::Now()),
+      status(ProxyStatus::Forwarding)
+    {
+    }
+
+    // Starts forwarding a request on route 0, with its body already received from the client. Bodies are copied,
+    // since there is no client socket to splice to.
+    ProxyStatus::Value Start(
+      ReverseProxy& proxy,
+      std::string const& headers,
+      Endpoint const& peer = Endpoint(),
+      std::string const& body = std::string())
+    {
+      Append(input, body);
+      exchange.reset(new ProxyExchange(proxy, 0, headers, peer, body.size(), false, false));
+      return Update();
+    }
+
+    ProxyStatus::Value Update()
+    {
+      auto output = std::string();
+      status = exchange->Update(input, output, INVALID_SOCKET, now);
+      received += output;
+      return status;
+    }
+  };
+
+  // Updates the exchange until it is done with the request, or gives up after maxUpdates.
+  ProxyStatus::Value UpdateUntilDone(ProxyClient& client, unsigned maxUpdates = 100)
+  {
+    for (auto i = 0u; i < maxUpdates && client.Update() == ProxyStatus::Forwarding; ++i)
+    {
+    }
+
+    return client.status;
+  }
+
+  bool StartsWith(std::string const& text, char const* prefix)
+  {
+    return text.compare(0, std::strlen(prefix), prefix) == 0;
+  }
+
+  // A proxy with one route to stub, without splicing.
+  void AddStubRoute(ReverseProxy& proxy, StubUpstream const& stub, ProxyOptions options = ProxyOptions())
+  {
+    options.splice = false;
+    proxy.AddRoute("/", std::vector<Endpoint>(1, stub.endpoint), options);
+  }
+
+  // What a handler would typically read from a request's headers.
+  std::string DescribeHeaders(HttpRequest const& request)
+  {
+    return request["Host"] + "|" + request["user-agent"] + "|" + request["X-Request-ID"] + "|" + request["ACCEPT"];
+  }
+
+  void TestRequestHeaderCase()
+  {
+    auto request = HttpRequest(
+      "GET /orders HTTP/1.1\r\n"
+      "Host: example.com\r\n"
+      "Content-Type: application/json\r\n"
+      "\r\n");
+
+    OLYMPUS_CHECK(request["Content-Type"] == "application/json");
+    OLYMPUS_CHECK(request["content-type"] == "application/json");
+    OLYMPUS_CHECK(request["CONTENT-TYPE"] == "application/json");
+    OLYMPUS_CHECK(request["host"] == "example.com");
+    OLYMPUS_CHECK(request["Accept"].empty());
+  }
+
+  // The same handler sees the same headers whether the request came over HTTP/1.1 or, lower-cased, over HTTP/2.
+  void TestRequestHeadersMatchAcrossProtocols()
+  {
+    auto http11 = HttpRequest(
+      "GET /orders?limit=5 HTTP/1.1\r\n"
+      "Host: example.com\r\n"
+      "User-Agent: curl/8.4.0\r\n"
+      "X-Request-Id: 42\r\n"
+      "Accept: text/html\r\n"
+      "\r\n");
+
+    auto encoder = HpackEncoder();
+    auto block = std::string();
+    encoder.Encode(":method", "GET", block);
+    encoder.Encode(":scheme", "http", block);
+    encoder.Encode(":path", "/orders?limit=5", block);
+    encoder.Encode(":authority", "example.com", block);
+    encoder.Encode("user-agent", "curl/8.4.0", block);
+    encoder.Encode("x-request-id", "42", block);
+    encoder.Encode("accept", "text/html", block);
+
+    Http2Session session;
+    auto input = ReceiveBuffer();
+    Append(input, MakePreface() +
+      MakeFrame(Http2FrameType::Headers, Http2Flag::EndHeaders | Http2Flag::EndStream, 1, block));
+    OLYMPUS_CHECK(session.Receive(input));
+
+    auto requestString = std::string();
+    auto streamId = 0u;
+    OLYMPUS_CHECK(session.ReadRequest(requestString, streamId));
+    OLYMPUS_CHECK(streamId == 1);
+
+    auto http2 = HttpRequest(requestString);
+    OLYMPUS_CHECK(http2.GetHttpVersion() == HttpVersion::Http2);
+    OLYMPUS_CHECK(http2.GetPath() == http11.GetPath());
+    OLYMPUS_CHECK(DescribeHeaders(http11) == "example.com|curl/8.4.0|42|text/html");
+    OLYMPUS_CHECK(DescribeHeaders(http2) == DescribeHeaders(http11));
+  }
+
+  // RFC 7541 C.2: one field in each literal representation, and an indexed one.
+  void TestHpackFieldRepresentations()
+  {
+    auto decoder = HpackDecoder();
+    OLYMPUS_CHECK(DecodeBlock(decoder,
+      "400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572") == "custom-key: custom-header\n");
+    OLYMPUS_CHECK(DecodeBlock(decoder, "040c 2f73 616d 706c 652f 7061 7468") == ":path: /sample/path\n");
+    OLYMPUS_CHECK(DecodeBlock(decoder, "1008 7061 7373 776f 7264 0673 6563 7265 74") == "password: secret\n");
+    OLYMPUS_CHECK(DecodeBlock(decoder, "82") == ":method: GET\n");
+
+    // Only the first was added to the dynamic table, at index 62.
+    OLYMPUS_CHECK(DecodeBlock(decoder, "be") == "custom-key: custom-header\n");
+    OLYMPUS_CHECK(DecodeBlock(decoder, "bf") == "(error)");
+  }
+
+  // RFC 7541 C.3 and C.4: three requests on one connection, without and then with Huffman coding. Each builds on
+  // the dynamic table the one before left.
+  void TestHpackRequestExamples()
+  {
+    auto plain = HpackDecoder();
+    OLYMPUS_CHECK(DecodeBlock(plain, "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d") ==
+      ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n");
+    OLYMPUS_CHECK(DecodeBlock(plain, "8286 84be 5808 6e6f 2d63 6163 6865") ==
+      ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\ncache-control: no-cache\n");
+    OLYMPUS_CHECK(DecodeBlock(plain,
+      "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65") ==
+      ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\ncustom-key: custom-value\n");
+
+    auto huffman = HpackDecoder();
+    OLYMPUS_CHECK(DecodeBlock(huffman, "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff") ==
+      ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n");
+    OLYMPUS_CHECK(DecodeBlock(huffman, "8286 84be 5886 a8eb 1064 9cbf") ==
+      ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\ncache-control: no-cache\n");
+    OLYMPUS_CHECK(DecodeBlock(huffman, "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf") ==
+      ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\ncustom-key: custom-value\n");
+  }
+
+  // RFC 7541 C.5 and C.6: three responses through a 256-byte table, so each one evicts entries the next one
+  // must not find. The examples assume the table was already that size; a size update leading the first block
+  // shrinks it here.
+  void TestHpackResponseExamples()
+  {
+    auto first = std::string(
+      ":status: 302\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\n"
+      "location: https://www.example.com\n");
+    auto second = std::string(
+      ":status: 307\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\n"
+      "location: https://www.example.com\n");
+    auto third = std::string(
+      ":status: 200\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:22 GMT\n"
+      "location: https://www.example.com\ncontent-encoding: gzip\n"
+      "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\n");
+
+    auto plain = HpackDecoder();
+    OLYMPUS_CHECK(DecodeBlock(plain,
+      "3fe1 01"
+      "4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32"
+      "3120 474d 546e 1768 7474 7073 3a2f 2f77 7777 2e65 7861 6d70 6c65 2e63 6f6d") == first);
+    OLYMPUS_CHECK(DecodeBlock(plain, "4803 3330 37c1 c0bf") == second);
+    OLYMPUS_CHECK(DecodeBlock(plain,
+      "88c1 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 3220 474d 54c0 5a04 677a 6970"
+      "7738 666f 6f3d 4153 444a 4b48 514b 425a 584f 5157 454f 5049 5541 5851 5745 4f49 553b 206d 6178 2d61"
+      "6765 3d33 3630 303b 2076 6572 7369 6f6e 3d31") == third);
+
+    auto huffman = HpackDecoder();
+    OLYMPUS_CHECK(DecodeBlock(huffman,
+      "3fe1 01"
+      "4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0 82a6 2d1b ff6e 919d 29ad"
+      "1718 63c7 8f0b 97c8 e9ae 82ae 43d3") == first);
+    OLYMPUS_CHECK(DecodeBlock(huffman, "4883 640e ffc1 c0bf") == second);
+    OLYMPUS_CHECK(DecodeBlock(huffman,
+      "88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a 839b d9ab 77ad 94e7 821d d7f2"
+      "e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f 9587 3160 65c0 03ed 4ee5 b106 3d50 07") ==
+      third);
+
+    // The third response evicted everything the first two added, leaving its own three entries at 62 to 64.
+    OLYMPUS_CHECK(DecodeBlock(huffman, "c0") == "date: Mon, 21 Oct 2013 20:13:22 GMT\n");
+    OLYMPUS_CHECK(DecodeBlock(huffman, "c1") == "(error)");
+  }
+
+  void TestHpackTableSizeUpdates()
+  {
+    auto decoder = HpackDecoder();
+    OLYMPUS_CHECK(DecodeBlock(decoder, "400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572") ==
+      "custom-key: custom-header\n");
+
+    // Shrinking to zero empties the table; growing back does not restore what was evicted.
+    OLYMPUS_CHECK(DecodeBlock(decoder, "20 3fe1 1f be") == "(error)");
+    OLYMPUS_CHECK(DecodeBlock(decoder, "20 82") == ":method: GET\n");
+    OLYMPUS_CHECK(DecodeBlock(decoder, "3fe1 1f be") == "(error)");
+
+    // An update must lead the block, and cannot exceed the 4096 bytes SETTINGS allows.
+    OLYMPUS_CHECK(DecodeBlock(decoder, "82 20") == "(error)");
+    OLYMPUS_CHECK(DecodeBlock(decoder, "3fe1 1f") == std::string());
+    OLYMPUS_CHECK(DecodeBlock(decoder, "3fe2 1f") == "(error)");
+
+    // The encoder announces a smaller table in the next block it writes, which the decoder follows.
+    auto encoder = HpackEncoder();
+    auto peer = HpackDecoder();
+    auto block = std::string();
+    auto headers = HttpHeaderList();
+    encoder.Encode("x-trace", "abc", block);
+    OLYMPUS_CHECK(peer.Decode(block.data(), block.size(), headers));
+    encoder.SetMaxTableSize(0);
+    block.clear();
+    headers.clear();
+    encoder.Encode("x-trace", "abc", block);
+    encoder.Encode("x-trace", "abc", block);
+    OLYMPUS_CHECK(!block.empty() && static_cast<unsigned char>(block[0]) == 0x20);
+    OLYMPUS_CHECK(peer.Decode(block.data(), block.size(), headers));
+    OLYMPUS_CHECK(JoinHeaders(headers) == "x-trace: abc\nx-trace: abc\n");
+  }
+
+  void TestHpackHuffman()
+  {
+    auto decode = [](char const* hex) -> std::string
+    {
+      auto bytes = FromHex(hex);
+      auto text = std::string();
+      return HpackHuffman::Decode(reinterpret_cast<unsigned char const*>(bytes.data()), bytes.size(), text) ?
+        text : "(error)";
+    };
+
+    OLYMPUS_CHECK(decode("f1e3 c2e5 f23a 6ba0 ab90 f4ff") == "www.example.com");
+    OLYMPUS_CHECK(decode("a8eb 1064 9cbf") == "no-cache");
+    OLYMPUS_CHECK(decode("") == std::string());
+    OLYMPUS_CHECK(decode("1f") == "a"); // five bits of 'a', padded with ones
+    OLYMPUS_CHECK(decode("18") == "(error)"); // padded with zeros
+    OLYMPUS_CHECK(decode("1f ff") == "(error)"); // more than seven bits of padding
+    OLYMPUS_CHECK(decode("ffff fffc") == "(error)"); // EOS
+  }
+
+  // Every one of these is a connection error, answered with GOAWAY and the given code.
+  void TestHttp2MalformedFrames()
+  {
+    class MalformedCase
+    {
+    public: // data
+
+      char const* name;
+      std::string frames;
+      Http2Error::Value error;
+    };
+
+    auto headers = MakeRequestBlock();
+    MalformedCase const cases[] =
+    {
+      { "DATA on stream 0", MakeFrame(Http2FrameType::Data, 0, 0, "x"), Http2Error::ProtocolError },
+      { "DATA on an idle stream", MakeFrame(Http2FrameType::Data, 0, 3, "x"), Http2Error::ProtocolError },
+      { "HEADERS on an even stream", MakeFrame(Http2FrameType::Headers, Http2Flag::EndHeaders, 2, headers),
+        Http2Error::ProtocolError },
+      { "HEADERS on a stream already used",
+        MakeFrame(Http2FrameType::Headers, Http2Flag::EndHeaders | Http2Flag::EndStream, 5, headers) +
+        MakeFrame(Http2FrameType::Headers, Http2Flag::EndHeaders | Http2Flag::EndStream, 3, MakeRequestBlock()),
+        Http2Error::StreamClosed },
+      { "frame over the maximum size", MakeFrame(Http2FrameType::Data, 0, 1, std::string(16385, 'x')),
+        Http2Error::FrameSizeError },
+      { "padding longer than the frame",
+        MakeFrame(Http2FrameType::Headers, Http2Flag::EndHeaders | Http2Flag::Padded, 1, "\x05" "abc"),
+        Http2Error::ProtocolError },
+      { "HEADERS with priority but no room for it",
+        MakeFrame(Http2FrameType::Headers, Http2Flag::EndHeaders | Http2Flag::Priority, 1, "abc"),
+        Http2Error::FrameSizeError },
+      { "CONTINUATION without HEADERS", MakeFrame(Http2FrameType::Continuation, Http2Flag::EndHeaders, 1, headers),
+        Http2Error::ProtocolError },
+      { "header block interrupted",
+        MakeFrame(Http2FrameType::Headers, 0, 1, headers) + MakeFrame(Http2FrameType::Ping, 0, 0, "12345678"),
+        Http2Error::ProtocolError },
+      { "CONTINUATION on another stream",
+        MakeFrame(Http2FrameType::Headers, 0, 1, headers) +
+        MakeFrame(Http2FrameType::Continuation, Http2Flag::EndHeaders, 3, std::string()),
+        Http2Error::ProtocolError },
+      { "undecodable header block", MakeFrame(Http2FrameType::Headers, Http2Flag::EndHeaders, 1, "\x80"),
+        Http2Error::CompressionError },
+      { "SETTINGS on a stream", MakeFrame(Http2FrameType::Settings, 0, 1, std::string()), Http2Error::ProtocolError },
+      { "SETTINGS of a partial entry", MakeFrame(Http2FrameType::Settings, 0, 0, "12345"),
+        Http2Error::FrameSizeError },
+      { "SETTINGS ack with a payload", MakeFrame(Http2FrameType::Settings, Http2Flag::Ack, 0, "123456"),
+        Http2Error::FrameSizeError },
+      { "ENABLE_PUSH of 2", MakeFrame(Http2FrameType::Settings, 0, 0, MakeSetting(Http2Setting::EnablePush, 2)),
+        Http2Error::ProtocolError },
+      { "INITIAL_WINDOW_SIZE over 2^31-1",
+        MakeFrame(Http2FrameType::Settings, 0, 0, MakeSetting(Http2Setting::InitialWindowSize, 0x80000000u)),
+        Http2Error::FlowControlError },
+      { "MAX_FRAME_SIZE under 16384",
+        MakeFrame(Http2FrameType::Settings, 0, 0, MakeSetting(Http2Setting::MaxFrameSize, 16383)),
+        Http2Error::ProtocolError },
+      { "PING of 7 bytes", MakeFrame(Http2FrameType::Ping, 0, 0, "1234567"), Http2Error::FrameSizeError },
+      { "PING on a stream", MakeFrame(Http2FrameType::Ping, 0, 1, "12345678"), Http2Error::ProtocolError },
+      { "PRIORITY of 4 bytes", MakeFrame(Http2FrameType::Priority, 0, 1, "1234"), Http2Error::FrameSizeError },
+      { "RST_STREAM on an idle stream", MakeFrame(Http2FrameType::ResetStream, 0, 7, MakeUint32(0)),
+        Http2Error::ProtocolError },
+      { "PUSH_PROMISE from a client", MakeFrame(Http2FrameType::PushPromise, Http2Flag::EndHeaders, 1, "1234"),
+        Http2Error::ProtocolError },
+      { "WINDOW_UPDATE of zero", MakeFrame(Http2FrameType::WindowUpdate, 0, 0, MakeUint32(0)),
+        Http2Error::ProtocolError },
+      { "WINDOW_UPDATE of 3 bytes", MakeFrame(Http2FrameType::WindowUpdate, 0, 0, "123"),
+        Http2Error::FrameSizeError },
+      { "GOAWAY on a stream", MakeFrame(Http2FrameType::GoAway, 0, 1, MakeUint32(0) + MakeUint32(0)),
+        Http2Error::ProtocolError },
+    };
+
+    for (auto i = 0u; i < sizeof(cases) / sizeof(cases[0]); ++i)
+    {
+      Http2Session session;
+      StartSession(session);
+      auto isReceived = Receive(session, cases[i].frames);
+      auto error = FindGoAwayError(TakeFrames(session));
+      if (isReceived || !session.IsClosing() || error != cases[i].error)
+      {
+        std::printf("  %s: GOAWAY error %lld, expected %d\n", cases[i].name, error, cases[i].error);
+        OLYMPUS_CHECK(!isReceived && session.IsClosing() && error == cases[i].error);
+      }
+    }
+
+    // The preface must be exact, and followed by SETTINGS.
+    {
+      Http2Session session;
+      OLYMPUS_CHECK(!Receive(session, "PRI * HTTP/2.0\r\n\r\nXX\r\n\r\n"));
+      OLYMPUS_CHECK(FindGoAwayError(TakeFrames(session)) == Http2Error::ProtocolError);
+    }
+    {
+      Http2Session session;
+      OLYMPUS_CHECK(!Receive(session,
+        std::string(Http2Session::GetPreface()) + MakeFrame(Http2FrameType::Ping, 0, 0, "12345678")));
+      OLYMPUS_CHECK(FindGoAwayError(TakeFrames(session)) == Http2Error::ProtocolError);
+    }
+
+    // Unknown frame types are ignored, and after a GOAWAY nothing more is read.
+    {
+      Http2Session session;
+      StartSession(session);
+      OLYMPUS_CHECK(Receive(session, MakeFrame(static_cast<Http2FrameType::Value>(0xfa), 0, 1, "abc")));
+      OLYMPUS_CHECK(TakeFrames(session).empty());
+      OLYMPUS_CHECK(!Receive(session, MakeFrame(Http2FrameType::Data, 0, 0, "x")));
+      OLYMPUS_CHECK(!Receive(session, MakeFrame(Http2FrameType::Ping, 0, 0, "12345678")));
+      auto frames = TakeFrames(session);
+      OLYMPUS_CHECK(frames.size() == 1 && frames[0].type == Http2FrameType::GoAway); // the PING is not answered
+    }
+  }
+
+  // A failure queues the GOAWAY behind whatever output is still waiting, and names the last stream opened.
+  void TestHttp2GoAwayKeepsPendingOutput()
+  {
+    Http2Session session;
+    StartSession(session);
+    OLYMPUS_CHECK(Receive(session,
+      MakeFrame(Http2FrameType::Headers, Http2Flag::EndHeaders | Http2Flag::EndStream, 1, MakeRequestBlock())));
+
+    auto request = std::string();
+    auto streamId = 0u;
+    OLYMPUS_CHECK(session.ReadRequest(request, streamId));
+    session.SendResponse(streamId, HttpResponse("{}"));
+
+    OLYMPUS_CHECK(!Receive(session, MakeFrame(Http2FrameType::Data, 0, 0, "x")));
+    auto frames = TakeFrames(session);
+    auto isEnded = false;
+    OLYMPUS_CHECK(frames.size() == 3);
+    OLYMPUS_CHECK(!frames.empty() && frames[0].type == Http2FrameType::Headers);
+    OLYMPUS_CHECK(CountData(frames, 1, isEnded) == 2 && isEnded);
+    OLYMPUS_CHECK(!frames.empty() && frames.back().type == Http2FrameType::GoAway);
+    OLYMPUS_CHECK(!frames.empty() && Http2Session::ReadUint32(frames.back().payload.data()) == 1);
+  }
+
+  // Requests whose fields break RFC 9113 are stream errors: the stream is reset and the connection carries on.
+  void TestHttp2MalformedRequests()
+  {
+    HttpHeaderList const malformedFields[] =
+    {
+      HttpHeaderList(1, HttpHeader("User-Agent", "curl")),
+      HttpHeaderList(1, HttpHeader("x-value", " padded")),
+      HttpHeaderList(1, HttpHeader("connection", "keep-alive")),
+      HttpHeaderList(1, HttpHeader("te", "gzip")),
+      HttpHeaderList(1, HttpHeader(":protocol", "websocket")),
+      HttpHeaderList(1, HttpHeader("content-length", "5")),
+    };
+
+    Http2Session session;
+    StartSession(session);
+    auto streamId = 1u;
+    for (auto i = 0u; i < sizeof(malformedFields) / sizeof(malformedFields[0]); ++i, streamId += 2)
+    {
+      auto flags = static_cast<unsigned char>(Http2Flag::EndHeaders | Http2Flag::EndStream);
+      OLYMPUS_CHECK(Receive(session, MakeFrame(Http2FrameType::Headers, flags, streamId,
+        MakeRequestBlock(malformedFields[i]))));
+
+      auto request = std::string();
+      auto readId = 0u;
+      OLYMPUS_CHECK(!session.ReadRequest(request, readId));
+      OLYMPUS_CHECK(FindResetError(TakeFrames(session), streamId) == Http2Error::ProtocolError);
+    }
+
+    // "te: trailers" is the one connection-specific field allowed.
+    OLYMPUS_CHECK(Receive(session, MakeFrame(Http2FrameType::Headers, Http2Flag::EndHeaders | Http2Flag::EndStream,
+      streamId, MakeRequestBlock(HttpHeaderList(1, HttpHeader("te", "trailers"))))));
+    auto request = std::string();
+    auto readId = 0u;
+    OLYMPUS_CHECK(session.ReadRequest(request, readId) && readId == streamId);
+    OLYMPUS_CHECK(!session.IsClosing());
+  }
+
+  // Trailers end a request whose body came in DATA frames. They are not passed on, and must end the stream.
+  void TestHttp2Trailers()
+  {
+    Http2Session session;
+    StartSession(session);
+
+    OLYMPUS_CHECK(Receive(session,
+      MakeFrame(Http2FrameType::Headers, Http2Flag::EndHeaders, 1,
+        MakeRequestBlock(HttpHeaderList(1, HttpHeader("content-length", "11")))) +
+      MakeFrame(Http2FrameType::Data, 0, 1, "hello ") +
+      MakeFrame(Http2FrameType::Data, Http2Flag::Padded, 1, std::string("\x03" "world", 6) + std::string(3, '\0'))));
+
+    auto request = std::string();
+    auto streamId = 0u;
+    OLYMPUS_CHECK(!session.ReadRequest(request, streamId));
+
+    // Trailers can be split across CONTINUATION frames like any header block.
+    auto trailers = std::string();
+    auto encoder = HpackEncoder();
+    encoder.Encode("x-checksum", "5eb63bbbe01eeed093cb22bb8f5acdc3", trailers);
+    OLYMPUS_CHECK(Receive(session,
+      MakeFrame(Http2FrameType::Headers, Http2Flag::EndStream, 1, trailers.substr(0, 4)) +
+      MakeFrame(Http2FrameType::Continuation, Http2Flag::EndHeaders, 1, trailers.substr(4))));
+    OLYMPUS_CHECK(session.ReadRequest(request, streamId) && streamId == 1);
+    OLYMPUS_CHECK(request.size() > 11 && request.compare(request.size() - 15, 15, "\r\n\r\nhello world") == 0);
+    OLYMPUS_CHECK(request.find("x-checksum") == std::string::npos);
+
+    // Trailers that leave the stream open are a connection error.
+    OLYMPUS_CHECK(Receive(session, MakeFrame(Http2FrameType::Headers, Http2Flag::EndHeaders, 3, MakeRequestBlock())));
+    OLYMPUS_CHECK(!Receive(session, MakeFrame(Http2FrameType::Headers, Http2Flag::EndHeaders, 3, trailers)));
+    OLYMPUS_CHECK(FindGoAwayError(TakeFrames(session)) == Http2Error::ProtocolError);
+  }
+
+  // A response larger than the windows goes out as the client opens them, on the stream and the connection alike.
+  void TestHttp2SendWindows()
+  {
+    Http2Session session;
+    StartSession(session);
+    OLYMPUS_CHECK(Receive(session,
+      MakeFrame(Http2FrameType::Headers, Http2Flag::EndHeaders | Http2Flag::EndStream, 1, MakeRequestBlock())));
+
+    auto request = std::string();
+    auto streamId = 0u;
+    OLYMPUS_CHECK(session.ReadRequest(request, streamId));
+    session.SendResponse(streamId, HttpResponse(std::string(100000, 'x')));
+
+    auto isEnded = false;
+    OLYMPUS_CHECK(CountData(TakeFrames(session), 1, isEnded) == 65535 && !isEnded);
+
+    // The stream's window alone is not enough while the connection's is used up.
+    OLYMPUS_CHECK(Receive(session, MakeFrame(Http2FrameType::WindowUpdate, 0, 1, MakeUint32(50000))));
+    OLYMPUS_CHECK(CountData(TakeFrames(session), 1, isEnded) == 0);
+
+    OLYMPUS_CHECK(Receive(session, MakeFrame(Http2FrameType::WindowUpdate, 0, 0, MakeUint32(20000))));
+    OLYMPUS_CHECK(CountData(TakeFrames(session), 1, isEnded) == 20000 && !isEnded);
+
+    OLYMPUS_CHECK(Receive(session, MakeFrame(Http2FrameType::WindowUpdate, 0, 0, MakeUint32(100000))));
+    OLYMPUS_CHECK(CountData(TakeFrames(session), 1, isEnded) == 14465 && isEnded);
+  }
+
+  // A smaller SETTINGS_INITIAL_WINDOW_SIZE applies to streams already open and can leave their windows negative;
+  // nothing more is sent until WINDOW_UPDATE frames bring them back above zero.
+  void TestHttp2InitialWindowChange()
+  {
+    Http2Session session;
+    StartSession(session, MakeSetting(Http2Setting::InitialWindowSize, 16));
+    OLYMPUS_CHECK(Receive(session,
+      MakeFrame(Http2FrameType::Headers, Http2Flag::EndHeaders | Http2Flag::EndStream, 1, MakeRequestBlock())));
+
+    auto request = std::string();
+    auto streamId = 0u;
+    OLYMPUS_CHECK(session.ReadRequest(request, streamId));
+    session.SendResponse(streamId, HttpResponse(std::string(100, 'x')));
+
+    auto isEnded = false;
+    OLYMPUS_CHECK(CountData(TakeFrames(session), 1, isEnded) == 16);
+
+    OLYMPUS_CHECK(Receive(session,
+      MakeFrame(Http2FrameType::Settings, 0, 0, MakeSetting(Http2Setting::InitialWindowSize, 0))));
+    auto frames = TakeFrames(session);
+    OLYMPUS_CHECK(frames.size() == 1 && frames[0].type == Http2FrameType::Settings && frames[0].flags == Http2Flag::Ack);
+
+    OLYMPUS_CHECK(Receive(session, MakeFrame(Http2FrameType::WindowUpdate, 0, 1, MakeUint32(10))));
+    OLYMPUS_CHECK(CountData(TakeFrames(session), 1, isEnded) == 0); // the window is -16 + 10
+
+    OLYMPUS_CHECK(Receive(session, MakeFrame(Http2FrameType::WindowUpdate, 0, 1, MakeUint32(10))));
+    OLYMPUS_CHECK(CountData(TakeFrames(session), 1, isEnded) == 4);
+
+    OLYMPUS_CHECK(Receive(session,
+      MakeFrame(Http2FrameType::Settings, 0, 0, MakeSetting(Http2Setting::InitialWindowSize, 1000))));
+    OLYMPUS_CHECK(CountData(TakeFrames(session), 1, isEnded) == 80 && isEnded);
+  }
+
+  // Windows may not grow past 2^31-1: a stream that does is reset, and the connection window failing is fatal.
+  void TestHttp2WindowOverflow()
+  {
+    Http2Session session;
+    StartSession(session);
+    OLYMPUS_CHECK(Receive(session, MakeFrame(Http2FrameType::Headers, Http2Flag::EndHeaders, 1, MakeRequestBlock())));
+    OLYMPUS_CHECK(Receive(session, MakeFrame(Http2FrameType::WindowUpdate, 0, 1, MakeUint32(0x7FFFFFFFu))));
+    OLYMPUS_CHECK(FindResetError(TakeFrames(session), 1) == Http2Error::FlowControlError);
+
+    // A WINDOW_UPDATE for a stream that has been closed is ignored.
+    OLYMPUS_CHECK(Receive(session, MakeFrame(Http2FrameType::WindowUpdate, 0, 1, MakeUint32(1))));
+    OLYMPUS_CHECK(TakeFrames(session).empty());
+
+    OLYMPUS_CHECK(!Receive(session, MakeFrame(Http2FrameType::WindowUpdate, 0, 0, MakeUint32(0x7FFFFFFFu))));
+    OLYMPUS_CHECK(FindGoAwayError(TakeFrames(session)) == Http2Error::FlowControlError);
+  }
+
+  // A client may send no more than the windows the server advertised. The connection window is replenished as it
+  // is used; a stream's never is, so a body larger than it is refused.
+  void TestHttp2ReceiveWindows()
+  {
+    Http2Session session;
+    StartSession(session);
+
+    auto chunk = std::string(16384, 'x');
+    auto streamId = 1u;
+    auto sentLength = 0ll;
+    auto isReplenished = false;
+    for (; streamId <= 5; streamId += 2)
+    {
+      OLYMPUS_CHECK(Receive(session,
+        MakeFrame(Http2FrameType::Headers, Http2Flag::EndHeaders, streamId, MakeRequestBlock())));
+      for (auto i = 0; i < 48; ++i) // 768 KiB, within the stream's window
+      {
+        OLYMPUS_CHECK(Receive(session, MakeFrame(Http2FrameType::Data, 0, streamId, chunk)));
+        sentLength += static_cast<long long>(chunk.size());
+      }
+
+      auto frames = TakeFrames(session);
+      for (auto it = frames.begin(); it != frames.end(); ++it)
+      {
+        isReplenished = isReplenished || (it->type == Http2FrameType::WindowUpdate && it->streamId == 0 &&
+          static_cast<long long>(Http2Session::ReadUint32(it->payload.data())) >= Http2Session::ConnectionWindow / 2);
+      }
+      OLYMPUS_CHECK(FindResetError(frames, streamId) == -1);
+    }
+    OLYMPUS_CHECK(sentLength > Http2Session::ConnectionWindow / 2 && isReplenished);
+
+    // 17 more frames take the first stream over its 1 MiB.
+    for (auto i = 0; i < 17; ++i)
+    {
+      OLYMPUS_CHECK(Receive(session, MakeFrame(Http2FrameType::Data, 0, 1, chunk)));
+    }
+    OLYMPUS_CHECK(FindResetError(TakeFrames(session), 1) == Http2Error::FlowControlError);
+
+    // DATA on the stream it reset is answered with STREAM_CLOSED, still counting towards the connection window.
+    OLYMPUS_CHECK(Receive(session, MakeFrame(Http2FrameType::Data, Http2Flag::EndStream, 1, "x")));
+    OLYMPUS_CHECK(FindResetError(TakeFrames(session), 1) == Http2Error::StreamClosed);
+    OLYMPUS_CHECK(!session.IsClosing());
+  }
+
+  // Fragments are joined into one message, whatever their number and however the bytes arrive.
+  void TestWebSocketFragmentedMessages()
+  {
+    auto text =
+      MakeClientFrame(false, WebSocketOpcode::Text, "Hel") +
+      MakeClientFrame(false, WebSocketOpcode::Continuation, std::string()) +
+      MakeClientFrame(false, WebSocketOpcode::Continuation, "lo, ") +
+      MakeClientFrame(true, WebSocketOpcode::Continuation, "world");
+    auto frames = text +
+      MakeClientFrame(false, WebSocketOpcode::Binary, std::string(200, 'b')) +
+      MakeClientFrame(true, WebSocketOpcode::Continuation, "!");
+
+    auto session = WebSocketSession("/chat", 0);
+    OLYMPUS_CHECK(ReadMessages(session, frames) == "text:Hello, world\nbinary:" + std::string(200, 'b') + "!\n");
+    OLYMPUS_CHECK(TakeOutput(session).empty());
+
+    // One byte at a time, nothing is handed out until the last fragment is complete.
+    auto trickled = WebSocketSession("/chat", 0);
+    auto input = ReceiveBuffer();
+    auto message = std::string();
+    auto isBinary = true;
+    auto messageCount = 0u;
+    for (auto i = std::size_t(); i < frames.size(); ++i)
+    {
+      Append(input, frames.substr(i, 1));
+      while (trickled.ReadMessage(input, message, isBinary))
+      {
+        ++messageCount;
+        OLYMPUS_CHECK(messageCount != 1 || (message == "Hello, world" && !isBinary && i + 1 == text.size()));
+        OLYMPUS_CHECK(messageCount != 2 || (message.size() == 201 && isBinary && i + 1 == frames.size()));
+      }
+    }
+    OLYMPUS_CHECK(messageCount == 2);
+
+    // A character split between fragments is only checked once the message is whole.
+    auto split = WebSocketSession("/chat", 0);
+    OLYMPUS_CHECK(ReadMessages(split,
+      MakeClientFrame(false, WebSocketOpcode::Text, "caf\xc3") +
+      MakeClientFrame(true, WebSocketOpcode::Continuation, "\xa9")) == "text:caf\xc3\xa9\n");
+  }
+
+  // Control frames may arrive between the fragments of a message, and are answered without disturbing it.
+  void TestWebSocketControlBetweenFragments()
+  {
+    auto session = WebSocketSession("/chat", 0);
+    OLYMPUS_CHECK(ReadMessages(session,
+      MakeClientFrame(false, WebSocketOpcode::Text, "ab") +
+      MakeClientFrame(true, WebSocketOpcode::Ping, "are you there") +
+      MakeClientFrame(true, WebSocketOpcode::Pong, std::string()) +
+      MakeClientFrame(true, WebSocketOpcode::Continuation, "cd")) == "text:abcd\n");
+    OLYMPUS_CHECK(TakeOutput(session) == *WebSocketSession::EncodeFrame(WebSocketOpcode::Pong, "are you there", 13));
+
+    // A close between fragments ends the session; the partial message is dropped.
+    auto closing = WebSocketSession("/chat", 0);
+    OLYMPUS_CHECK(ReadMessages(closing,
+      MakeClientFrame(false, WebSocketOpcode::Text, "ab") +
+      MakeClientFrame(true, WebSocketOpcode::Close, "\x03\xe8" "bye") +
+      MakeClientFrame(true, WebSocketOpcode::Continuation, "cd")).empty());
+    OLYMPUS_CHECK(TakeOutput(closing) == MakeCloseFrame(WebSocketCloseCode::Normal));
+    OLYMPUS_CHECK(closing.IsFinished());
+  }
+
+  // Text that is not UTF-8 is refused with 1007, whether or not it was fragmented.
+  void TestWebSocketInvalidUtf8()
+  {
+    char const* const invalidTexts[] =
+    {
+      "\xff",
+      "abc\xc3",               // truncated
+      "\xc0\xaf",              // overlong '/'
+      "\xed\xa0\x80",          // surrogate
+      "\xf4\x90\x80\x80",      // past U+10FFFF
+      "plain ascii text\x80",  // continuation byte after the fast path
+    };
+
+    for (auto i = 0u; i < sizeof(invalidTexts) / sizeof(invalidTexts[0]); ++i)
+    {
+      auto session = WebSocketSession("/chat", 0);
+      OLYMPUS_CHECK(ReadMessages(session,
+        MakeClientFrame(true, WebSocketOpcode::Text, invalidTexts[i]) +
+        MakeClientFrame(true, WebSocketOpcode::Text, "never read")).empty());
+      OLYMPUS_CHECK(TakeOutput(session) == MakeCloseFrame(WebSocketCloseCode::InvalidData));
+    }
+
+    auto fragmented = WebSocketSession("/chat", 0);
+    OLYMPUS_CHECK(ReadMessages(fragmented,
+      MakeClientFrame(false, WebSocketOpcode::Text, "ok so far ") +
+      MakeClientFrame(true, WebSocketOpcode::Continuation, "\xed\xbf\xbf")).empty());
+    OLYMPUS_CHECK(TakeOutput(fragmented) == MakeCloseFrame(WebSocketCloseCode::InvalidData));
+
+    // Binary messages are not checked.
+    auto binary = WebSocketSession("/chat", 0);
+    OLYMPUS_CHECK(ReadMessages(binary, MakeClientFrame(true, WebSocketOpcode::Binary, "\xff")) == "binary:\xff\n");
+  }
+
+  // A frame that would take the message past MaxMessageLength is refused with 1009 as soon as its header arrives.
+  void TestWebSocketOversizedFrames()
+  {
+    // A 64-bit length for one byte more than the limit, with none of the payload sent.
+    auto header = std::string("\x82\xff", 2);
+    for (auto shift = 56; shift >= 0; shift -= 8)
+    {
+      header.push_back(static_cast<char>((static_cast<unsigned long long>(WebSocketSession::MaxMessageLength + 1) >>
+        shift) & 0xFF));
+    }
+    header += "mask";
+
+    auto session = WebSocketSession("/upload", 0);
+    OLYMPUS_CHECK(ReadMessages(session, header).empty());
+    OLYMPUS_CHECK(TakeOutput(session) == MakeCloseFrame(WebSocketCloseCode::MessageTooBig));
+
+    // Fragments are limited by their total, not each on its own: 1 MiB more after 100000 bytes is too much.
+    auto fragmented = WebSocketSession("/upload", 0);
+    OLYMPUS_CHECK(ReadMessages(fragmented,
+      MakeClientFrame(false, WebSocketOpcode::Binary, std::string(50000, 'x')) +
+      MakeClientFrame(false, WebSocketOpcode::Continuation, std::string(50000, 'x'))).empty());
+    auto input = ReceiveBuffer();
+    Append(input, std::string("\x00\xff", 2) + std::string(4, '\0') + std::string("\x00\x10\x00\x00", 4) + "mask");
+    auto message = std::string();
+    auto isBinary = false;
+    OLYMPUS_CHECK(!fragmented.ReadMessage(input, message, isBinary));
+    OLYMPUS_CHECK(TakeOutput(fragmented) == MakeCloseFrame(WebSocketCloseCode::MessageTooBig));
+
+    // Exactly the limit is accepted.
+    auto half = std::string(WebSocketSession::MaxMessageLength / 2, 'x');
+    auto atLimit = WebSocketSession("/upload", 0);
+    auto messages = ReadMessages(atLimit,
+      MakeClientFrame(false, WebSocketOpcode::Binary, half) + MakeClientFrame(true, WebSocketOpcode::Continuation, half));
+    OLYMPUS_CHECK(messages.size() == std::strlen("binary:\n") + WebSocketSession::MaxMessageLength);
+
+    // Control frames are limited to 125 bytes.
+    auto control = WebSocketSession("/upload", 0);
+    OLYMPUS_CHECK(ReadMessages(control, MakeClientFrame(true, WebSocketOpcode::Ping, std::string(126, 'p'))).empty());
+    OLYMPUS_CHECK(TakeOutput(control) == MakeCloseFrame(WebSocketCloseCode::ProtocolError));
+  }
+
+  // Frames that break the framing rules are refused with 1002, and nothing after them is read.
+  void TestWebSocketProtocolErrors()
+  {
+    std::string const invalidFrames[] =
+    {
+      MakeClientFrame(true, WebSocketOpcode::Text, "unmasked", false),
+      std::string("\xc1\x80mask", 6), // RSV1 set with no extension negotiated
+      MakeClientFrame(true, static_cast<WebSocketOpcode::Value>(0x3), "reserved opcode"),
+      MakeClientFrame(true, static_cast<WebSocketOpcode::Value>(0xB), "reserved control opcode"),
+      MakeClientFrame(true, WebSocketOpcode::Continuation, "nothing to continue"),
+      MakeClientFrame(false, WebSocketOpcode::Text, "a") + MakeClientFrame(true, WebSocketOpcode::Text, "b"),
+      MakeClientFrame(false, WebSocketOpcode::Ping, "fragmented control"),
+      MakeClientFrame(true, WebSocketOpcode::Close, "\x03"), // a one-byte close payload
+    };
+
+    for (auto i = 0u; i < sizeof(invalidFrames) / sizeof(invalidFrames[0]); ++i)
+    {
+      auto session = WebSocketSession("/chat", 0);
+      OLYMPUS_CHECK(ReadMessages(session,
+        invalidFrames[i] + MakeClientFrame(true, WebSocketOpcode::Text, "after")).empty());
+      OLYMPUS_CHECK(TakeOutput(session) == MakeCloseFrame(WebSocketCloseCode::ProtocolError));
+      OLYMPUS_CHECK(session.IsFinished());
+    }
+  }
+
+  // Unmask must match a plain XOR for every length, including the tails after the 16-byte blocks, and for data
+  // at any alignment.
+  void TestWebSocketUnmask()
+  {
+    static unsigned char const mask[4] = { 0xa5, 0x01, 0xfe, 0x7c };
+
+    for (auto offset = 0u; offset < 4; ++offset)
+    {
+      for (auto length = 0u; length <= 67; ++length)
+      {
+        auto buffer = std::string(offset + length, '\0');
+        for (auto i = 0u; i < buffer.size(); ++i)
+        {
+          buffer[i] = static_cast<char>(i * 7 + 3);
+        }
+
+        auto expected = buffer;
+        for (auto i = 0u; i < length; ++i)
+        {
+          expected[offset + i] = static_cast<char>(expected[offset + i] ^ mask[i % 4]);
+        }
+
+        WebSocketSession::Unmask(&buffer[0] + offset, length, mask);
+        if (buffer != expected)
+        {
+          std::printf("  offset %u, length %u\n", offset, length);
+          OLYMPUS_CHECK(buffer == expected);
+        }
+      }
+    }
+  }
+
+  // Only the request that was let through to probe an upstream out of rotation ends the probe. Requests that were
+  // already outstanding when it failed finish without letting a second probe in.
+  void TestUpstreamProbeOwnership()
+  {
+    auto path = MakeSocketPath("probe");
+    auto listener = TcpSocket();
+    listener.Open(Endpoint::Unix(path), true);
+
+    auto options = ProxyOptions();
+    options.failTimeoutSeconds = 0;
+    options.maxFailures = 1;
+    Upstream upstream(Endpoint::Unix(path), options);
+    auto now = 1000ll;
+
+    auto earlier = UpstreamConnection();
+    auto isEarlierReused = false;
+    auto isEarlierProbe = false;
+    OLYMPUS_CHECK(upstream.Acquire(earlier, isEarlierReused, isEarlierProbe));
+    OLYMPUS_CHECK(!isEarlierProbe);
+
+    auto failed = UpstreamConnection();
+    auto isFailedReused = false;
+    auto isFailedProbe = false;
+    OLYMPUS_CHECK(upstream.Acquire(failed, isFailedReused, isFailedProbe));
+    upstream.OnFailure(now, isFailedProbe);
+    upstream.Release(failed, false, isFailedProbe, now);
+    OLYMPUS_CHECK(!upstream.IsHealthy());
+    OLYMPUS_CHECK(upstream.IsAvailable(now));
+
+    auto probe = UpstreamConnection();
+    auto isProbeReused = false;
+    auto isProbe = false;
+    OLYMPUS_CHECK(upstream.Acquire(probe, isProbeReused, isProbe));
+    OLYMPUS_CHECK(isProbe);
+    OLYMPUS_CHECK(!upstream.IsAvailable(now));
+
+    // The earlier request failing, or just finishing, says nothing about the probe.
+    upstream.OnFailure(now, isEarlierProbe);
+    OLYMPUS_CHECK(!upstream.IsAvailable(now));
+    upstream.Release(earlier, false, isEarlierProbe, now);
+    OLYMPUS_CHECK(!upstream.IsAvailable(now));
+
+    // The probe ending without a verdict lets the next request try.
+    upstream.Release(probe, false, isProbe, now);
+    OLYMPUS_CHECK(!isProbe);
+    OLYMPUS_CHECK(upstream.IsAvailable(now));
+    OLYMPUS_CHECK(upstream.GetOutstanding() == 0);
+
+    // A probe that succeeds brings the upstream back.
+    OLYMPUS_CHECK(upstream.Acquire(probe, isProbeReused, isProbe));
+    OLYMPUS_CHECK(isProbe);
+    upstream.OnSuccess(isProbe);
+    OLYMPUS_CHECK(upstream.IsHealthy());
+    upstream.Release(probe, false, isProbe, now);
+
+    listener.Close();
+    unlink(path.c_str());
+  }
+
+  // Hop-by-hop headers, including those a Connection header names, are dropped in both directions, and the
+  // client's address is added to any X-Forwarded-For and Forwarded the request came with.
+  void TestProxyHopByHopHeaders()
+  {
+    StubUpstream stub("hop-by-hop");
+    ReverseProxy proxy;
+    AddStubRoute(proxy, stub);
+
+    auto client = ProxyClient();
+    client.Start(proxy,
+      "GET /a HTTP/1.1\r\n"
+      "Host: example.com\r\n"
+      "Connection: keep-alive, X-Session-Hint\r\n"
+      "X-Session-Hint: 7\r\n"
+      "Keep-Alive: timeout=5\r\n"
+      "X-Forwarded-For: 198.51.100.1\r\n"
+      "X-Request-ID: 42\r\n"
+      "\r\n",
+      Endpoint::Ipv4("192.0.2.7", 40000));
+    OLYMPUS_CHECK(stub.Accept());
+    auto request = stub.Receive();
+    OLYMPUS_CHECK(request ==
+      "GET /a HTTP/1.1\r\n"
+      "Host: example.com\r\n"
+      "X-Request-ID: 42\r\n"
+      "Forwarded: for=192.0.2.7\r\n"
+      "X-Forwarded-For: 198.51.100.1, 192.0.2.7\r\n"
+      "\r\n");
+
+    stub.Send(
+      "HTTP/1.1 200 OK\r\n"
+      "Connection: X-Backend-Hop\r\n"
+      "X-Backend-Hop: 1\r\n"
+      "Content-Length: 2\r\n"
+      "\r\n"
+      "ok");
+    OLYMPUS_CHECK(client.Update() == ProxyStatus::Finished);
+    OLYMPUS_CHECK(client.received == "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok");
+  }
+
+  // IPv6 clients are quoted in Forwarded, and clients on Unix sockets have no address to add.
+  void TestProxyForwardedFor()
+  {
+    StubUpstream stub("forwarded-for");
+    ReverseProxy proxy;
+    AddStubRoute(proxy, stub);
+
+    auto ipv6 = ProxyClient();
+    ipv6.Start(proxy, "GET / HTTP/1.1\r\nForwarded: for=198.51.100.1\r\n\r\n", Endpoint::Ipv6("2001:db8::7", 40000));
+    OLYMPUS_CHECK(stub.Accept());
+    OLYMPUS_CHECK(stub.Receive() ==
+      "GET / HTTP/1.1\r\n"
+      "Forwarded: for=198.51.100.1, for=\"[2001:db8::7]\"\r\n"
+      "X-Forwarded-For: 2001:db8::7\r\n"
+      "\r\n");
+
+    auto local = ProxyClient();
+    local.Start(proxy, "GET / HTTP/1.1\r\n\r\n", Endpoint::Unix("/run/client.sock"));
+    OLYMPUS_CHECK(stub.Accept());
+    OLYMPUS_CHECK(stub.Receive() == "GET / HTTP/1.1\r\n\r\n");
+  }
+
+  // A Content-Length body larger than the exchange buffers is relayed whole as it arrives, and the connection
+  // goes back to the pool. One cut short closes the client connection.
+  void TestProxyContentLength()
+  {
+    StubUpstream stub("content-length");
+    ReverseProxy proxy;
+    AddStubRoute(proxy, stub);
+    auto& upstream = *proxy.GetUpstreams()[0];
+
+    auto client = ProxyClient();
+    client.Start(proxy, "GET /big HTTP/1.1\r\n\r\n");
+    OLYMPUS_CHECK(stub.Accept());
+    OLYMPUS_CHECK(stub.Receive() == "GET /big HTTP/1.1\r\n\r\n");
+
+    auto response = "HTTP/1.1 200 OK\r\nContent-Length: 300000\r\n\r\n" + std::string(300000, 'b');
+    auto offset = std::size_t();
+    for (auto i = 0; i < 10000 && client.status == ProxyStatus::Forwarding; ++i)
+    {
+      offset += stub.connection.SendSome(response, offset);
+      client.Update();
+    }
+    OLYMPUS_CHECK(client.status == ProxyStatus::Finished);
+    OLYMPUS_CHECK(client.received == response);
+    OLYMPUS_CHECK(upstream.GetIdleCount() == 1);
+    OLYMPUS_CHECK(upstream.GetOutstanding() == 0);
+
+    auto cut = ProxyClient();
+    cut.Start(proxy, "GET /cut HTTP/1.1\r\n\r\n");
+    OLYMPUS_CHECK(stub.Receive() == "GET /cut HTTP/1.1\r\n\r\n");
+    stub.Send("HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nshort");
+    stub.connection.Close();
+    OLYMPUS_CHECK(UpdateUntilDone(cut) == ProxyStatus::Closing);
+    OLYMPUS_CHECK(cut.received == "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nshort");
+    OLYMPUS_CHECK(upstream.GetIdleCount() == 0);
+  }
+
+  // A chunked body is relayed in its own framing, however its pieces arrive.
+  void TestProxyChunked()
+  {
+    StubUpstream stub("chunked");
+    ReverseProxy proxy;
+    AddStubRoute(proxy, stub);
+
+    auto client = ProxyClient();
+    client.Start(proxy, "GET /chunked HTTP/1.1\r\n\r\n");
+    OLYMPUS_CHECK(stub.Accept());
+    stub.Receive();
+
+    char const* const pieces[] =
+    {
+      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r",
+      "\nhel",
+      "lo\r\n1",
+      "0\r\n0123456789abcdef\r\n0\r\nX-Checksum: 9\r\n",
+      "\r\n"
+    };
+    auto response = std::string();
+    for (auto i = 0u; i < sizeof(pieces) / sizeof(pieces[0]); ++i)
+    {
+      OLYMPUS_CHECK(client.status == ProxyStatus::Forwarding);
+      stub.Send(pieces[i]);
+      response += pieces[i];
+      client.Update();
+    }
+    OLYMPUS_CHECK(client.status == ProxyStatus::Finished);
+    OLYMPUS_CHECK(client.received == response);
+    OLYMPUS_CHECK(proxy.GetUpstreams()[0]->GetIdleCount() == 1);
+  }
+
+  // A body without a length ends when the upstream closes. The client is told the connection closes too, since
+  // that is the only way it can find the end.
+  void TestProxyCloseDelimited()
+  {
+    StubUpstream stub("close-delimited");
+    ReverseProxy proxy;
+    AddStubRoute(proxy, stub);
+
+    auto client = ProxyClient();
+    client.Start(proxy, "GET /close HTTP/1.1\r\n\r\n");
+    OLYMPUS_CHECK(stub.Accept());
+    stub.Receive();
+
+    stub.Send("HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\nfirst ");
+    OLYMPUS_CHECK(client.Update() == ProxyStatus::Forwarding);
+    stub.Send("second");
+    stub.connection.Close();
+    OLYMPUS_CHECK(UpdateUntilDone(client) == ProxyStatus::Closing);
+    OLYMPUS_CHECK(client.received ==
+      "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\nfirst second");
+    OLYMPUS_CHECK(proxy.GetUpstreams()[0]->GetIdleCount() == 0);
+    OLYMPUS_CHECK(proxy.GetUpstreams()[0]->IsHealthy());
+  }
+
+  // An upstream that closes a pooled connection while it sits idle is not failing: the request goes out again
+  // on a new connection, a POST without a body included, since the upstream cannot have seen it.
+  void TestProxyStaleConnection()
+  {
+    StubUpstream stub("stale");
+    ReverseProxy proxy;
+    auto options = ProxyOptions();
+    options.maxFailures = 1;
+    AddStubRoute(proxy, stub, options);
+    auto& upstream = *proxy.GetUpstreams()[0];
+
+    char const* const requests[] = { "GET /first HTTP/1.1\r\n\r\n", "POST /second HTTP/1.1\r\n\r\n" };
+    for (auto i = 0u; i < sizeof(requests) / sizeof(requests[0]); ++i)
+    {
+      auto first = ProxyClient();
+      first.Start(proxy, "GET /warm HTTP/1.1\r\n\r\n");
+      OLYMPUS_CHECK(stub.Accept());
+      stub.Receive();
+      stub.Send("HTTP/1.1 204 No Content\r\n\r\n");
+      OLYMPUS_CHECK(UpdateUntilDone(first) == ProxyStatus::Finished);
+      OLYMPUS_CHECK(upstream.GetIdleCount() == 1);
+
+      // The upstream's idle timeout runs out before the proxy's.
+      stub.connection.Close();
+
+      auto retried = ProxyClient();
+      retried.Start(proxy, requests[i]);
+      UpdateUntilDone(retried, 3);
+      OLYMPUS_CHECK(stub.Accept());
+      OLYMPUS_CHECK(stub.Receive() == requests[i]);
+      stub.Send("HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok");
+      OLYMPUS_CHECK(UpdateUntilDone(retried) == ProxyStatus::Finished);
+      OLYMPUS_CHECK(retried.received == "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok");
+      OLYMPUS_CHECK(upstream.IsHealthy());
+      stub.connection.Close();
+      upstream.Update(first.now + TraceClock::FromMicroseconds(3600e6)); // empties the pool
+    }
+  }
+
+  // An upstream that drops the connection without answering gets one retry for a request without a body, then
+  // the client is told 502 Bad Gateway. A request with a body is not sent twice.
+  void TestProxyBadGateway()
+  {
+    StubUpstream stub("bad-gateway");
+    ReverseProxy proxy;
+    auto options = ProxyOptions();
+    options.maxFailures = 10;
+    AddStubRoute(proxy, stub, options);
+
+    auto client = ProxyClient();
+    client.Start(proxy, "GET /drop HTTP/1.1\r\n\r\n");
+    for (auto i = 0; i < 2; ++i)
+    {
+      OLYMPUS_CHECK(stub.Accept());
+      OLYMPUS_CHECK(stub.Receive() == "GET /drop HTTP/1.1\r\n\r\n");
+      stub.connection.Close();
+      UpdateUntilDone(client, 3);
+    }
+    OLYMPUS_CHECK(client.status == ProxyStatus::Finished);
+    OLYMPUS_CHECK(StartsWith(client.received, "HTTP/1.1 502 Bad Gateway\r\n"));
+    OLYMPUS_CHECK(!stub.Accept());
+
+    auto post = ProxyClient();
+    post.Start(proxy, "POST /drop HTTP/1.1\r\nContent-Length: 4\r\n\r\n", Endpoint(), "data");
+    OLYMPUS_CHECK(stub.Accept());
+    OLYMPUS_CHECK(stub.Receive() == "POST /drop HTTP/1.1\r\nContent-Length: 4\r\n\r\ndata");
+    stub.connection.Close();
+    OLYMPUS_CHECK(UpdateUntilDone(post, 3) == ProxyStatus::Finished);
+    OLYMPUS_CHECK(StartsWith(post.received, "HTTP/1.1 502 Bad Gateway\r\n"));
+    OLYMPUS_CHECK(!stub.Accept());
+
+    auto garbage = ProxyClient();
+    garbage.Start(proxy, "POST /garbage HTTP/1.1\r\n\r\n");
+    OLYMPUS_CHECK(stub.Accept());
+    stub.Receive();
+    stub.Send("SSH-2.0-OpenSSH_9.6\r\n\r\n");
+    OLYMPUS_CHECK(UpdateUntilDone(garbage, 3) == ProxyStatus::Finished);
+    OLYMPUS_CHECK(StartsWith(garbage.received, "HTTP/1.1 502 Bad Gateway\r\n"));
+  }
+
+  // With nothing listening, connections fail at once and the client is told 503 Service Unavailable. After
+  // maxFailures the upstream is out of rotation and not even tried.
+  void TestProxyServiceUnavailable()
+  {
+    auto path = MakeSocketPath("service-unavailable");
+    ReverseProxy proxy;
+    auto options = ProxyOptions();
+    options.maxFailures = 2;
+    options.splice = false;
+    proxy.AddRoute("/", std::vector<Endpoint>(1, Endpoint::Unix(path)), options);
+
+    auto client = ProxyClient();
+    OLYMPUS_CHECK(client.Start(proxy, "GET / HTTP/1.1\r\n\r\n") == ProxyStatus::Finished);
+    OLYMPUS_CHECK(StartsWith(client.received, "HTTP/1.1 503 Service Unavailable\r\n"));
+    OLYMPUS_CHECK(!proxy.GetUpstreams()[0]->IsHealthy());
+    OLYMPUS_CHECK(!proxy.GetUpstreams()[0]->IsAvailable(client.now));
+    OLYMPUS_CHECK(proxy.PickUpstream(0, client.now) == NULL);
+  }
+
+  // An upstream that says nothing within responseTimeoutSeconds gets 504 Gateway Timeout, and no retry.
+  void TestProxyGatewayTimeout()
+  {
+    StubUpstream stub("gateway-timeout");
+    ReverseProxy proxy;
+    auto options = ProxyOptions();
+    options.responseTimeoutSeconds = 5;
+    AddStubRoute(proxy, stub, options);
+
+    auto client = ProxyClient();
+    client.Start(proxy, "GET /slow HTTP/1.1\r\n\r\n");
+    OLYMPUS_CHECK(stub.Accept());
+    stub.Receive();
+    client.now += TraceClock::FromMicroseconds(4e6);
+    OLYMPUS_CHECK(client.Update() == ProxyStatus::Forwarding);
+    client.now += TraceClock::FromMicroseconds(2e6);
+    OLYMPUS_CHECK(client.Update() == ProxyStatus::Finished);
+    OLYMPUS_CHECK(StartsWith(client.received, "HTTP/1.1 504 Gateway Timeout\r\n"));
+    OLYMPUS_CHECK(!stub.Accept());
+    OLYMPUS_CHECK(proxy.GetUpstreams()[0]->GetOutstanding() == 0);
+  }
+
+  // Responses to HEAD, and 204 and 304 responses, have no body whatever their Content-Length says, so the
+  // exchange finishes with the headers and the connection is reused.
+  void TestProxyResponsesWithoutBody()
+  {
+    StubUpstream stub("without-body");
+    ReverseProxy proxy;
+    AddStubRoute(proxy, stub);
+
+    char const* const exchanges[][2] =
+    {
+      { "HEAD /file HTTP/1.1\r\n\r\n", "HTTP/1.1 200 OK\r\nContent-Length: 1000\r\n\r\n" },
+      { "GET /file HTTP/1.1\r\nIf-None-Match: \"v1\"\r\n\r\n", "HTTP/1.1 304 Not Modified\r\nContent-Length: 1000\r\n\r\n" },
+      { "HEAD /stream HTTP/1.1\r\n\r\n", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n" },
+      { "DELETE /file HTTP/1.1\r\n\r\n", "HTTP/1.1 204 No Content\r\n\r\n" }
+    };
+    for (auto i = 0u; i < sizeof(exchanges) / sizeof(exchanges[0]); ++i)
+    {
+      auto client = ProxyClient();
+      client.Start(proxy, exchanges[i][0]);
+      if (i == 0)
+      {
+        OLYMPUS_CHECK(stub.Accept());
+      }
+      OLYMPUS_CHECK(stub.Receive() == exchanges[i][0]);
+      stub.Send(exchanges[i][1]);
+      OLYMPUS_CHECK(client.Update() == ProxyStatus::Finished);
+      OLYMPUS_CHECK(client.received == exchanges[i][1]);
+      OLYMPUS_CHECK(proxy.GetUpstreams()[0]->GetIdleCount() == 1);
+    }
+    OLYMPUS_CHECK(!stub.Accept());
+  }
+
+  class TestCase
+  {
+  public: // data
+
+    char const* name;
+    void (*run)();
+  };
+
+  TestCase const testCases[] =
+  {
+    { "hpack-field-representations", TestHpackFieldRepresentations },
+    { "hpack-request-examples", TestHpackRequestExamples },
+    { "hpack-response-examples", TestHpackResponseExamples },
+    { "hpack-table-size-updates", TestHpackTableSizeUpdates },
+    { "hpack-huffman", TestHpackHuffman },
+    { "http2-malformed-frames", TestHttp2MalformedFrames },
+    { "http2-goaway-keeps-pending-output", TestHttp2GoAwayKeepsPendingOutput },
+    { "http2-malformed-requests", TestHttp2MalformedRequests },
+    { "http2-trailers", TestHttp2Trailers },
+    { "http2-send-windows", TestHttp2SendWindows },
+    { "http2-initial-window-change", TestHttp2InitialWindowChange },
+    { "http2-window-overflow", TestHttp2WindowOverflow },
+    { "http2-receive-windows", TestHttp2ReceiveWindows },
+    { "proxy-hop-by-hop-headers", TestProxyHopByHopHeaders },
+    { "proxy-forwarded-for", TestProxyForwardedFor },
+    { "proxy-content-length", TestProxyContentLength },
+    { "proxy-chunked", TestProxyChunked },
+    { "proxy-close-delimited", TestProxyCloseDelimited },
+    { "proxy-stale-connection", TestProxyStaleConnection },
+    { "proxy-bad-gateway", TestProxyBadGateway },
+    { "proxy-service-unavailable", TestProxyServiceUnavailable },
+    { "proxy-gateway-timeout", TestProxyGatewayTimeout },
+    { "proxy-responses-without-body", TestProxyResponsesWithoutBody },
+    { "request-header-case", TestRequestHeaderCase },
+    { "request-headers-match-across-protocols", TestRequestHeadersMatchAcrossProtocols },
+    { "upstream-probe-ownership", TestUpstreamProbeOwnership },
+    { "websocket-fragmented-messages", TestWebSocketFragmentedMessages },
+    { "websocket-control-between-fragments", TestWebSocketControlBetweenFragments },
+    { "websocket-invalid-utf8", TestWebSocketInvalidUtf8 },
+    { "websocket-oversized-frames", TestWebSocketOversizedFrames },
+    { "websocket-protocol-errors", TestWebSocketProtocolErrors },
+    { "websocket-unmask", TestWebSocketUnmask },
+  };
+}
+
+// Runs every test, or only those whose names start with one of the arguments. Returns nonzero if any check failed.
+int main(int argc, char** argv)
+{
+  auto runCount = 0u;
+  auto failedCount = 0u;
+  for (auto i = 0u; i < sizeof(testCases) / sizeof(testCases[0]); ++i)
+  {
+    auto& testCase = testCases[i];
+    auto isSelected = argc < 2;
+    for (auto j = 1; j < argc && !isSelected; ++j)
+    {
+      isSelected = std::strncmp(testCase.name, argv[j], std::strlen(argv[j])) == 0;
+    }
+    if (!isSelected)
+    {
+      continue;
+    }
+
+    auto failuresBefore = failureCount;
+    std::printf("%s\n", testCase.name);
+    testCase.run();
+    ++runCount;
+    if (failureCount != failuresBefore)
+    {
+      ++failedCount;
+    }
+  }
+
+  std::printf("%u of %u tests passed\n", runCount - failedCount, runCount);
+  return failedCount == 0 ? 0 : 1;
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <functional>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#include <process.h>
+#define OLYMPUS_THREAD_LOCAL __declspec(thread)
+#else
+#include <pthread.h>
+#define OLYMPUS_THREAD_LOCAL __thread
+#endif
+
+namespace OlympusWebServer
+{
+  class Atomic
+  {
+  public: // methods
+
+    static long Increment(long volatile& value)
+    {
+#ifdef _WIN32
+      return InterlockedIncrement(&value);
+#else
+      return __sync_add_and_fetch(&value, 1);
+#endif
+    }
+
+    static long Load(long volatile const& value)
+    {
+#ifdef _WIN32
+      return value; // volatile reads have acquire semantics under /volatile:ms
+#else
+      return __atomic_load_n(&value, __ATOMIC_ACQUIRE);
+#endif
+    }
+
+    static void Store(long volatile& value, long newValue)
+    {
+#ifdef _WIN32
+      InterlockedExchange(&value, newValue);
+#else
+      __atomic_store_n(&value, newValue, __ATOMIC_RELEASE);
+#endif
+    }
+  };
+
+  class Mutex
+  {
+  private: // data
+
+#ifdef _WIN32
+    CRITICAL_SECTION criticalSection;
+#else
+    pthread_mutex_t mutex;
+#endif
+
+  public: // methods
+
+    Mutex()
+    {
+#ifdef _WIN32
+      InitializeCriticalSection(&criticalSection);
+#else
+      pthread_mutex_init(&mutex, NULL);
+#endif
+    }
+
+    ~Mutex()
+    {
+#ifdef _WIN32
+      DeleteCriticalSection(&criticalSection);
+#else
+      pthread_mutex_destroy(&mutex);
+#endif
+    }
+
+    void Lock()
+    {
+#ifdef _WIN32
+      EnterCriticalSection(&criticalSection);
+#else
+      pthread_mutex_lock(&mutex);
+#endif
+    }
+
+    void Unlock()
+    {
+#ifdef _WIN32
+      LeaveCriticalSection(&criticalSection);
+#else
+      pthread_mutex_unlock(&mutex);
+#endif
+    }
+
+  private: // methods
+
+    Mutex(Mutex const&);
+    Mutex& operator=(Mutex const&);
+  };
+
+  class MutexLock
+  {
+  private: // data
+
+    Mutex& mutex;
+
+  public: // methods
+
+    explicit MutexLock(Mutex& mutex_) :
+      mutex(mutex_)
+    {
+      mutex.Lock();
+    }
+
+    ~MutexLock()
+    {
+      mutex.Unlock();
+    }
+
+  private: // methods
+
+    MutexLock(MutexLock const&);
+    MutexLock& operator=(MutexLock const&);
+  };
+
+  class Thread
+  {
+  private: // data
+
+    std::function<void()> function;
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    bool isJoinable;
+
+  public: // methods
+
+    explicit Thread(std::function<void()> function_) :
+      function(std::move(function_)),
+      isJoinable(false)
+    {
+#ifdef _WIN32
+      handle = reinterpret_cast<HANDLE>(_beginthreadex(NULL, 0, &Thread::Run, this, 0, NULL));
+      isJoinable = handle != 0;
+#else
+      isJoinable = pthread_create(&handle, NULL, &Thread::Run, this) == 0;
+#endif
+      if (!isJoinable)
+      {
+        throw std::runtime_error("Thread.Thread - Unable to start thread");
+      }
+    }
+
+    ~Thread()
+    {
+      Join();
+    }
+
+    void Join()
+    {
+      if (!isJoinable)
+      {
+        return;
+      }
+
+#ifdef _WIN32
+      WaitForSingleObject(handle, INFINITE);
+      CloseHandle(handle);
+#else
+      pthread_join(handle, NULL);
+#endif
+      isJoinable = false;
+    }
+
+  private: // methods
+
+    Thread(Thread const&);
+    Thread& operator=(Thread const&);
+
+#ifdef _WIN32
+    static unsigned __stdcall Run(void* thread)
+    {
+      static_cast<Thread*>(thread)->function();
+      return 0;
+    }
+#else
+    static void* Run(void* thread)
+    {
+      static_cast<Thread*>(thread)->function();
+      return NULL;
+    }
+#endif
+  };
+} // namespace OlympusWebServer
\ No newline at end of file
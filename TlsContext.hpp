@@ -0,0 +1,149 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include "Threading.hpp"
+#include "TlsOptions.hpp"
+
+#ifdef OLYMPUS_TLS
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#else
+typedef struct ssl_ctx_st SSL_CTX;
+#endif
+
+namespace OlympusWebServer
+{
+  // A server's TLS configuration: its certificate, and the session cache and ticket keys that every connection made
+  // from it shares. One context can be shared by listeners on any number of threads, so a client resumes its
+  // session whichever worker accepts it next.
+  //
+  // OpenSSL writes to the socket with write(2), which has no MSG_NOSIGNAL, so a client that goes away mid-response
+  // raises SIGPIPE. A process serving TLS must ignore SIGPIPE itself, as Main.cpp does; this class leaves process-wide
+  // signal handling alone. Kernel TLS sends go through send with MSG_NOSIGNAL and are not affected.
+  class TlsContext
+  {
+  private: // data
+
+    SSL_CTX* context;
+    long volatile kernelSendCount;
+
+  public: // methods
+
+    // Throws if the certificate or key cannot be loaded, or if TLS support was not compiled in.
+    explicit TlsContext(TlsOptions const& options) :
+      context(NULL),
+      kernelSendCount(0)
+    {
+#ifndef OLYMPUS_TLS
+      (void) options;
+      throw std::runtime_error("TlsContext.TlsContext - Built without TLS support; define OLYMPUS_TLS");
+#else
+      context = SSL_CTX_new(TLS_server_method());
+      if (context == NULL)
+      {
+        throw std::runtime_error("TlsContext.TlsContext - Unable to create an OpenSSL context");
+      }
+
+      SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+
+      if (SSL_CTX_use_certificate_chain_file(context, options.certificateFile.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(context, options.privateKeyFile.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(context) != 1)
+      {
+        auto error = GetErrorString();
+        SSL_CTX_free(context);
+        throw std::runtime_error("TlsContext.TlsContext - Unable to load " + options.certificateFile + " and " +
+          options.privateKeyFile + ": " + error);
+      }
+
+      // Partial writes let a non-blocking send return what fit, like send(2) does, and moving write buffers let the
+      // caller retry from a string it has since erased the sent bytes from. Released buffers mean an idle
+      // connection holds none of OpenSSL's 16 KB record buffers, and read-ahead takes everything the socket has
+      // in one recv instead of one per record header and body.
+      SSL_CTX_set_mode(context,
+        SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+      SSL_CTX_set_read_ahead(context, 1);
+
+      static const unsigned char sessionIdContext[] = "rs-webserver";
+      SSL_CTX_set_session_id_context(context, sessionIdContext, sizeof(sessionIdContext) - 1);
+      SSL_CTX_set_session_cache_mode(context, options.sessionCacheSize > 0 ? SSL_SESS_CACHE_SERVER : SSL_SESS_CACHE_OFF);
+      SSL_CTX_sess_set_cache_size(context, options.sessionCacheSize);
+      SSL_CTX_set_timeout(context, options.sessionTimeoutSeconds);
+
+      if (!options.sessionTickets)
+      {
+        SSL_CTX_set_options(context, SSL_OP_NO_TICKET);
+      }
+
+#ifdef SSL_OP_ENABLE_KTLS
+      if (options.kernelTls)
+      {
+        SSL_CTX_set_options(context, SSL_OP_ENABLE_KTLS);
+      }
+#endif
+
+      SSL_CTX_set_alpn_select_cb(context, &SelectProtocol, NULL);
+#endif
+    }
+
+    ~TlsContext()
+    {
+#ifdef OLYMPUS_TLS
+      if (context != NULL)
+      {
+        SSL_CTX_free(context);
+      }
+#endif
+    }
+
+    SSL_CTX* GetHandle() const
+    {
+      return context;
+    }
+
+    // Connections whose sends were handed to kTLS after their handshake.
+    long GetKernelSendCount() const
+    {
+      return Atomic::Load(kernelSendCount);
+    }
+
+    // Called by each connection whose handshake enabled kTLS for sending.
+    void OnKernelSend()
+    {
+      Atomic::Increment(kernelSendCount);
+    }
+
+  private: // methods
+
+    TlsContext(TlsContext const&);
+    TlsContext& operator=(TlsContext const&);
+
+#ifdef OLYMPUS_TLS
+    static std::string GetErrorString()
+    {
+      char text[256] = {};
+      ERR_error_string_n(ERR_get_error(), text, sizeof(text));
+      ERR_clear_error();
+      return text;
+    }
+
+    // ALPN: prefer HTTP/2, which the connection detects from its preface, and fall back to HTTP/1.1. A client that
+    // offers neither is served HTTP/1.1 without an ALPN answer.
+    static int SelectProtocol(
+      SSL*,
+      unsigned char const** selected,
+      unsigned char* selectedLength,
+      unsigned char const* offered,
+      unsigned offeredLength,
+      void*)
+    {
+      static const unsigned char supported[] = "\x02h2\x08http/1.1";
+      auto result = SSL_select_next_proto(
+        const_cast<unsigned char**>(selected), selectedLength, supported, sizeof(supported) - 1, offered, offeredLength);
+
+      return result == OPENSSL_NPN_NEGOTIATED ? SSL_TLSEXT_ERR_OK : SSL_TLSEXT_ERR_NOACK;
+    }
+#endif
+  };
+} // namespace OlympusWebServer
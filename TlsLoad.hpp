@@ -0,0 +1,361 @@
+#pragma once
+
+#ifdef OLYMPUS_TLS
+
+#include <cstdio>
+#include "LoadGenerator.hpp"
+#include <memory>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <stdexcept>
+#include <string>
+#include "Threading.hpp"
+#include "Trace.hpp"
+#include <vector>
+#include "Winsock.hpp"
+
+namespace OlympusWebServer
+{
+  // Loopback TLS benchmarks: handshake rate, with or without session resumption, and bulk upload or download
+  // throughput over TLS or plain TCP. Each thread runs a blocking client; what is measured is the server's cost per handshake and
+  // per byte, so the client does nothing else.
+  class TlsLoad
+  {
+  private: // types
+
+    class Connection
+    {
+    public: // data
+
+      std::string input;
+      SOCKET socket;
+      SSL* ssl;
+
+    public: // methods
+
+      Connection() :
+        socket(INVALID_SOCKET),
+        ssl(NULL)
+      {
+      }
+
+      ~Connection()
+      {
+        if (ssl != NULL)
+        {
+          // OpenSSL marks the session of a connection freed without a close_notify as not resumable.
+          SSL_shutdown(ssl);
+          SSL_free(ssl);
+        }
+        if (socket != INVALID_SOCKET)
+        {
+          Winsock::DestroySocket(socket);
+        }
+      }
+
+      // Reads until a whole response has arrived and removes it from the input.
+      bool ReadResponse(bool& isSuccess)
+      {
+        char buffer[16384];
+        for (;;)
+        {
+          auto length = LoadGenerator::ParseResponse(input, 0, isSuccess);
+          if (length == std::string::npos)
+          {
+            return false;
+          }
+          if (length > 0)
+          {
+            input.erase(0, length);
+            return true;
+          }
+
+          auto received = ssl != NULL ? SSL_read(ssl, buffer, sizeof(buffer)) : Winsock::Receive(socket, buffer);
+          if (received <= 0)
+          {
+            return false;
+          }
+          input.append(buffer, static_cast<std::size_t>(received));
+        }
+      }
+
+      bool SendAll(std::string const& data)
+      {
+        for (auto offset = std::size_t(); offset < data.size();)
+        {
+          auto length = data.size() - offset;
+          auto sent = ssl != NULL ?
+            SSL_write(ssl, data.data() + offset, static_cast<int>(length)) :
+            Winsock::Send(socket, data.data() + offset, length);
+          if (sent <= 0)
+          {
+            return false;
+          }
+          offset += static_cast<std::size_t>(sent);
+        }
+
+        return true;
+      }
+
+    private: // methods
+
+      Connection(Connection const&);
+      Connection& operator=(Connection const&);
+    };
+
+  private: // data
+
+    SSL_CTX* context;
+    LoadGeneratorOptions options;
+
+  public: // methods
+
+    // Uses threads, endpoint, request and durationSeconds from options. The server's certificate is not verified.
+    // SSL_write raises SIGPIPE if the server closes first, so the process must ignore SIGPIPE, as for TlsContext.
+    explicit TlsLoad(LoadGeneratorOptions options_) :
+      context(SSL_CTX_new(TLS_client_method())),
+      options(std::move(options_))
+    {
+      if (context == NULL)
+      {
+        throw std::runtime_error("TlsLoad.TlsLoad - Unable to create an OpenSSL context");
+      }
+      if (options.threads == 0)
+      {
+        SSL_CTX_free(context);
+        throw std::runtime_error("TlsLoad.TlsLoad - Needs at least one thread");
+      }
+
+      SSL_CTX_set_verify(context, SSL_VERIFY_NONE, NULL);
+    }
+
+    ~TlsLoad()
+    {
+      SSL_CTX_free(context);
+    }
+
+    // Moves bodyLength-byte bodies over one keep-alive connection per thread: as POST bodies, or with isDownload,
+    // as the responses to empty POSTs to /download, which the server must answer with bodyLength bytes. Kernel TLS
+    // only offloads what the server sends, so only downloads can show its effect.
+    LoadGeneratorResult RunBulk(std::size_t bodyLength, bool isTls, bool isDownload)
+    {
+      char header[128];
+      std::sprintf(header, "POST /%s HTTP/1.1\r\nHost: localhost\r\nContent-Length: %lu\r\n\r\n",
+        isDownload ? "download" : "upload", static_cast<unsigned long>(isDownload ? 0 : bodyLength));
+      auto request = std::string(header) + std::string(isDownload ? 0 : bodyLength, 'x');
+
+      return Run([&](long long deadline, LoadGeneratorResult& result, unsigned long long&)
+      {
+        Connection connection;
+        if (!Open(connection, isTls, NULL))
+        {
+          ++result.errors;
+          return;
+        }
+
+        for (auto start = TraceClock::Now(); start < deadline; start = TraceClock::Now())
+        {
+          auto isSuccess = false;
+          if (!connection.SendAll(request) || !connection.ReadResponse(isSuccess))
+          {
+            ++result.errors;
+            return;
+          }
+
+          Record(isSuccess, start, result);
+        }
+      });
+    }
+
+    // Connects, handshakes and makes one request per connection until the duration is up. With resume, each
+    // connection offers the session (or ticket) from the thread's previous one; resumed counts the handshakes the
+    // server accepted it for.
+    LoadGeneratorResult RunHandshakes(bool resume, unsigned long long& resumed)
+    {
+      auto counts = std::vector<unsigned long long>(options.threads);
+      auto result = Run([&](long long deadline, LoadGeneratorResult& threadResult, unsigned long long& threadResumed)
+      {
+        auto session = static_cast<SSL_SESSION*>(NULL);
+        for (auto start = TraceClock::Now(); start < deadline; start = TraceClock::Now())
+        {
+          Connection connection;
+          auto isSuccess = false;
+          if (!Open(connection, true, session) || !connection.SendAll(options.request) ||
+            !connection.ReadResponse(isSuccess))
+          {
+            ++threadResult.errors;
+            continue;
+          }
+
+          Record(isSuccess, start, threadResult);
+          if (SSL_session_reused(connection.ssl))
+          {
+            ++threadResumed;
+          }
+
+          // TLS 1.3 tickets arrive after the handshake, so the session is taken once the response has been read.
+          if (resume)
+          {
+            if (session != NULL)
+            {
+              SSL_SESSION_free(session);
+            }
+            session = SSL_get1_session(connection.ssl);
+          }
+        }
+
+        if (session != NULL)
+        {
+          SSL_SESSION_free(session);
+        }
+      }, &counts);
+
+      resumed = 0;
+      for (auto it = counts.begin(); it != counts.end(); ++it)
+      {
+        resumed += *it;
+      }
+
+      return result;
+    }
+
+    // Writes a self-signed P-256 certificate for "localhost" and its key as PEM files.
+    static void WriteSelfSignedCertificate(std::string const& certificateFile, std::string const& privateKeyFile)
+    {
+      auto key = static_cast<EVP_PKEY*>(NULL);
+      auto keyContext = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+      if (keyContext == NULL || EVP_PKEY_keygen_init(keyContext) != 1 ||
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keyContext, NID_X9_62_prime256v1) != 1 ||
+        EVP_PKEY_keygen(keyContext, &key) != 1)
+      {
+        EVP_PKEY_CTX_free(keyContext);
+        throw std::runtime_error("TlsLoad.WriteSelfSignedCertificate - Unable to generate a key");
+      }
+      EVP_PKEY_CTX_free(keyContext);
+
+      auto certificate = X509_new();
+      X509_set_version(certificate, 2);
+      ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+      X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+      X509_gmtime_adj(X509_getm_notAfter(certificate), 24 * 60 * 60);
+      X509_set_pubkey(certificate, key);
+
+      auto name = X509_get_subject_name(certificate);
+      X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<unsigned char const*>("localhost"), -1, -1, 0);
+      X509_set_issuer_name(certificate, name);
+
+      auto certificateOut = std::fopen(certificateFile.c_str(), "wb");
+      auto keyOut = std::fopen(privateKeyFile.c_str(), "wb");
+      auto isWritten = X509_sign(certificate, key, EVP_sha256()) > 0 &&
+        certificateOut != NULL && PEM_write_X509(certificateOut, certificate) == 1 &&
+        keyOut != NULL && PEM_write_PrivateKey(keyOut, key, NULL, NULL, 0, NULL, NULL) == 1;
+
+      if (certificateOut != NULL)
+      {
+        std::fclose(certificateOut);
+      }
+      if (keyOut != NULL)
+      {
+        std::fclose(keyOut);
+      }
+      X509_free(certificate);
+      EVP_PKEY_free(key);
+
+      if (!isWritten)
+      {
+        throw std::runtime_error("TlsLoad.WriteSelfSignedCertificate - Unable to write " + certificateFile);
+      }
+    }
+
+  private: // methods
+
+    bool Open(Connection& connection, bool isTls, SSL_SESSION* session)
+    {
+      connection.socket = Winsock::CreateStreamSocket(options.endpoint.GetFamily());
+      if (connection.socket == INVALID_SOCKET ||
+        !Winsock::Connect(connection.socket, options.endpoint.GetAddress(), options.endpoint.GetLength()))
+      {
+        return false;
+      }
+
+      // The handshake's last flight and the request are separate writes, which Nagle would hold apart.
+      Winsock::SetOption(connection.socket, IPPROTO_TCP, TCP_NODELAY, 1);
+      if (!isTls)
+      {
+        return true;
+      }
+
+      connection.ssl = SSL_new(context);
+      if (connection.ssl == NULL || SSL_set_fd(connection.ssl, static_cast<int>(connection.socket)) != 1)
+      {
+        return false;
+      }
+      if (session != NULL)
+      {
+        SSL_set_session(connection.ssl, session);
+      }
+
+      return SSL_connect(connection.ssl) == 1;
+    }
+
+    static void Record(bool isSuccess, long long start, LoadGeneratorResult& result)
+    {
+      if (!isSuccess)
+      {
+        ++result.errors;
+        return;
+      }
+
+      ++result.completed;
+      result.latency.Record(
+        static_cast<unsigned long long>(TraceClock::ToMicroseconds(TraceClock::Now() - start) * 1000.0));
+    }
+
+    // Runs client(deadline, result, count) on every thread and merges the results. Each thread's count is stored
+    // in counts, if given.
+    template <typename Client>
+    LoadGeneratorResult Run(Client client, std::vector<unsigned long long>* counts = NULL)
+    {
+      Winsock::Initialize();
+
+      auto results = std::vector<LoadGeneratorResult>(options.threads);
+      auto threadCounts = std::vector<unsigned long long>(options.threads);
+      auto threads = std::vector<std::unique_ptr<Thread>>();
+
+      auto start = TraceClock::Now();
+      auto deadline = start + TraceClock::FromMicroseconds(options.durationSeconds * 1000000.0);
+
+      for (auto i = 0u; i < options.threads; ++i)
+      {
+        auto& result = results[i];
+        auto& count = threadCounts[i];
+        threads.push_back(std::unique_ptr<Thread>(new Thread([&client, deadline, &result, &count]()
+        {
+          client(deadline, result, count);
+        })));
+      }
+
+      for (auto it = threads.begin(); it != threads.end(); ++it)
+      {
+        (*it)->Join();
+      }
+
+      auto total = LoadGeneratorResult();
+      for (auto it = results.begin(); it != results.end(); ++it)
+      {
+        total.Merge(*it);
+      }
+      total.elapsedSeconds = TraceClock::ToMicroseconds(TraceClock::Now() - start) / 1000000.0;
+
+      if (counts != NULL)
+      {
+        *counts = threadCounts;
+      }
+
+      return total;
+    }
+  };
+} // namespace OlympusWebServer
+
+#endif // OLYMPUS_TLS
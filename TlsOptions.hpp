@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+
+namespace OlympusWebServer
+{
+  // Configuration for a TLS listener. Only used when built with OLYMPUS_TLS (OpenSSL 1.1.1 or later).
+  class TlsOptions
+  {
+  public: // data
+
+    // PEM certificate chain, leaf first.
+    std::string certificateFile;
+
+    // Hands record encryption to the kernel (kTLS) after the handshake, so responses leave through plain sends
+    // with no copy through OpenSSL's buffers. Ignored where OpenSSL or the kernel lacks it; on Linux it needs the
+    // tls module loaded.
+    bool kernelTls;
+
+    // PEM private key for the certificate.
+    std::string privateKeyFile;
+
+    // Sessions kept in the server-side cache, which every connection made from the same TlsContext shares, on any
+    // thread. Resuming from it skips the key exchange and certificate. Zero disables the cache.
+    long sessionCacheSize;
+
+    // How long a cached session or ticket can be resumed.
+    long sessionTimeoutSeconds;
+
+    // Stateless session tickets: the session is encrypted into a ticket the client keeps, so resumption needs no
+    // server-side state. With tickets off, TLS 1.3 resumption falls back to the session cache.
+    bool sessionTickets;
+
+  public: // methods
+
+    TlsOptions() :
+      kernelTls(true),
+      sessionCacheSize(20480),
+      sessionTimeoutSeconds(7200),
+      sessionTickets(true)
+    {
+    }
+  };
+} // namespace OlympusWebServer
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <climits>
+#include <cstddef>
+#include "ReceiveBuffer.hpp"
+#include "TlsContext.hpp"
+#include "Winsock.hpp"
+
+#ifndef OLYMPUS_TLS
+typedef struct ssl_st SSL;
+#endif
+
+namespace OlympusWebServer
+{
+  // TLS on one accepted, non-blocking connection. OpenSSL reads and writes the socket itself, so a call that needs
+  // more data, or room to send, simply returns nothing and is retried on a later update; the handshake advances the
+  // same way from Receive and Write.
+  //
+  // Once the handshake has enabled kTLS for sending, the kernel encrypts records and the owner writes application
+  // data straight to the socket instead (see IsKernelSend).
+  class TlsStream
+  {
+  private: // data
+
+    TlsContext* context;
+    bool isClosed;
+    bool isHandshakeDone;
+    bool isKernelSend;
+    SSL* ssl;
+
+  public: // methods
+
+    TlsStream(TlsStream&& b)
+    {
+      ssl = NULL;
+      *this = std::move(b);
+    }
+
+    TlsStream& operator=(TlsStream&& b)
+    {
+      if (this == &b)
+      {
+        return *this;
+      }
+      Free();
+
+      context = b.context;
+      isClosed = b.isClosed;
+      isHandshakeDone = b.isHandshakeDone;
+      isKernelSend = b.isKernelSend;
+      ssl = b.ssl;
+
+      b.ssl = NULL;
+
+      return *this;
+    }
+
+    TlsStream(TlsContext& context_, SOCKET socket) :
+      context(&context_),
+      isClosed(false),
+      isHandshakeDone(false),
+      isKernelSend(false),
+      ssl(NULL)
+    {
+#ifdef OLYMPUS_TLS
+      ssl = SSL_new(context->GetHandle());
+      if (ssl == NULL || SSL_set_fd(ssl, static_cast<int>(socket)) != 1)
+      {
+        Free();
+        throw std::runtime_error("TlsStream.TlsStream - Unable to create an OpenSSL connection");
+      }
+      SSL_set_accept_state(ssl);
+#else
+      (void) socket;
+#endif
+    }
+
+    ~TlsStream()
+    {
+      Free();
+    }
+
+    // True once the peer has closed the connection or it has failed. The owner should close the socket.
+    bool IsClosed() const
+    {
+      return isClosed;
+    }
+
+    bool IsHandshakeDone() const
+    {
+      return isHandshakeDone;
+    }
+
+    // True if the kernel encrypts what is sent, so application data goes to the socket directly.
+    bool IsKernelSend() const
+    {
+      return isKernelSend;
+    }
+
+    // Decrypts whatever has arrived into the end of buffer, returning the number of bytes added.
+    std::size_t Receive(ReceiveBuffer& buffer, std::size_t maxLength = 64u * 1024u)
+    {
+      auto total = std::size_t();
+#ifdef OLYMPUS_TLS
+      if (!Handshake())
+      {
+        return 0;
+      }
+
+      while (total < maxLength)
+      {
+        auto length = std::size_t();
+        auto writable = buffer.GetWritable(length);
+
+        auto result = SSL_read(ssl, writable, static_cast<int>(length));
+        if (result <= 0)
+        {
+          buffer.Commit(0);
+          CheckError(result);
+          break;
+        }
+
+        buffer.Commit(static_cast<std::size_t>(result));
+        total += static_cast<std::size_t>(result);
+      }
+#else
+      (void) buffer;
+      (void) maxLength;
+#endif
+
+      return total;
+    }
+
+    // Sends a close_notify alert, best effort, before the owner closes the socket.
+    void Shutdown()
+    {
+#ifdef OLYMPUS_TLS
+      if (ssl != NULL && isHandshakeDone && !isClosed)
+      {
+        SSL_shutdown(ssl);
+        ERR_clear_error();
+      }
+#endif
+      isClosed = true;
+    }
+
+    // Encrypts and sends as much of data as the socket takes without blocking, returning the number of bytes of
+    // data consumed.
+    std::size_t Write(char const* data, std::size_t length)
+    {
+#ifdef OLYMPUS_TLS
+      if (length == 0 || !Handshake())
+      {
+        return 0;
+      }
+
+      auto result = SSL_write(ssl, data, static_cast<int>(length < INT_MAX ? length : INT_MAX));
+      if (result <= 0)
+      {
+        CheckError(result);
+        return 0;
+      }
+
+      return static_cast<std::size_t>(result);
+#else
+      (void) data;
+      (void) length;
+      return 0;
+#endif
+    }
+
+  private: // methods
+
+    TlsStream(TlsStream const&);
+    TlsStream& operator=(TlsStream const&);
+
+#ifdef OLYMPUS_TLS
+    // Wanting to read or write more is not an error on a non-blocking socket; anything else closes the connection.
+    void CheckError(int result)
+    {
+      switch (SSL_get_error(ssl, result))
+      {
+      case SSL_ERROR_WANT_READ:
+      case SSL_ERROR_WANT_WRITE:
+        break;
+
+      default:
+        isClosed = true;
+        ERR_clear_error();
+        break;
+      }
+    }
+
+    // Advances the handshake, returning true once it has completed.
+    bool Handshake()
+    {
+      if (isHandshakeDone)
+      {
+        return true;
+      }
+      if (isClosed)
+      {
+        return false;
+      }
+
+      auto result = SSL_do_handshake(ssl);
+      if (result != 1)
+      {
+        CheckError(result);
+        return false;
+      }
+
+      isHandshakeDone = true;
+#ifndef OPENSSL_NO_KTLS
+      isKernelSend = BIO_get_ktls_send(SSL_get_wbio(ssl)) != 0;
+      if (isKernelSend)
+      {
+        context->OnKernelSend();
+      }
+#endif
+
+      return true;
+    }
+#endif
+
+    void Free()
+    {
+#ifdef OLYMPUS_TLS
+      if (ssl != NULL)
+      {
+        SSL_free(ssl); // the socket was set without BIO_CLOSE, so it stays open for its owner to close
+      }
+#endif
+      ssl = NULL;
+    }
+  };
+} // namespace OlympusWebServer
@@ -0,0 +1,374 @@
+#pragma once
+
+#include <cstddef>
+#include <ios>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include "Threading.hpp"
+#include <vector>
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+namespace OlympusWebServer
+{
+  namespace TracePhase
+  {
+    enum Value
+    {
+      Accept,
+      FirstByteReceived,
+      HeadersParsed,
+      HandlerStart,
+      HandlerEnd,
+      FirstByteSent,
+      LastByteFlushed,
+      Count
+    };
+  }
+
+  class TraceClock
+  {
+  public: // methods
+
+    static long long FromMicroseconds(double microseconds)
+    {
+#ifdef _WIN32
+      static const auto frequency = QueryFrequency();
+      return static_cast<long long>(microseconds * static_cast<double>(frequency) / 1000000.0);
+#else
+      return static_cast<long long>(microseconds * 1000.0);
+#endif
+    }
+
+    // Returns a monotonic timestamp in clock ticks. QueryPerformanceCounter reads the invariant TSC on modern
+    // hardware and clock_gettime(CLOCK_MONOTONIC) is served from the vDSO, so neither enters the kernel.
+    static long long Now()
+    {
+#ifdef _WIN32
+      auto counter = LARGE_INTEGER();
+      QueryPerformanceCounter(&counter);
+      return counter.QuadPart;
+#else
+      auto now = timespec();
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      return static_cast<long long>(now.tv_sec) * 1000000000ll + now.tv_nsec;
+#endif
+    }
+
+    static double ToMicroseconds(long long ticks)
+    {
+#ifdef _WIN32
+      static const auto frequency = QueryFrequency();
+      return static_cast<double>(ticks) * 1000000.0 / static_cast<double>(frequency);
+#else
+      return static_cast<double>(ticks) / 1000.0;
+#endif
+    }
+
+  private: // methods
+
+#ifdef _WIN32
+    static long long QueryFrequency()
+    {
+      auto frequency = LARGE_INTEGER();
+      QueryPerformanceFrequency(&frequency);
+      return frequency.QuadPart;
+    }
+#endif
+  };
+
+  class RequestTrace
+  {
+  private: // data
+
+    long id;
+    long long timestamps[TracePhase::Count];
+
+  public: // methods
+
+    // Creates a trace that is not sampled; marking phases on it is a no-op.
+    RequestTrace() :
+      id(0)
+    {
+      Clear();
+    }
+
+    explicit RequestTrace(long id_) :
+      id(id_)
+    {
+      Clear();
+    }
+
+    long GetId() const
+    {
+      return id;
+    }
+
+    long long GetTimestamp(TracePhase::Value phase) const
+    {
+      return timestamps[phase];
+    }
+
+    bool IsSampled() const
+    {
+      return id != 0;
+    }
+
+    void Mark(TracePhase::Value phase)
+    {
+      if (IsSampled())
+      {
+        timestamps[phase] = TraceClock::Now();
+      }
+    }
+
+    void Mark(TracePhase::Value phase, long long timestamp)
+    {
+      if (IsSampled())
+      {
+        timestamps[phase] = timestamp;
+      }
+    }
+
+  private: // methods
+
+    void Clear()
+    {
+      for (auto i = 0; i < TracePhase::Count; ++i)
+      {
+        timestamps[i] = 0;
+      }
+    }
+  };
+
+  class TraceRing
+  {
+  private: // data
+
+    std::size_t count;
+    mutable Mutex mutex;
+    std::vector<RequestTrace> records;
+    std::size_t threadIndex;
+
+  public: // methods
+
+    TraceRing(std::size_t threadIndex_, std::size_t capacity) :
+      count(0),
+      records(capacity),
+      threadIndex(threadIndex_)
+    {
+    }
+
+    std::size_t GetThreadIndex() const
+    {
+      return threadIndex;
+    }
+
+    // Only sampled requests reach the ring, so the lock is uncontended except while a dump is copying it out.
+    void Push(RequestTrace const& trace)
+    {
+      MutexLock lock(mutex);
+      records[count % records.size()] = trace;
+      ++count;
+    }
+
+    std::vector<RequestTrace> Snapshot() const
+    {
+      MutexLock lock(mutex);
+      if (count < records.size())
+      {
+        return std::vector<RequestTrace>(records.begin(), records.begin() + count);
+      }
+
+      // Return the records oldest first.
+      auto oldest = records.begin() + count % records.size();
+      auto snapshot = std::vector<RequestTrace>(oldest, records.end());
+      snapshot.insert(snapshot.end(), records.begin(), oldest);
+      return snapshot;
+    }
+
+  private: // methods
+
+    TraceRing(TraceRing const&);
+    TraceRing& operator=(TraceRing const&);
+  };
+
+  class Tracer
+  {
+  public: // data
+
+    static const std::size_t RingCapacity = 4096;
+
+  public: // methods
+
+    // Decides whether the next request on this thread is traced. Unsampled requests cost a load and a
+    // thread-local increment.
+    static RequestTrace Begin()
+    {
+      static OLYMPUS_THREAD_LOCAL unsigned long requestCount = 0;
+
+      auto sampleRate = Atomic::Load(SampleRate());
+      if (sampleRate <= 0 || ++requestCount % static_cast<unsigned long>(sampleRate) != 0)
+      {
+        return RequestTrace();
+      }
+
+      static long volatile nextId = 0;
+      return RequestTrace(Atomic::Increment(nextId));
+    }
+
+    static void Commit(RequestTrace const& trace)
+    {
+      if (trace.IsSampled())
+      {
+        ThreadRing().Push(trace);
+      }
+    }
+
+    static std::string GetChromeTrace()
+    {
+      auto ostream = std::ostringstream();
+      WriteChromeTrace(ostream);
+      return ostream.str();
+    }
+
+    static long GetSampleRate()
+    {
+      return Atomic::Load(SampleRate());
+    }
+
+    // Traces one in every sampleRate requests. Zero disables tracing. Safe to call while requests are in flight.
+    static void SetSampleRate(long sampleRate)
+    {
+      Atomic::Store(SampleRate(), sampleRate < 0 ? 0 : sampleRate);
+    }
+
+    // Writes every thread's ring buffer as Chrome trace_event JSON, loadable in Perfetto or chrome://tracing.
+    static void WriteChromeTrace(std::ostream& ostream)
+    {
+      auto flags = ostream.flags();
+      auto precision = ostream.precision();
+      ostream.setf(std::ios::fixed, std::ios::floatfield);
+      ostream.precision(3);
+
+      ostream << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+      auto first = true;
+
+      MutexLock lock(RegistryMutex());
+      auto& rings = Rings();
+      for (auto it = rings.begin(); it != rings.end(); ++it)
+      {
+        auto tid = (*it)->GetThreadIndex();
+        WriteSeparator(ostream, first);
+        ostream << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+          << ",\"args\":{\"name\":\"worker " << tid << "\"}}";
+
+        auto records = (*it)->Snapshot();
+        for (auto record = records.begin(); record != records.end(); ++record)
+        {
+          WriteRequest(ostream, first, tid, *record);
+        }
+      }
+
+      ostream << "]}";
+
+      ostream.flags(flags);
+      ostream.precision(precision);
+    }
+
+  private: // methods
+
+    static Mutex& RegistryMutex()
+    {
+      static Mutex mutex;
+      return mutex;
+    }
+
+    static std::vector<TraceRing*>& Rings()
+    {
+      static std::vector<TraceRing*> rings;
+      return rings;
+    }
+
+    static long volatile& SampleRate()
+    {
+      static long volatile sampleRate = 0;
+      return sampleRate;
+    }
+
+    // Rings stay registered after their thread exits so its last requests can still be dumped.
+    static TraceRing& ThreadRing()
+    {
+      static OLYMPUS_THREAD_LOCAL TraceRing* ring = NULL;
+      if (ring == NULL)
+      {
+        MutexLock lock(RegistryMutex());
+        ring = new TraceRing(Rings().size(), RingCapacity);
+        Rings().push_back(ring);
+      }
+
+      return *ring;
+    }
+
+    static void WriteRequest(std::ostream& ostream, bool& first, std::size_t tid, RequestTrace const& trace)
+    {
+      auto requestStart = trace.GetTimestamp(TracePhase::FirstByteReceived);
+      auto requestEnd = requestStart;
+      for (auto i = 0; i < TracePhase::Count; ++i)
+      {
+        auto timestamp = trace.GetTimestamp(static_cast<TracePhase::Value>(i));
+        if (timestamp > requestEnd)
+        {
+          requestEnd = timestamp;
+        }
+      }
+
+      WriteSpan(ostream, first, "accept", tid, trace.GetId(),
+        trace.GetTimestamp(TracePhase::Accept),
+        trace.GetTimestamp(TracePhase::FirstByteReceived));
+      WriteSpan(ostream, first, "request", tid, trace.GetId(), requestStart, requestEnd);
+      WriteSpan(ostream, first, "parse", tid, trace.GetId(),
+        trace.GetTimestamp(TracePhase::FirstByteReceived),
+        trace.GetTimestamp(TracePhase::HeadersParsed));
+      WriteSpan(ostream, first, "handler", tid, trace.GetId(),
+        trace.GetTimestamp(TracePhase::HandlerStart),
+        trace.GetTimestamp(TracePhase::HandlerEnd));
+      WriteSpan(ostream, first, "send", tid, trace.GetId(),
+        trace.GetTimestamp(TracePhase::FirstByteSent),
+        trace.GetTimestamp(TracePhase::LastByteFlushed));
+    }
+
+    static void WriteSeparator(std::ostream& ostream, bool& first)
+    {
+      if (!first)
+      {
+        ostream << ",";
+      }
+      first = false;
+    }
+
+    static void WriteSpan(
+      std::ostream& ostream,
+      bool& first,
+      char const* name,
+      std::size_t tid,
+      long id,
+      long long begin,
+      long long end)
+    {
+      if (begin == 0 || end < begin)
+      {
+        return; // phase was not reached
+      }
+
+      WriteSeparator(ostream, first);
+      ostream << "{\"name\":\"" << name << "\",\"cat\":\"http\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+        << ",\"ts\":" << TraceClock::ToMicroseconds(begin)
+        << ",\"dur\":" << TraceClock::ToMicroseconds(end - begin)
+        << ",\"args\":{\"request\":" << id << "}}";
+    }
+  };
+} // namespace OlympusWebServer
\ No newline at end of file
@@ -0,0 +1,204 @@
+#pragma once
+
+#include "Endpoint.hpp"
+#include "ProxyOptions.hpp"
+#include "ReceiveBuffer.hpp"
+#include "TcpSocket.hpp"
+#include "Trace.hpp"
+#include <vector>
+
+namespace OlympusWebServer
+{
+  // A connection to an upstream, with whatever it has sent that has not been forwarded yet.
+  class UpstreamConnection
+  {
+  public: // data
+
+    // When the connection was returned to its upstream's pool.
+    long long idleTime;
+
+    ReceiveBuffer input;
+    TcpSocket socket;
+
+  public: // methods
+
+    UpstreamConnection() :
+      idleTime(0)
+    {
+    }
+
+    UpstreamConnection(UpstreamConnection&& b)
+    {
+      *this = std::move(b);
+    }
+
+    UpstreamConnection& operator=(UpstreamConnection&& b)
+    {
+      idleTime = b.idleTime;
+      input = std::move(b.input);
+      socket = std::move(b.socket);
+
+      return *this;
+    }
+
+  private: // methods
+
+    UpstreamConnection(UpstreamConnection const&);
+    UpstreamConnection& operator=(UpstreamConnection const&);
+  };
+
+  // A backend that a proxy route forwards to, as seen by one WebServer: its pool of idle keep-alive connections,
+  // the requests outstanding on it, and its health. Health is passive. Consecutive failures take the upstream out
+  // of rotation for ProxyOptions::failTimeoutSeconds, after which one request at a time is let through until one
+  // succeeds. That request is the probe; only its own verdict or release lets another request try, so requests that
+  // were already outstanding when the upstream failed cannot end a probe that is still in flight.
+  class Upstream
+  {
+  private: // data
+
+    Endpoint endpoint;
+    unsigned failures;
+    std::vector<UpstreamConnection> idleConnections; // least recently used first
+    bool isProbing;
+    ProxyOptions options;
+    unsigned outstanding;
+    long long retryTime;
+
+  public: // methods
+
+    Upstream(Endpoint const& endpoint_, ProxyOptions const& options_) :
+      endpoint(endpoint_),
+      failures(0),
+      isProbing(false),
+      options(options_),
+      outstanding(0),
+      retryTime(0)
+    {
+    }
+
+    // Takes the most recently used idle connection, or starts connecting a new one, for a request. isReused tells
+    // which: the backend may have closed a reused connection while it sat idle. isProbe tells whether the request
+    // is the one probe allowed while the upstream is out of rotation; the caller passes it back to OnFailure,
+    // OnSuccess and Release. Returns false if a new connection failed at once, which the caller reports with
+    // OnFailure.
+    bool Acquire(UpstreamConnection& connection, bool& isReused, bool& isProbe)
+    {
+      isProbe = failures >= options.maxFailures;
+      if (isProbe)
+      {
+        isProbing = true;
+      }
+
+      isReused = !idleConnections.empty();
+      if (isReused)
+      {
+        connection = std::move(idleConnections.back());
+        idleConnections.pop_back();
+      }
+      else
+      {
+        connection = UpstreamConnection();
+        if (!connection.socket.Connect(endpoint))
+        {
+          return false;
+        }
+      }
+
+      ++outstanding;
+      return true;
+    }
+
+    Endpoint const& GetEndpoint() const
+    {
+      return endpoint;
+    }
+
+    unsigned GetIdleCount() const
+    {
+      return static_cast<unsigned>(idleConnections.size());
+    }
+
+    // Requests forwarded to the upstream that have not finished yet.
+    unsigned GetOutstanding() const
+    {
+      return outstanding;
+    }
+
+    // True if requests can be sent to the upstream: it is healthy, or it has been out of rotation long enough to
+    // be tried again and no other request is trying it.
+    bool IsAvailable(long long now) const
+    {
+      return failures < options.maxFailures || (!isProbing && now >= retryTime);
+    }
+
+    bool IsHealthy() const
+    {
+      return failures < options.maxFailures;
+    }
+
+    void OnFailure(long long now, bool& isProbe)
+    {
+      EndProbe(isProbe);
+      ++failures;
+      if (failures >= options.maxFailures)
+      {
+        retryTime = now + TraceClock::FromMicroseconds(options.failTimeoutSeconds * 1000000.0);
+        idleConnections.clear();
+      }
+    }
+
+    void OnSuccess(bool& isProbe)
+    {
+      EndProbe(isProbe);
+      failures = 0;
+    }
+
+    // Ends a request taken with Acquire. The connection goes back to the pool if it can carry another request.
+    void Release(UpstreamConnection& connection, bool isReusable, bool& isProbe, long long now)
+    {
+      --outstanding;
+      EndProbe(isProbe); // a probe that ended without a verdict lets the next request try
+
+      if (isReusable && connection.socket.IsOpen() && connection.input.IsEmpty() &&
+        idleConnections.size() < options.maxIdleConnections && IsHealthy())
+      {
+        connection.idleTime = now;
+        idleConnections.push_back(std::move(connection));
+        return;
+      }
+
+      connection.input.Release();
+      connection.socket.Close();
+    }
+
+    // Closes connections that have been idle for longer than ProxyOptions::idleTimeoutSeconds.
+    void Update(long long now)
+    {
+      auto expiry = now - TraceClock::FromMicroseconds(options.idleTimeoutSeconds * 1000000.0);
+      auto expired = idleConnections.begin();
+      while (expired != idleConnections.end() && expired->idleTime < expiry)
+      {
+        ++expired;
+      }
+
+      if (expired != idleConnections.begin())
+      {
+        idleConnections.erase(idleConnections.begin(), expired);
+      }
+    }
+
+  private: // methods
+
+    Upstream(Upstream const&);
+    Upstream& operator=(Upstream const&);
+
+    void EndProbe(bool& isProbe)
+    {
+      if (isProbe)
+      {
+        isProbing = false;
+        isProbe = false;
+      }
+    }
+  };
+} // namespace OlympusWebServer
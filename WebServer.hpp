@@ -1,11 +1,22 @@
 #pragma once
 
 #include <array>
+#include <cstdlib>
+#include "Endpoint.hpp"
 #include <functional>
+#include "HttpConnection.hpp"
 #include "HttpRequest.hpp"
 #include "HttpResponse.hpp"
+#include "ListenerOptions.hpp"
+#include <memory>
+#include "ProxyOptions.hpp"
+#include "RateLimiter.hpp"
+#include "ReverseProxy.hpp"
 #include "TcpSocket.hpp"
+#include "TlsContext.hpp"
+#include "Trace.hpp"
 #include <vector>
+#include "WebSocketSession.hpp"
 
 namespace OlympusWebServer
 {
@@ -13,14 +24,36 @@ namespace OlympusWebServer
   {
   private: // data
 
-    std::vector<TcpSocket> clients;
-    unsigned short port;
-    TcpSocket socket;
+    std::vector<HttpConnection> clients;
+    ListenerOptions listenerOptions;
+    std::vector<TcpSocket> listeners;
+
+    // TLS context of each listener, by index; empty for a plaintext listener.
+    std::vector<std::shared_ptr<TlsContext>> listenerTls;
+
+    // Shared with the connections, which forward requests through it.
+    std::shared_ptr<ReverseProxy> proxy;
+
+    // Checked by every connection, and possibly shared with other servers; empty for no rate limits.
+    std::shared_ptr<RateLimiter> rateLimiter;
 
   public: // data
 
+    // Answers POST requests, if set. Other requests get an empty response.
     std::function<HttpResponse(HttpRequest)> PostResponse;
 
+    // Path that serves the trace ring buffers as Chrome trace_event JSON. A "sampleRate" query sets the
+    // Tracer sampling rate first. Only clients on loopback addresses or Unix domain sockets are answered; others
+    // get 403 Forbidden. Empty disables the endpoint.
+    std::string TracePath;
+
+    // Called with each complete message from a WebSocket client. The handler can reply through the session.
+    std::function<void(WebSocketSession&, std::string const& message, bool isBinary)> WebSocketMessage;
+
+    // Path prefix under which "Upgrade: websocket" requests are accepted. Each WebSocket is subscribed to the channel
+    // named by the full path it connected to, for Broadcast. Empty disables WebSockets.
+    std::string WebSocketPath;
+
   public: // methods
 
     WebServer(WebServer&& b)
@@ -31,47 +64,171 @@ namespace OlympusWebServer
     WebServer& operator=(WebServer&& b)
     {
       clients = std::move(b.clients);
-      port = b.port;
-      socket = std::move(socket);
+      listenerOptions = b.listenerOptions;
+      listeners = std::move(b.listeners);
+      listenerTls = std::move(b.listenerTls);
+      proxy = std::move(b.proxy);
+      rateLimiter = std::move(b.rateLimiter);
+      PostResponse = std::move(b.PostResponse);
+      TracePath = std::move(b.TracePath);
+      WebSocketMessage = std::move(b.WebSocketMessage);
+      WebSocketPath = std::move(b.WebSocketPath);
 
       return *this;
     }
 
-    explicit WebServer(unsigned short port_ = 8800) :
-      port(port_)
+    // Listens on the loopback interface.
+    explicit WebServer(unsigned short port_ = 8800, ListenerOptions listenerOptions_ = ListenerOptions()) :
+      listenerOptions(listenerOptions_),
+      proxy(std::make_shared<ReverseProxy>())
     {
       static const auto maxOpenAttempts = 100;
-      while (!socket.Open(true, port, false) && port < port_ + maxOpenAttempts)
+      auto port = port_;
+      while (!AddListener(Endpoint::Loopback(port)) && port < port_ + maxOpenAttempts)
       {
         ++port;
       }
     }
 
-    HttpResponse HandleRequest(HttpRequest request)
+    // Listens on every endpoint, all served by the same Update loop.
+    explicit WebServer(std::vector<Endpoint> const& endpoints, ListenerOptions listenerOptions_ = ListenerOptions()) :
+      listenerOptions(listenerOptions_),
+      proxy(std::make_shared<ReverseProxy>())
+    {
+      for (auto it = endpoints.begin(); it != endpoints.end(); ++it)
+      {
+        AddListener(*it);
+      }
+    }
+
+    // Starts listening on another endpoint, such as a Unix domain socket for a local proxy alongside a TCP port.
+    // Connections accepted on it speak TLS if a context is given; the context can be shared with other listeners
+    // and servers, which then share its session cache and ticket keys. Serving TLS needs SIGPIPE ignored; see
+    // TlsContext.
+    bool AddListener(Endpoint const& endpoint, std::shared_ptr<TlsContext> tls = std::shared_ptr<TlsContext>())
+    {
+      auto listener = TcpSocket();
+      if (!listener.Open(endpoint, true, false, listenerOptions))
+      {
+        return false;
+      }
+
+      listeners.push_back(std::move(listener));
+      listenerTls.push_back(std::move(tls));
+      return true;
+    }
+
+    // Forwards requests whose path starts with pathPrefix to the upstreams, instead of handling them here. Each
+    // request goes to the available upstream with the fewest requests outstanding from this server, over a pooled
+    // keep-alive connection. Routes must be added before the connections that use them are accepted; the longest
+    // matching prefix wins.
+    void AddProxyRoute(
+      std::string pathPrefix,
+      std::vector<Endpoint> const& upstreams,
+      ProxyOptions const& options = ProxyOptions())
+    {
+      proxy->AddRoute(std::move(pathPrefix), upstreams, options);
+    }
+
+    // Sends message to every WebSocket subscribed to channel and returns how many it went to. The frame is encoded
+    // once and shared by every client's send queue, then flushed as far as each socket allows; the rest goes out
+    // in later updates. Must be called on the thread that runs Update.
+    std::size_t Broadcast(std::string const& channel, std::string const& message, bool isBinary = false)
     {
+      auto frame = WebSocketSession::EncodeFrame(
+        isBinary ? WebSocketOpcode::Binary : WebSocketOpcode::Text, message.data(), message.size());
+
+      auto count = std::size_t();
+      for (auto it = clients.begin(); it != clients.end(); ++it)
+      {
+        auto webSocket = it->GetWebSocket();
+        if (webSocket != NULL && it->IsOpen() && webSocket->GetChannel() == channel && webSocket->Send(frame))
+        {
+          it->Flush();
+          ++count;
+        }
+      }
+
+      return count;
+    }
+
+    // Peer is the client's address; the trace endpoint answers only local clients, and a request with no peer
+    // counts as remote.
+    HttpResponse HandleRequest(HttpRequest request, Endpoint const& peer = Endpoint())
+    {
+      if (!TracePath.empty() && request.GetPath() == TracePath)
+      {
+        return peer.IsLocal() ? HandleTraceRequest(request) : HttpResponse(HttpStatus::Forbidden);
+      }
+      if (PostResponse && request.GetMethod() == HttpMethod::Post)
+      {
+        return PostResponse(std::move(request));
+      }
+
       return HttpResponse();
     }
 
-    bool IsRunning() const
+    HttpResponse HandleTraceRequest(HttpRequest const& request)
     {
-      return socket.IsOpen() && socket.IsListening();
+      auto sampleRate = request.GetQuery("sampleRate");
+      if (!sampleRate.empty())
+      {
+        Tracer::SetSampleRate(std::strtol(sampleRate.c_str(), NULL, 10));
+      }
+
+      return HttpResponse(Tracer::GetChromeTrace(), HttpDataType::Json);
     }
 
-    void Update()
+    bool IsRunning() const
     {
-      if (!socket.IsOpen())
+      for (auto it = listeners.begin(); it != listeners.end(); ++it)
       {
-        return;
+        if (it->IsOpen() && it->IsListening())
+        {
+          return true;
+        }
       }
 
-      // Accept a new client.
-      auto client = TcpSocket();
-      if (socket.Accept(client, false))
+      return false;
+    }
+
+    // Limits the rate of each client's requests by the limiter's rules. Requests over a limit are answered with
+    // 429 Too Many Requests. Servers run by separate threads can share one limiter, so a client is limited across
+    // all of them. Applies to connections accepted from then on.
+    void SetRateLimiter(std::shared_ptr<RateLimiter> limiter)
+    {
+      rateLimiter = std::move(limiter);
+    }
+
+    void Update()
+    {
+      // Accept every queued client, up to the budget per listener so a connection storm cannot starve established
+      // clients.
+      for (auto i = 0u; i < listeners.size(); ++i)
       {
-        clients.push_back(std::move(client));
+        auto& listener = listeners[i];
+        for (auto accepted = 0u; listener.IsOpen() && accepted < listenerOptions.acceptBudget; ++accepted)
+        {
+          auto client = TcpSocket();
+          if (!listener.Accept(client, false))
+          {
+            break;
+          }
+          clients.push_back(HttpConnection(
+            std::move(client),
+            listenerTls[i].get(),
+            proxy->HasRoutes() ? proxy : std::shared_ptr<ReverseProxy>(),
+            rateLimiter && rateLimiter->HasRules() ? rateLimiter : std::shared_ptr<RateLimiter>()));
+        }
       }
 
       auto clientsToRemove = std::vector<std::size_t>();
+      auto message = std::string();
+      auto now = TraceClock::Now();
+      if (proxy->HasRoutes())
+      {
+        proxy->Update(now);
+      }
 
       for (auto i = 0u; i < clients.size(); ++i)
       {
@@ -84,22 +241,55 @@ namespace OlympusWebServer
           continue;
         }
 
-        // Receive the request from the client.
-        auto requestString = client.Receive();
-        if (requestString.empty())
+        // Receive from the client, move along any request being forwarded to an upstream, and handle every complete
+        // request that has arrived.
+        client.Receive();
+        client.UpdateProxy(now);
+
+        auto requestString = std::string();
+        auto streamId = 0u;
+        while (client.IsOpen() && client.ReadRequest(requestString, streamId))
         {
-          continue;
+          auto trace = Tracer::Begin();
+          trace.Mark(TracePhase::Accept, client.TakeAcceptTime());
+          trace.Mark(TracePhase::FirstByteReceived, client.GetFirstByteTime());
+
+          auto request = HttpRequest(std::move(requestString));
+          trace.Mark(TracePhase::HeadersParsed);
+
+          if (client.IsWebSocketRequested() && !WebSocketPath.empty() &&
+            request.GetPath().compare(0, WebSocketPath.size(), WebSocketPath) == 0)
+          {
+            client.AcceptWebSocket(request.GetPath());
+            break; // anything after the upgrade request is WebSocket frames
+          }
+
+          // Process a response for the request.
+          trace.Mark(TracePhase::HandlerStart);
+          auto response = HandleRequest(std::move(request), client.GetSocket().GetPeer());
+          trace.Mark(TracePhase::HandlerEnd);
+
+          // The connection marks when the response starts and finishes going out, and commits the trace then.
+          client.SendResponse(streamId, response, trace);
         }
-        auto request = HttpRequest(std::move(requestString));
 
-        // Send a continue if it is requested.
-        if (request.GetHttpVersion() == 1.1f && request["Expect"] == "100-continue")
+        // Hand WebSocket messages to the handler, and keep the connection's ping timer running.
+        auto webSocket = client.GetWebSocket();
+        if (webSocket != NULL)
         {
-          client.Send(HttpResponse(HttpStatus::Continue).GetFormattedResponse());
+          auto isBinary = false;
+          while (client.ReadMessage(message, isBinary))
+          {
+            if (WebSocketMessage)
+            {
+              WebSocketMessage(*webSocket, message, isBinary);
+            }
+          }
+          webSocket->Update(now);
         }
 
-        // Process a response for the request.
-        client.Send(HandleRequest(std::move(request)).GetFormattedResponse());
+        // HTTP/2 responses and WebSocket frames are queued; send all of the client's at once.
+        client.Flush();
       }
 
       // Destroy all clients that should be removed.
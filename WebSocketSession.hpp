@@ -0,0 +1,515 @@
+#pragma once
+
+#include "Base64.hpp"
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include "ReceiveBuffer.hpp"
+#include "Sha1.hpp"
+#include <string>
+#include "Trace.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace OlympusWebServer
+{
+  namespace WebSocketCloseCode
+  {
+    enum Value
+    {
+      Normal = 1000,
+      GoingAway = 1001,
+      ProtocolError = 1002,
+      InvalidData = 1007,
+      MessageTooBig = 1009
+    };
+  }
+
+  namespace WebSocketOpcode
+  {
+    enum Value
+    {
+      Continuation = 0x0,
+      Text = 0x1,
+      Binary = 0x2,
+      Close = 0x8,
+      Ping = 0x9,
+      Pong = 0xA
+    };
+  }
+
+  // An encoded frame, ready to send. Frames are immutable once encoded, so one broadcast frame is shared by the
+  // send queue of every client it goes to.
+  typedef std::shared_ptr<std::string const> WebSocketFrame;
+
+  // The server side of one WebSocket connection (RFC 6455), after the upgrade handshake. Client frames are parsed
+  // and unmasked out of the connection's receive buffer, and fragmented messages are joined before they are handed
+  // out. Frames to send wait in a queue of shared buffers until the connection flushes them.
+  //
+  // Each session is subscribed to one channel, the path it was upgraded on.
+  class WebSocketSession
+  {
+  public: // data
+
+    static const std::size_t MaxMessageLength = 1024u * 1024u;
+
+    // Bytes of frames queued for a client before it is treated as having stopped reading and is dropped, so a
+    // stalled subscriber cannot make broadcasts grow without bound.
+    static const std::size_t MaxQueuedLength = 4u * 1024u * 1024u;
+
+    static const unsigned PingIntervalSeconds = 30;
+
+    // A client that has not answered a ping in this long is dropped.
+    static const unsigned PongTimeoutSeconds = 10;
+
+  private: // data
+
+    std::string channel;
+    std::string control;
+    bool isAbandoned;
+    bool isClosing;
+    bool isMessageBinary;
+    bool isMessageStarted;
+    bool isPongAwaited;
+    std::string message;
+    std::deque<WebSocketFrame> output;
+    std::size_t outputOffset;
+    long long pingTime;
+    std::size_t queuedLength;
+
+  public: // methods
+
+    WebSocketSession(WebSocketSession&& b)
+    {
+      *this = std::move(b);
+    }
+
+    WebSocketSession& operator=(WebSocketSession&& b)
+    {
+      channel = std::move(b.channel);
+      control = std::move(b.control);
+      isAbandoned = b.isAbandoned;
+      isClosing = b.isClosing;
+      isMessageBinary = b.isMessageBinary;
+      isMessageStarted = b.isMessageStarted;
+      isPongAwaited = b.isPongAwaited;
+      message = std::move(b.message);
+      output = std::move(b.output);
+      outputOffset = b.outputOffset;
+      pingTime = b.pingTime;
+      queuedLength = b.queuedLength;
+
+      b.outputOffset = 0;
+      b.queuedLength = 0;
+
+      return *this;
+    }
+
+    // The first ping goes out PingIntervalSeconds after now.
+    WebSocketSession(std::string channel_, long long now) :
+      channel(std::move(channel_)),
+      isAbandoned(false),
+      isClosing(false),
+      isMessageBinary(false),
+      isMessageStarted(false),
+      isPongAwaited(false),
+      outputOffset(0),
+      pingTime(now),
+      queuedLength(0)
+    {
+    }
+
+    // Encodes one unfragmented, unmasked server frame.
+    static WebSocketFrame EncodeFrame(WebSocketOpcode::Value opcode, char const* data, std::size_t length)
+    {
+      auto frame = std::make_shared<std::string>();
+      frame->reserve(length + 10);
+      frame->push_back(static_cast<char>(0x80 | opcode)); // FIN
+
+      if (length < 126)
+      {
+        frame->push_back(static_cast<char>(length));
+      }
+      else if (length <= 0xFFFF)
+      {
+        frame->push_back(static_cast<char>(126));
+        frame->push_back(static_cast<char>((length >> 8) & 0xFF));
+        frame->push_back(static_cast<char>(length & 0xFF));
+      }
+      else
+      {
+        frame->push_back(static_cast<char>(127));
+        auto longLength = static_cast<unsigned long long>(length);
+        for (auto shift = 56; shift >= 0; shift -= 8)
+        {
+          frame->push_back(static_cast<char>((longLength >> shift) & 0xFF));
+        }
+      }
+
+      frame->append(data, length);
+      return frame;
+    }
+
+    // Writes as much of the queue as the connection takes without blocking. send(data, offset) sends from
+    // data[offset..] and returns the number of bytes it sent. Returns true once nothing is left.
+    template <typename Send>
+    bool Flush(Send send)
+    {
+      while (!output.empty())
+      {
+        auto& frame = *output.front();
+        outputOffset += send(frame, outputOffset);
+        if (outputOffset < frame.size())
+        {
+          return false;
+        }
+
+        queuedLength -= frame.size();
+        output.pop_front();
+        outputOffset = 0;
+      }
+
+      return true;
+    }
+
+    // Value of Sec-WebSocket-Accept for a client's Sec-WebSocket-Key.
+    static std::string GetAcceptKey(std::string const& key)
+    {
+      auto text = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+      auto digest = Sha1::Hash(text.data(), text.size());
+      return Base64::Encode(digest.data(), digest.size());
+    }
+
+    std::string const& GetChannel() const
+    {
+      return channel;
+    }
+
+    // True once the connection should be closed: the close handshake is done and flushed, or the client stopped
+    // reading or answering pings.
+    bool IsFinished() const
+    {
+      return isAbandoned || (isClosing && output.empty());
+    }
+
+    // Takes the next complete message out of input, answering any control frames on the way. Returns false if none
+    // has fully arrived. A protocol violation starts the close handshake; no messages are read after that.
+    bool ReadMessage(ReceiveBuffer& input, std::string& data, bool& isBinary)
+    {
+      static const std::size_t maskLength = 4;
+
+      while (!isClosing && input.GetSize() >= 2)
+      {
+        auto first = static_cast<unsigned char>(input[0]);
+        auto second = static_cast<unsigned char>(input[1]);
+        auto isFinal = (first & 0x80) != 0;
+        auto opcode = first & 0x0F;
+        auto isControl = (opcode & 0x8) != 0;
+
+        // No extensions are negotiated, so the reserved bits must be clear, and every client frame is masked.
+        if ((first & 0x70) != 0 || (second & 0x80) == 0)
+        {
+          Close(WebSocketCloseCode::ProtocolError);
+          break;
+        }
+
+        auto length = static_cast<unsigned long long>(second & 0x7F);
+        auto headerLength = 2 + (length == 126 ? 2 : length == 127 ? 8 : 0) + maskLength;
+        if (input.GetSize() < headerLength)
+        {
+          break;
+        }
+        if (length >= 126)
+        {
+          length = 0;
+          for (auto i = 2u; i < headerLength - maskLength; ++i)
+          {
+            length = (length << 8) | static_cast<unsigned char>(input[i]);
+          }
+        }
+
+        if (isControl ? (!isFinal || length > 125 || opcode > WebSocketOpcode::Pong) :
+          opcode == WebSocketOpcode::Continuation ? !isMessageStarted :
+          isMessageStarted || opcode > WebSocketOpcode::Binary)
+        {
+          Close(WebSocketCloseCode::ProtocolError);
+          break;
+        }
+        if (!isControl && length > MaxMessageLength - message.size())
+        {
+          Close(WebSocketCloseCode::MessageTooBig);
+          break;
+        }
+        if (input.GetSize() < headerLength + length)
+        {
+          break;
+        }
+
+        unsigned char mask[maskLength];
+        for (auto i = 0u; i < maskLength; ++i)
+        {
+          mask[i] = static_cast<unsigned char>(input[headerLength - maskLength + i]);
+        }
+
+        auto& payload = isControl ? control : message;
+        if (isControl)
+        {
+          control.clear();
+        }
+        auto start = payload.size();
+        input.CopyTo(headerLength, static_cast<std::size_t>(length), payload);
+        input.Consume(headerLength + static_cast<std::size_t>(length));
+        if (length > 0)
+        {
+          Unmask(&payload[start], static_cast<std::size_t>(length), mask);
+        }
+
+        if (isControl)
+        {
+          HandleControl(static_cast<WebSocketOpcode::Value>(opcode));
+          continue;
+        }
+
+        if (opcode != WebSocketOpcode::Continuation)
+        {
+          isMessageBinary = opcode == WebSocketOpcode::Binary;
+          isMessageStarted = true;
+        }
+        if (!isFinal)
+        {
+          continue;
+        }
+
+        isMessageStarted = false;
+        if (!isMessageBinary && !IsValidUtf8(message))
+        {
+          Close(WebSocketCloseCode::InvalidData);
+          break;
+        }
+
+        data.swap(message);
+        message.clear();
+        isBinary = isMessageBinary;
+        return true;
+      }
+
+      return false;
+    }
+
+    // Queues a frame. Returns false if the session is closing, or if the client has fallen so far behind that it
+    // is dropped instead.
+    bool Send(WebSocketFrame const& frame)
+    {
+      if (isClosing || isAbandoned)
+      {
+        return false;
+      }
+      if (queuedLength + frame->size() > MaxQueuedLength)
+      {
+        isAbandoned = true;
+        return false;
+      }
+
+      queuedLength += frame->size();
+      output.push_back(frame);
+      return true;
+    }
+
+    // XORs data with the repeating 4-byte mask, 16 bytes at a time where SSE2 or NEON is available.
+    static void Unmask(char* data, std::size_t length, unsigned char const* mask)
+    {
+      auto bytes = reinterpret_cast<unsigned char*>(data);
+      auto i = std::size_t();
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+      unsigned char pattern[16];
+      for (auto j = 0u; j < 16; ++j)
+      {
+        pattern[j] = mask[j % 4];
+      }
+
+      auto key = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pattern));
+      for (; i + 16 <= length; i += 16)
+      {
+        auto block = reinterpret_cast<__m128i*>(bytes + i);
+        _mm_storeu_si128(block, _mm_xor_si128(_mm_loadu_si128(block), key));
+      }
+#elif defined(__ARM_NEON)
+      unsigned char pattern[16];
+      for (auto j = 0u; j < 16; ++j)
+      {
+        pattern[j] = mask[j % 4];
+      }
+
+      auto key = vld1q_u8(pattern);
+      for (; i + 16 <= length; i += 16)
+      {
+        vst1q_u8(bytes + i, veorq_u8(vld1q_u8(bytes + i), key));
+      }
+#else
+      unsigned long long pattern;
+      unsigned char patternBytes[8];
+      for (auto j = 0u; j < 8; ++j)
+      {
+        patternBytes[j] = mask[j % 4];
+      }
+      std::memcpy(&pattern, patternBytes, sizeof(pattern));
+
+      for (; i + 8 <= length; i += 8)
+      {
+        unsigned long long word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        word ^= pattern;
+        std::memcpy(bytes + i, &word, sizeof(word));
+      }
+#endif
+
+      // Every block above is a multiple of the mask length, so the tail is still aligned with the mask.
+      for (; i < length; ++i)
+      {
+        bytes[i] ^= mask[i % 4];
+      }
+    }
+
+    // Runs the keep-alive timer: sends a ping every PingIntervalSeconds and abandons a client that does not answer
+    // within PongTimeoutSeconds.
+    void Update(long long now)
+    {
+      static const auto pingInterval = TraceClock::FromMicroseconds(PingIntervalSeconds * 1000000.0);
+      static const auto pongTimeout = TraceClock::FromMicroseconds(PongTimeoutSeconds * 1000000.0);
+
+      if (isPongAwaited)
+      {
+        isAbandoned = isAbandoned || now - pingTime > pongTimeout;
+      }
+      else if (now - pingTime >= pingInterval && Send(EncodeFrame(WebSocketOpcode::Ping, NULL, 0)))
+      {
+        isPongAwaited = true;
+        pingTime = now;
+      }
+    }
+
+  private: // methods
+
+    WebSocketSession(WebSocketSession const&);
+    WebSocketSession& operator=(WebSocketSession const&);
+
+    // Starts the close handshake. The connection is closed once the close frame is flushed.
+    void Close(WebSocketCloseCode::Value code)
+    {
+      char payload[2] = { static_cast<char>((code >> 8) & 0xFF), static_cast<char>(code & 0xFF) };
+      Send(EncodeFrame(WebSocketOpcode::Close, payload, sizeof(payload)));
+      isClosing = true;
+    }
+
+    void HandleControl(WebSocketOpcode::Value opcode)
+    {
+      switch (opcode)
+      {
+      case WebSocketOpcode::Close:
+        if (control.size() == 1)
+        {
+          Close(WebSocketCloseCode::ProtocolError);
+          break;
+        }
+
+        // Echo the client's status code, as the close handshake expects.
+        Send(EncodeFrame(WebSocketOpcode::Close, control.data(), control.size() < 2 ? 0 : 2));
+        isClosing = true;
+        break;
+
+      case WebSocketOpcode::Ping:
+        Send(EncodeFrame(WebSocketOpcode::Pong, control.data(), control.size()));
+        break;
+
+      case WebSocketOpcode::Pong:
+        isPongAwaited = false;
+        break;
+
+      default:
+        break;
+      }
+    }
+
+    static bool IsValidUtf8(std::string const& text)
+    {
+      auto bytes = reinterpret_cast<unsigned char const*>(text.data());
+      auto end = bytes + text.size();
+
+      while (bytes < end)
+      {
+        // Skip ASCII eight bytes at a time.
+        if (end - bytes >= 8)
+        {
+          unsigned long long word;
+          std::memcpy(&word, bytes, sizeof(word));
+          if ((word & 0x8080808080808080ull) == 0)
+          {
+            bytes += 8;
+            continue;
+          }
+        }
+
+        auto c = *bytes;
+        if (c < 0x80)
+        {
+          ++bytes;
+          continue;
+        }
+
+        auto count = 0;
+        auto codePoint = 0u;
+        auto minimum = 0u;
+        if ((c & 0xE0) == 0xC0)
+        {
+          count = 1;
+          codePoint = c & 0x1F;
+          minimum = 0x80;
+        }
+        else if ((c & 0xF0) == 0xE0)
+        {
+          count = 2;
+          codePoint = c & 0x0F;
+          minimum = 0x800;
+        }
+        else if ((c & 0xF8) == 0xF0)
+        {
+          count = 3;
+          codePoint = c & 0x07;
+          minimum = 0x10000;
+        }
+        else
+        {
+          return false;
+        }
+
+        if (end - bytes <= count)
+        {
+          return false;
+        }
+        for (auto i = 1; i <= count; ++i)
+        {
+          if ((bytes[i] & 0xC0) != 0x80)
+          {
+            return false;
+          }
+          codePoint = (codePoint << 6) | (bytes[i] & 0x3F);
+        }
+
+        // Reject overlong forms, UTF-16 surrogates and code points past Unicode.
+        if (codePoint < minimum || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+        {
+          return false;
+        }
+        bytes += count + 1;
+      }
+
+      return true;
+    }
+  };
+} // namespace OlympusWebServer
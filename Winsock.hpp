@@ -1,7 +1,45 @@
 #pragma once
 
 #include <stdexcept>
+#include <string>
+#include "Threading.hpp"
+
+#ifdef _WIN32
 #include <WinSock2.h>
+#include <WS2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Winsock names used by the socket layer, mapped onto BSD sockets.
+typedef int SOCKET;
+
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define SD_BOTH SHUT_RDWR
+
+#define WSAECONNABORTED ECONNABORTED
+#define WSAECONNREFUSED ECONNREFUSED
+#define WSAECONNRESET ECONNRESET
+#define WSAEINPROGRESS EINPROGRESS
+#define WSAENETRESET ENETRESET
+#define WSAENOTCONN ENOTCONN
+#define WSAESHUTDOWN ESHUTDOWN
+#define WSAETIMEDOUT ETIMEDOUT
+#define WSAEWOULDBLOCK EWOULDBLOCK
+
+inline int WSAGetLastError()
+{
+  return errno;
+}
+#endif
 
 #ifdef _MSC_VER
 #pragma comment(lib, "ws2_32.lib")
@@ -13,33 +51,94 @@ namespace OlympusWebServer
   {
   public: // methods
 
-    static bool Accept(SOCKET socket, sockaddr_in address, SOCKET& newSocket)
+    // Accepts a connection and puts it in the requested blocking mode. On Linux, accept4 does both (and sets
+    // close-on-exec) in a single system call. The peer's address is written to address, if given.
+    static bool Accept(
+      SOCKET socket,
+      SOCKET& newSocket,
+      bool blocking,
+      sockaddr* address = NULL,
+      socklen_t* addressLength = NULL)
     {
-      auto addressSize = static_cast<int>(sizeof(address));
-      newSocket = accept(socket, (sockaddr*) &address, &addressSize);
+      CountCall();
+#ifdef __linux__
+      newSocket = accept4(socket, address, addressLength, SOCK_CLOEXEC | (blocking ? 0 : SOCK_NONBLOCK));
       return newSocket != INVALID_SOCKET;
+#else
+      newSocket = accept(socket, address, addressLength);
+      if (newSocket == INVALID_SOCKET)
+      {
+        return false;
+      }
+
+      if (!IoctlSocket(newSocket, blocking))
+      {
+        DestroySocket(newSocket);
+        newSocket = INVALID_SOCKET;
+        return false;
+      }
+
+      return true;
+#endif
     }
 
     static bool Bind(SOCKET socket, sockaddr_in address)
     {
-      return bind(socket, (sockaddr*) &address, sizeof(address)) != SOCKET_ERROR;
+      return Bind(socket, (sockaddr const*) &address, sizeof(address));
+    }
+
+    static bool Bind(SOCKET socket, sockaddr const* address, socklen_t addressLength)
+    {
+      CountCall();
+      return bind(socket, address, addressLength) != SOCKET_ERROR;
+    }
+
+    static bool Connect(SOCKET socket, sockaddr_in address)
+    {
+      return Connect(socket, (sockaddr const*) &address, sizeof(address));
+    }
+
+    static bool Connect(SOCKET socket, sockaddr const* address, socklen_t addressLength)
+    {
+      CountCall();
+      return connect(socket, address, addressLength) != SOCKET_ERROR;
+    }
+
+    // Creates a stream socket: TCP for AF_INET and AF_INET6, or a Unix domain socket for AF_UNIX.
+    static SOCKET CreateStreamSocket(int family)
+    {
+      CountCall();
+      return ::socket(family, SOCK_STREAM, family == AF_INET || family == AF_INET6 ? IPPROTO_TCP : 0);
     }
 
     static SOCKET CreateTcpSocket()
     {
-      return ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+      return CreateStreamSocket(AF_INET);
     }
 
     static bool DestroySocket(SOCKET socket)
     {
-      return shutdown(socket, SD_BOTH) != SOCKET_ERROR && closesocket(socket) != SOCKET_ERROR;
+      // shutdown fails on listening and already-reset sockets; the descriptor still has to be released.
+      CountCall(2);
+      shutdown(socket, SD_BOTH);
+#ifdef _WIN32
+      return closesocket(socket) != SOCKET_ERROR;
+#else
+      return close(socket) != SOCKET_ERROR;
+#endif
+    }
+
+    // Number of socket calls made by the calling thread, each of which is a system call.
+    static unsigned long long GetCallCount()
+    {
+      return CallCount();
     }
 
     static sockaddr_in GetLoopbackAddress()
     {
       auto loopbackAddress = sockaddr_in();
       loopbackAddress.sin_family = AF_INET;
-      loopbackAddress.sin_addr.S_un.S_addr = inet_addr("127.0.0.1");
+      loopbackAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
 
       return loopbackAddress;
     }
@@ -60,45 +159,127 @@ namespace OlympusWebServer
 
     static bool IoctlSocket(SOCKET socket, bool blocking)
     {
+      CountCall();
+#ifdef _WIN32
       auto blockingMode = blocking ? 0ul : 1ul;
       return ::ioctlsocket(socket, FIONBIO, &blockingMode) != SOCKET_ERROR;
+#else
+      auto blockingMode = blocking ? 0 : 1;
+      return ::ioctl(socket, FIONBIO, &blockingMode) != SOCKET_ERROR;
+#endif
     }
 
-    static bool Listen(SOCKET socket)
+    static bool Listen(SOCKET socket, int backlog)
     {
-      static const int backlog = 32;
+      CountCall();
       return ::listen(socket, backlog) != SOCKET_ERROR;
     }
 
+    static int Poll(pollfd* descriptors, std::size_t count, int timeoutMilliseconds)
+    {
+      CountCall();
+#ifdef _WIN32
+      return WSAPoll(descriptors, static_cast<ULONG>(count), timeoutMilliseconds);
+#else
+      return poll(descriptors, static_cast<nfds_t>(count), timeoutMilliseconds);
+#endif
+    }
+
+    // Waits until the socket is writable, returning 1 if it is, 0 on timeout and SOCKET_ERROR on failure. Uses
+    // poll rather than select, whose fd_set cannot hold descriptors past FD_SETSIZE.
+    static int PollWrite(SOCKET socket, int timeoutMilliseconds)
+    {
+      auto descriptor = pollfd();
+      descriptor.fd = socket;
+      descriptor.events = POLLOUT;
+
+      auto result = Poll(&descriptor, 1, timeoutMilliseconds);
+      if (result > 0 && (descriptor.revents & POLLOUT) == 0)
+      {
+        return 0;
+      }
+
+      return result;
+    }
+
+    static int Receive(SOCKET socket, char* buffer, std::size_t length)
+    {
+      CountCall();
+      return static_cast<int>(recv(socket, buffer, static_cast<int>(length), 0));
+    }
+
     template <std::size_t BufferLength>
     static int Receive(SOCKET socket, char (&buffer)[BufferLength])
     {
-      return recv(socket, buffer, BufferLength, 0);
+      CountCall();
+      return static_cast<int>(recv(socket, buffer, BufferLength, 0));
+    }
+
+    static bool SetOption(SOCKET socket, int level, int name, int value)
+    {
+      CountCall();
+      return setsockopt(socket, level, name, (char const*) &value, sizeof(value)) != SOCKET_ERROR;
+    }
+
+    static int Send(SOCKET socket, char const* data, std::size_t length)
+    {
+      CountCall();
+#ifdef _WIN32
+      return send(socket, data, static_cast<int>(length), 0);
+#else
+      // A peer that has gone away must surface as EPIPE rather than killing the process with SIGPIPE.
+      return static_cast<int>(send(socket, data, length, MSG_NOSIGNAL));
+#endif
     }
 
     static int Send(SOCKET socket, std::string const& data)
     {
-      return send(socket, data.data(), data.size(), 0);
+      return Send(socket, data.data(), data.size());
     }
 
+#ifdef __linux__
+    // Moves up to length bytes from one descriptor to another without copying them through user space. One side
+    // must be a pipe. Never blocks; returns -1 with EWOULDBLOCK if nothing can move yet.
+    static long Splice(int from, int to, std::size_t length)
+    {
+      CountCall();
+      return static_cast<long>(splice(from, NULL, to, NULL, length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+    }
+#endif
+
   private: // methods
 
+    static unsigned long long& CallCount()
+    {
+      static OLYMPUS_THREAD_LOCAL unsigned long long callCount = 0;
+      return callCount;
+    }
+
+    static void CountCall(unsigned calls = 1)
+    {
+      CallCount() += calls;
+    }
+
     Winsock()
     {
+#ifdef _WIN32
       auto winsockData = WSADATA();
       auto result = WSAStartup(WINSOCK_VERSION, &winsockData);
       if (result != 0)
       {
         throw std::runtime_error("Winsock.Winsock - WSAStartup failed");
       }
+#endif
     }
 
     ~Winsock()
     {
+#ifdef _WIN32
       if (WSACleanup() == SOCKET_ERROR)
       {
         throw std::runtime_error("Winsock.~Winsock - WSACleanup failed");
       }
+#endif
     }
   };
 